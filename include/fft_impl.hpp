@@ -21,11 +21,56 @@ Fast Fourier/Cosine/Sine Transform
     data        :inplace
     table       :use
 functions
+    cdft: Complex Discrete Fourier Transform
     rdft: Real Discrete Fourier Transform
 function prototypes
+    void cdft(int, int, float *, int *, float *);
     void rdft(int, int, float *, int *, float *);
 
 
+-------- Complex DFT (Discrete Fourier Transform) --------
+    [definition]
+        <case1>
+            X[k] = sum_j=0^n-1 x[j]*exp(2*pi*i*j*k/n), 0<=k<n
+        <case2>
+            X[k] = sum_j=0^n-1 x[j]*exp(-2*pi*i*j*k/n), 0<=k<n
+        (notes: sum_j=0^n-1 is a summation from j=0 to n-1)
+    [usage]
+        <case1>
+            ip[0] = 0; // first time only
+            cdft(2*n, 1, a, ip, w);
+        <case2>
+            ip[0] = 0; // first time only
+            cdft(2*n, -1, a, ip, w);
+    [parameters]
+        2*n            :data length (int)
+                        n >= 1, n = power of 2
+        a[0...2*n-1]   :input/output data (float *)
+                        input data
+                            a[2*j] = Re(x[j]),
+                            a[2*j+1] = Im(x[j]), 0<=j<n
+                        output data
+                            a[2*k] = Re(X[k]),
+                            a[2*k+1] = Im(X[k]), 0<=k<n
+        ip[0...*]      :work area for bit reversal (int *)
+                        length of ip >= 2+sqrt(n)
+                        strictly,
+                        length of ip >=
+                            2+(1<<(int)(log(n+0.5)/log(2))/2).
+                        ip[0],ip[1] are pointers of the cos/sin table.
+        w[0...n/2-1]   :cos/sin table (float *)
+                        w[],ip[] are initialized if ip[0] == 0.
+    [remark]
+        Inverse of
+            cdft(2*n, -1, a, ip, w);
+        is
+            cdft(2*n, 1, a, ip, w);
+            for (j = 0; j <= 2 * n - 1; j++) {
+                a[j] *= 1.0 / n;
+            }
+        .
+
+
 -------- Real DFT / Inverse of Real DFT --------
     [definition]
         <case1> RDFT
@@ -84,15 +129,40 @@ Appendix :
 #include <algorithm>
 #include <cmath>
 
+void cdft(int n, int isgn, float *a, int *ip, float *w)
+{
+    void makewt(int nw, int *ip, float *w);
+    void bitrv2(int n, int *ip, float *a);
+    void bitrv2conj(int n, int *ip, float *a);
+    void cftfsub(int n, float *a, const float *w);
+    void cftbsub(int n, float *a, const float *w);
+
+    if (n > (ip[0] << 2)) {
+        makewt(n >> 2, ip, w);
+    }
+    if (n > 4) {
+        if (isgn >= 0) {
+            bitrv2(n, ip + 2, a);
+            cftfsub(n, a, w);
+        } else {
+            bitrv2conj(n, ip + 2, a);
+            cftbsub(n, a, w);
+        }
+    } else if (n == 4) {
+        cftfsub(n, a, w);
+    }
+}
+
+
 void rdft(int n, int isgn, float *a, int *ip, float *w)
 {
     void makewt(int nw, int *ip, float *w);
     void makect(int nc, int *ip, float *c);
     void bitrv2(int n, int *ip, float *a);
-    void cftfsub(int n, float *a, float *w);
-    void cftbsub(int n, float *a, float *w);
-    void rftfsub(int n, float *a, int nc, float *c);
-    void rftbsub(int n, float *a, int nc, float *c);
+    void cftfsub(int n, float *a, const float *w);
+    void cftbsub(int n, float *a, const float *w);
+    void rftfsub(int n, float *a, int nc, const float *c);
+    void rftbsub(int n, float *a, int nc, const float *c);
     int nw, nc;
     float xi;
 
@@ -130,6 +200,27 @@ void rdft(int n, int isgn, float *a, int *ip, float *w)
     }
 }
 
+/*
+    rdftForward: forward rdft() over a table built beforehand for n (by
+    rdft() itself or at compile time), which is only read. ip[2...] is
+    still the bit reversal work area; ip[0] and ip[1] are not used. n >= 8.
+*/
+void rdftForward(int n, float *a, int *ip, const float *w)
+{
+    void bitrv2(int n, int *ip, float *a);
+    void cftfsub(int n, float *a, const float *w);
+    void rftfsub(int n, float *a, int nc, const float *c);
+    int nw = n >> 2;
+    float xi;
+
+    bitrv2(n, ip + 2, a);
+    cftfsub(n, a, w);
+    rftfsub(n, a, nw, w + nw);
+    xi = a[0] - a[1];
+    a[0] += a[1];
+    a[1] = xi;
+}
+
 /* -------- initializing routines -------- */
 
 #include <math.h>
@@ -395,10 +486,10 @@ void bitrv2conj(int n, int *ip, float *a)
 }
 
 
-void cftfsub(int n, float *a, float *w)
+void cftfsub(int n, float *a, const float *w)
 {
-    void cft1st(int n, float *a, float *w);
-    void cftmdl(int n, int l, float *a, float *w);
+    void cft1st(int n, float *a, const float *w);
+    void cftmdl(int n, int l, float *a, const float *w);
     int j, j1, j2, j3, l;
     float x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
 
@@ -448,10 +539,10 @@ void cftfsub(int n, float *a, float *w)
 }
 
 
-void cftbsub(int n, float *a, float *w)
+void cftbsub(int n, float *a, const float *w)
 {
-    void cft1st(int n, float *a, float *w);
-    void cftmdl(int n, int l, float *a, float *w);
+    void cft1st(int n, float *a, const float *w);
+    void cftmdl(int n, int l, float *a, const float *w);
     int j, j1, j2, j3, l;
     float x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
 
@@ -500,7 +591,7 @@ void cftbsub(int n, float *a, float *w)
 }
 
 
-void cft1st(int n, float *a, float *w)
+void cft1st(int n, float *a, const float *w)
 {
     int j, k1, k2;
     float wk1r, wk1i, wk2r, wk2i, wk3r, wk3i;
@@ -605,7 +696,7 @@ void cft1st(int n, float *a, float *w)
 }
 
 
-void cftmdl(int n, int l, float *a, float *w)
+void cftmdl(int n, int l, float *a, const float *w)
 {
     int j, j1, j2, j3, k, k1, k2, m, m2;
     float wk1r, wk1i, wk2r, wk2i, wk3r, wk3i;
@@ -732,7 +823,7 @@ void cftmdl(int n, int l, float *a, float *w)
 }
 
 
-void rftfsub(int n, float *a, int nc, float *c)
+void rftfsub(int n, float *a, int nc, const float *c)
 {
     int j, k, kk, ks, m;
     float wkr, wki, xr, xi, yr, yi;
@@ -757,7 +848,7 @@ void rftfsub(int n, float *a, int nc, float *c)
 }
 
 
-void rftbsub(int n, float *a, int nc, float *c)
+void rftbsub(int n, float *a, int nc, const float *c)
 {
     int j, k, kk, ks, m;
     float wkr, wki, xr, xi, yr, yi;
@@ -3,8 +3,18 @@
 #include <vector>
 #include <string>
 #include <complex>
-#include <deque>  // Add this include for std::deque
+#include <list>
+#include <unordered_map>
+#include <memory>
 #include "../src/reed-solomon/rs.hpp"
+#include "../src/core/baseband.h"
+#include "../src/core/thread_pool.h"
+#include "../src/core/arena.h"
+#include "../src/core/bitstream.h"
+#include "../src/core/frame.h"
+#include "../src/core/diagnostics.h"
+
+class ChaCha20Poly1305;
 
 class RiifUltrasonic {
 public:
@@ -12,26 +22,141 @@ public:
     ~RiifUltrasonic();
     
     std::vector<int16_t> encode(const std::string& message);
+
+    // Pull-based encoding for audio output callbacks: prepare() encodes the message, then each
+    // render() synthesizes the next block on demand and returns the frames written, fewer
+    // than asked once the transmission is over. Returns false if no codec is configured.
+    bool prepare(const std::string& message);
+    size_t render(int16_t* out, size_t frames);
+    size_t pendingFrames() const;
+
+    // Largest message that goes out unclipped with the current parameters
+    size_t messageCapacity() const;
+
+    // Authenticated payloads: prepareSealed() encrypts the payload straight into the codec's
+    // message block with the tag behind it, so up to messageCapacity() - 16 bytes fit.
+    // openSealed() corrects decoded bits and decrypts straight from the message block into
+    // payload; the receiver has to know the payload length. Both return false on any failure.
+    bool prepareSealed(const ChaCha20Poly1305& aead, const uint8_t* nonce, const uint8_t* payload, size_t length);
+    bool openSealed(const BitStream& bits, const ChaCha20Poly1305& aead, const uint8_t* nonce,
+                    uint8_t* payload, size_t length);
+    bool openSealed(const std::vector<bool>& bits, const ChaCha20Poly1305& aead, const uint8_t* nonce,
+                    uint8_t* payload, size_t length);
+
+    // Many messages encoded in parallel on the shared thread pool into one arena: message i
+    // occupies samples [offsets[i], offsets[i + 1]). Same output as encode() per message.
+    struct EncodedBatch {
+        std::vector<int16_t> samples;
+        std::vector<size_t> offsets;
+    };
+    EncodedBatch encodeBatch(const std::vector<std::string>& messages);
+    EncodedBatch encodeBatch(const std::string* messages, size_t count);
     std::vector<bool> decode(const std::vector<int16_t>& signal);
+    // Decode a capture taken at captureRate (e.g. 44100 on many Android devices) without
+    // resampling it; the symbol timing still follows Parameters::sampleRate
+    std::vector<bool> decode(const std::vector<int16_t>& signal, int captureRate);
+    // Decode straight from caller-owned samples (e.g. a memory-mapped file), without copying
+    std::vector<bool> decode(const int16_t* samples, size_t count, int captureRate);
+    // Packed output: the receive path appends whole bits into words, bytes come out 8 at a time
+    void decode(const int16_t* samples, size_t count, int captureRate, BitStream& bits);
+
+    // Corrects decoded bits back into the message: with shortened codewords the bytes that were
+    // sent, otherwise the whole zero-padded block. Empty if the codeword cannot be corrected.
+    std::vector<uint8_t> decodeMessage(const BitStream& bits);
+    std::vector<uint8_t> decodeMessage(const std::vector<bool>& bits);
+
+    // Incremental decoding next to receive(): feedFrame() takes the bits appended since the
+    // last call and folds each completed byte into the Reed-Solomon syndromes, so when the last
+    // byte lands a clean codeword is already known to be clean and only error location is left
+    // for a damaged one. feedFrame() returns true once the frame is complete or cannot be, and
+    // finishFrame() then returns what decodeMessage() would.
+    void beginFrame();
+    bool feedFrame(const BitStream& bits);
+    bool feedFrame(const std::vector<bool>& bits);
+    std::vector<uint8_t> finishFrame();
+
+    // Streaming receive for captures of any length: samples may be fed in blocks of any size
+    // and bits are appended as soon as the receiver's lookahead (about one sub-window of the
+    // noise tracker) has been seen. Memory stays bounded by that lookahead.
+    bool beginReceive(int captureRate);
+    void receive(const int16_t* samples, size_t count, BitStream& bits);
+    void receive(const int16_t* samples, size_t count, std::vector<bool>& bits);
+    void endReceive(BitStream& bits);
+    void endReceive(std::vector<bool>& bits);
 
     struct Parameters {
-        int sampleRate;
-        int samplesPerFrame;
-        int nBitsInMarker;
-        int nMarkerFrames;
-        double f0;
-        double df;
-        int numFreqs;
-        int rsMsgLength;
-        int rsEccLength;
-        int preambleDuration;
+        int sampleRate = DEFAULT_SAMPLE_RATE;
+        int samplesPerFrame = DEFAULT_SAMPLES_PER_FRAME;
+        int nBitsInMarker = DEFAULT_BITS_IN_MARKER;
+        int nMarkerFrames = DEFAULT_MARKER_FRAMES;
+        double f0 = DEFAULT_F0;
+        double df = DEFAULT_DF;
+        int numFreqs = DEFAULT_NUM_FREQS;
+        int rsMsgLength = DEFAULT_RS_MSG_LENGTH;
+        int rsEccLength = DEFAULT_RS_ECC_LENGTH;
+        int preambleDuration = DEFAULT_PREAMBLE_DURATION;
+        int analysisHop = 0;  // STFT hop in samples, 0 selects samplesPerFrame / 4
+        // Send only the message bytes and the parity behind a length header instead of the
+        // whole zero-padded codeword; the padding is restored by the receiver
+        bool shortenCodewords = false;
+        // Tone plans for encodeOnChannel(): channel k moves both tones up by k * 2 * df
+        int planChannels = DEFAULT_PLAN_CHANNELS;
+
+        bool operator==(const Parameters& other) const
+        {
+            return sampleRate == other.sampleRate && samplesPerFrame == other.samplesPerFrame &&
+                   nBitsInMarker == other.nBitsInMarker && nMarkerFrames == other.nMarkerFrames &&
+                   f0 == other.f0 && df == other.df && numFreqs == other.numFreqs &&
+                   rsMsgLength == other.rsMsgLength && rsEccLength == other.rsEccLength &&
+                   preambleDuration == other.preambleDuration && analysisHop == other.analysisHop &&
+                   shortenCodewords == other.shortenCodewords && planChannels == other.planChannels;
+        }
+        bool operator!=(const Parameters& other) const { return !(*this == other); }
     };
 
+    // Registers and selects a profile for these parameters
     void setParameters(const Parameters& params);
     const Parameters& getParameters() const;
 
+    // Profiles for devices that hop between configurations: registerProfile() builds the
+    // codec, tables and front end for a parameter set once (or returns the id it already
+    // has), and selectProfile() switches to it without rebuilding or allocating anything.
+    // Switching abandons a receive in progress.
+    int registerProfile(const Parameters& params);
+    bool selectProfile(int id);
+    int activeProfile() const;  // -1 until a profile is selected
+
+    // Carrier offset (Hz) estimated by the last decode
+    double getFrequencyOffset() const;
+
+    // Adaptive tone plans. surveyBand() measures the noise under both tones of every plan
+    // channel over a listen window (no transmission) and picks the quietest channel.
+    // encodeOnChannel() sends the frame on a channel behind a plan header, the channel number
+    // as one Hamming (8,4) byte sent on every channel at once. readPlanHeader() reads it from
+    // a capture that starts with the transmission, on each channel, and returns the channel
+    // most of them announce (-1 if none can be read); decodeAdaptive() then corrects the frame
+    // on that channel. A capture whose header reads on no channel is not decoded, as trying
+    // every channel would cost a full decode each. The channels are built with the profile
+    // and need planChannels > 1. Empty results on failure; the selected profile and a receive
+    // or frame in progress are left as they were.
+    struct BandSurvey {
+        std::vector<double> noise;  // per channel, the louder of its two tones
+        int best = -1;
+    };
+    BandSurvey surveyBand(const int16_t* samples, size_t count, int captureRate);
+    std::vector<int16_t> encodeOnChannel(const std::string& message, int channel);
+    int readPlanHeader(const int16_t* samples, size_t count, int captureRate);
+    std::vector<uint8_t> decodeAdaptive(const int16_t* samples, size_t count, int captureRate);
+
+    // Field-tuning diagnostics: with frames > 0 the receiver keeps the baseband spectrum of its
+    // last `frames` analysis windows, the tone bins and their noise floors, and its last
+    // `frames` symbol decisions, across decodes. Storage is allocated here, so recording only
+    // copies; 0 turns it off. diagnostics() copies the ring out, see DiagnosticSnapshot for the
+    // PGM spectrogram and binary dumps.
+    void enableDiagnostics(size_t frames);
+    DiagnosticSnapshot diagnostics() const;
+
 private:
-    Parameters m_params;
     static constexpr int DEFAULT_SAMPLE_RATE = 48000;
     static constexpr int DEFAULT_SAMPLES_PER_FRAME = 1024;
     static constexpr int DEFAULT_BITS_IN_MARKER = 16;
@@ -42,24 +167,151 @@ private:
     static constexpr int DEFAULT_RS_MSG_LENGTH = 223;
     static constexpr int DEFAULT_RS_ECC_LENGTH = 32;
     static constexpr int DEFAULT_PREAMBLE_DURATION = 256;
+    static constexpr int DEFAULT_PLAN_CHANNELS = 1;
+
+    // Plan channels are this many tone spacings apart, so neighbouring channels never share a
+    // tone
+    static constexpr int PLAN_CHANNEL_SPACING = 2;
+    static constexpr size_t PLAN_HEADER_BYTES = 1;
+    static constexpr int MAX_PLAN_CHANNELS = 16;  // the header carries one Hamming nibble
+
+    // Bit decision thresholds
+    static constexpr float MAGNITUDE_THRESHOLD = 0.1f;
+    static constexpr float RELATIVE_THRESHOLD = 1.2f;
+
+    // Analysis FFT length
+    static constexpr int FFT_SIZE = 1024;
+
+    // Baseband front end
+    static constexpr int MAX_DECIMATION = 8;
+    static constexpr int MIN_BASEBAND_FRAME = 16;        // baseband samples per symbol
+    static constexpr double BASEBAND_PASSBAND = 0.33;    // alias-free fraction of the output rate, each side
+
+    // Symbol timing loop gains (phase and drift terms of a second-order loop)
+    static constexpr double TIMING_LOOP_GAIN = 0.2;
+    static constexpr double TIMING_DRIFT_GAIN = 0.005;
+    static constexpr size_t ACQUISITION_SYMBOLS = 32;  // symbols used for the initial alignment
+
+    // Carrier offset tracking gain
+    static constexpr double FREQUENCY_LOOP_GAIN = 0.1;
+
+    // Noise floor tracking (minimum statistics over the running-average spectrum)
+    static constexpr int NOISE_FLOOR_SUBWINDOWS = 8;
+    static constexpr int NOISE_FLOOR_SUBWINDOW_FRAMES = 32;
+    static constexpr float NOISE_FLOOR_BIAS = 1.5f;    // compensates the downward bias of a minimum
+    static constexpr float NOISE_FLOOR_MARGIN = 2.0f;  // tone must clear the floor by this factor
+    static constexpr float NOISE_FLOOR_CAP = 0.5f;     // floor never removes more than half the stronger tone
 
-    std::vector<double> m_frequencies;
-    RS::ReedSolomon* rs;
-    uint8_t* rs_work_buffer;
     std::vector<float> m_tx_output;
 
-    void initializeFrequencies();
-    std::vector<uint8_t> rsEncode(const std::vector<uint8_t>& data);
-    std::vector<uint8_t> rsDecode(const std::vector<uint8_t>& encoded_data);
-    void generateTones(const std::vector<uint8_t>& encoded, std::vector<int>& tones);
-    void generateWaveform(const std::vector<int>& tones, std::vector<int16_t>& signal);
+
+    // Transmit state between render() calls
+    struct TransmitState {
+        std::vector<uint8_t> codeword;  // RS output, message block then parity
+        std::vector<uint8_t> frame;     // bytes on the air
+        size_t frameBytes;
+        const int16_t* shape;        // template of the current symbol
+        size_t bit;                  // next frame bit, MSB first
+        int sample;                  // position within the current symbol
+        double phase;
+        size_t padding;              // trailing silence still to emit
+    };
+    void startTransmit(TransmitState& tx) const;
+    size_t loadMessage(const uint8_t* message, size_t length, uint8_t* block) const;
+    void transmitBlock(RS::ReedSolomon& rs, const uint8_t* block, size_t messageLength, TransmitState& tx) const;
+    size_t frameBytes(size_t messageLength) const;
+    size_t transmitFrames(size_t messageLength) const;
+    bool correctFrame(size_t& messageLength);
+    bool openFrame(const ChaCha20Poly1305& aead, const uint8_t* nonce, uint8_t* payload, size_t length);
+    size_t synthesize(TransmitState& tx, int16_t* out, size_t frames) const;
+
+    // Per-worker encoding state for encodeBatch
+    struct BatchWorker {
+        std::vector<uint8_t> rsWork;
+        std::unique_ptr<RS::ReedSolomon> rs;
+        std::vector<uint8_t> data;
+        TransmitState tx;
+    };
+
+    // Symbol templates are rendered for this many start phases per tone
+    static constexpr int SYMBOL_TEMPLATE_PHASES = 16;
+
+    // Most recently used rendered waveforms, keyed by message hash
+    static constexpr size_t WAVEFORM_CACHE_ENTRIES = 4;
+    struct CachedWaveform {
+        size_t key;
+        std::string message;
+        std::vector<int16_t> signal;
+    };
+
+    // Complex baseband front end and its transform for one capture rate, with the scratch of
+    // a single transaction sized to match
+    struct CaptureFrontEnd {
+        int captureRate = 0;
+        BasebandFrontEnd frontend;
+        size_t basebandFrame = 0;  // baseband samples per symbol
+        int basebandFftSize = 0;
+        std::vector<int> basebandFftWorkArea;
+        std::vector<float> basebandFftSinCosTable;
+        std::vector<float> basebandFftBuffer;
+        std::vector<std::complex<float>> basebandSpectrum;
+        Arena scratchArena;
+    };
+
+    // Everything that depends on the parameters, built once per parameter set
+    struct CodecProfile {
+        Parameters params;
+        std::vector<double> frequencies;
+
+        // RS codec, its workspace and the message scratch are carved out of one arena
+        Arena codecArena;
+        RS::ReedSolomon* rs = nullptr;
+        uint8_t* rsWork = nullptr;
+        uint8_t* messageScratch = nullptr;
+        uint8_t* codewordScratch = nullptr;
+
+        // Front ends by capture rate. Each is built the first time its rate is received and
+        // then kept, so alternating rates only moves rx; the native rate's is built with the
+        // profile.
+        std::vector<std::unique_ptr<CaptureFrontEnd>> frontEnds;
+        CaptureFrontEnd* rx = nullptr;
+
+        // Windowed symbol templates, [tone][phase step][sample], and the oscillator phase a
+        // symbol of each tone moves on
+        std::vector<int16_t> symbolTemplates;
+        double symbolAdvance[2] = {};
+        TransmitState tx = {};
+        std::list<CachedWaveform> waveformCache;
+        std::unordered_map<size_t, std::list<CachedWaveform>::iterator> waveformIndex;
+        std::vector<std::unique_ptr<BatchWorker>> batchWorkers;
+
+        // With planChannels > 1, a codec of its own whose profiles are the plan channels in
+        // order, so plan headers and frames are sent and read without touching this codec's
+        // profiles, receive or frame
+        std::unique_ptr<RiifUltrasonic> plan;
+
+        CodecProfile() = default;
+        ~CodecProfile();
+        CodecProfile(const CodecProfile&) = delete;
+        CodecProfile& operator=(const CodecProfile&) = delete;
+    };
+    std::vector<std::unique_ptr<CodecProfile>> m_profiles;
+    std::unique_ptr<CodecProfile> m_default_profile;  // no codec, in use until a profile is selected
+    CodecProfile* m_profile;
+
+    void buildProfile(CodecProfile& profile, const Parameters& params, bool withCodec);
+    Parameters channelParameters(const Parameters& params, int channel) const;
+    bool channelFits(const Parameters& params, int channel, int sampleRate) const;
+    void initializeFrequencies(CodecProfile& profile);
+    void buildSymbolTemplates(CodecProfile& profile);
+
     void addPreamble(std::vector<int16_t>& signal);
 
     // Decoding functions
     size_t detectPreamble(const std::vector<float>& signal);
     std::vector<std::complex<float>> performFFT(const std::vector<float>& frame);
-    std::vector<uint8_t> demodulateFFT(const std::vector<std::complex<float>>& fft_result);
-    int findDominantFrequency(const std::vector<std::complex<float>>& fft_result);
+    int demodulateFFT(const std::vector<std::complex<float>>& fft_result);
+    double findDominantFrequency(const std::vector<std::complex<float>>& spectrum);
 
     void addTone(std::vector<int16_t>& signal, double freq, int duration);
 
@@ -81,11 +333,102 @@ private:
     uint8_t m_current_byte;
     int m_bit_count;
 
-    // Add these new members for spectrum history
-    std::deque<std::vector<std::complex<float>>> m_spectrum_history;
+    // Spectrum history ring of magnitudes, slots are reused so pushing a spectrum does not reallocate
+    std::vector<float> m_spectrum_history;  // SPECTRUM_HISTORY_SIZE slots of m_spectrum_bins
+    size_t m_spectrum_bins;
+    size_t m_spectrum_head;
+    size_t m_spectrum_count;
     static constexpr int SPECTRUM_HISTORY_SIZE = 5;  // You can adjust this value
 
-    // You might want to add or modify these function declarations
-    std::vector<float> calculateAverageSpectrum();
-    std::vector<float> normalizeSpectrum(const std::vector<float>& spectrum);
+    // Running sum over the history ring, updated by adding the newest and subtracting the oldest slot
+    std::vector<double> m_spectrum_sum;
+    std::vector<float> m_avg_spectrum;
+    std::vector<float> m_normalized_spectrum;
+
+    // Per-bin noise floor
+    std::vector<float> m_noise_floor;
+    std::vector<float> m_noise_current_min;
+    std::vector<float> m_noise_subwindow_min;
+    std::vector<float> m_noise_past_min;
+    size_t m_noise_frames;
+    size_t m_noise_subwindow;
+
+    // Recent spectra and symbol decisions for enableDiagnostics(), recorded from the history
+    DiagnosticRing m_diagnostics;
+
+    void resetSpectrumHistory(size_t bins);
+    void updateNoiseFloor();
+
+    // Short-time analysis
+    struct ToneFrame {
+        float mag0;
+        float mag1;
+        float floor0;
+        float floor1;
+        float peak;  // dominant frequency in Hz, 0 if none
+    };
+    size_t analysisHop(const Parameters& params) const;
+    void pushSpectrum(const std::vector<std::complex<float>>& spectrum);
+    ToneFrame measureTones(const std::vector<std::complex<float>>& fft_result, size_t bin0_center, size_t bin1_center);
+    ToneFrame measureTonesAt(const std::vector<std::complex<float>>& signal, size_t start, double offset);
+    float toneMagnitude(const std::vector<std::complex<float>>& signal, size_t start, double freq);
+    size_t toneBin(double freq, size_t fft_size) const;
+
+    // Complex baseband: the tone band mixed to 0 Hz and decimated by the profile's front end
+    std::vector<std::complex<float>> m_baseband;
+
+    void selectFrontEnd(CodecProfile& profile, int captureRate);
+    void configureFrontEnd(CaptureFrontEnd& fe, const Parameters& params, int captureRate);
+    const std::vector<std::complex<float>>& performBasebandFFT(const std::complex<float>* samples, size_t count);
+    size_t basebandBin(double freq) const;
+
+    // Carrier frequency offset (Doppler, resampler error)
+    double m_frequency_offset;
+    double acquireFrequencyOffset(const std::vector<ToneFrame>& frames);
+    void trackFrequencyOffset(const std::vector<std::complex<float>>& signal, size_t start, const ToneFrame& tf, int bit);
+    int decideBit(const ToneFrame& tf) const;
+    void analyzeSTFT(const std::vector<std::complex<float>>& signal, size_t hop, std::vector<ToneFrame>& frames, size_t length);
+    ToneFrame analyzeFrame(const std::vector<std::complex<float>>& signal, size_t start, double offset);
+    size_t selectAlignment(const std::vector<ToneFrame>& frames, size_t hop, double period);  // sample offset of the symbol grid
+
+    // Receiver state between receive() calls. Baseband samples and analysis frames are kept
+    // in sliding windows; base and frameBase are the absolute indices of their first entries.
+    struct ReceiveState {
+        enum Stage { ACQUIRE, ALIGN, TRACK };
+        Stage stage;
+        bool active;
+        size_t frameSize;
+        size_t hop;
+        double period;
+        double analysisOffset;  // carrier offset the analysis bins are placed on
+        size_t base;
+        std::vector<ToneFrame> frames;
+        size_t frameBase;
+        size_t nextFrame;
+        double tau;
+        double drift;  // baseband samples per symbol
+        double prevTau;
+        ToneFrame prevTf;
+        int prevBit;
+    };
+    ReceiveState m_rx;
+
+    // Frame being assembled by feedFrame() in the codec's codeword scratch
+    FrameAssembler m_frame;
+    size_t m_frame_bit;  // bits taken from the caller's vector
+    template <typename Bits>
+    bool feedFrameBits(const Bits& bits);
+    // Bits is BitStream or std::vector<bool>, both only appended to
+    template <typename Bits>
+    void receiveBits(const int16_t* samples, size_t count, Bits& bits);
+    template <typename Bits>
+    void endReceiveBits(Bits& bits);
+    template <typename Bits>
+    void runReceiver(bool flush, Bits& bits);
+    void advanceSTFT(bool flush);
+    template <typename Bits>
+    void trackSymbols(bool flush, Bits& bits);
+
+    const std::vector<float>& calculateAverageSpectrum();
+    const std::vector<float>& normalizeSpectrum(const std::vector<float>& spectrum);
 };
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "riif_ultrasonic.h"
+#include "../src/core/static_profile.h"
+#include "../src/core/static_tables.h"
+
+// Ooura forward real FFT over a prebuilt, read-only table, compiled into riif_ultrasonic
+void rdftForward(int n, float *a, int *ip, const float *w);
+
+// The codec for one configuration fixed at compile time. What RiifUltrasonic builds per
+// profile at run time (windowed symbol templates, per-symbol oscillator advances, FFT
+// twiddles and tone bins) is generated by the compiler into read-only data, so construction
+// only sets up the Reed-Solomon codec over a member workspace and the inner loops run over
+// constant lengths. Transmissions match RiifUltrasonic's with parameters().
+//
+// Receiving is symbol synchronous: demodulate() takes samples that start on the symbol grid,
+// as encode() output does. Captures from the air go through RiifUltrasonic's receiver, which
+// finds the grid and tracks drift and carrier offset.
+template <class Profile = StaticProfile>
+class RiifUltrasonicT {
+public:
+    static constexpr size_t SYMBOL = Profile::samplesPerFrame;
+    static constexpr size_t BLOCK = Profile::rsMsgLength;
+    static constexpr size_t PARITY = Profile::rsEccLength;
+    static constexpr size_t CODEWORD = BLOCK + PARITY;
+    static constexpr size_t PADDING = SYMBOL * (Profile::preambleDuration / SYMBOL);  // trailing silence
+    static constexpr size_t RS_WORK = RS::ReedSolomon::getWorkSize_bytes(BLOCK, PARITY);
+
+    // FFT bins of the two tones, one symbol per transform
+    static constexpr size_t TONE_BINS[2] = {
+        static_cast<size_t>(static_tables::detail::roundToLong(Profile::f0 * SYMBOL / Profile::sampleRate)),
+        static_cast<size_t>(static_tables::detail::roundToLong((Profile::f0 + Profile::df) * SYMBOL / Profile::sampleRate))};
+
+    RiifUltrasonicT()
+        : m_rs(BLOCK, PARITY, m_rsWork)
+    {
+        static_assert(CODEWORD < 256, "Reed-Solomon codewords are at most 255 bytes");
+        static_assert(static_tables::isPowerOfTwo(SYMBOL), "symbols are transformed whole");
+        static_assert(TONE_BINS[0] != TONE_BINS[1] && TONE_BINS[1] < SYMBOL / 2, "tones must fall in distinct bins below Nyquist");
+    }
+    RiifUltrasonicT(const RiifUltrasonicT&) = delete;
+    RiifUltrasonicT& operator=(const RiifUltrasonicT&) = delete;
+
+    // The run-time parameters that produce the same transmissions
+    static RiifUltrasonic::Parameters parameters()
+    {
+        RiifUltrasonic::Parameters params;
+        params.sampleRate = Profile::sampleRate;
+        params.samplesPerFrame = Profile::samplesPerFrame;
+        params.f0 = Profile::f0;
+        params.df = Profile::df;
+        params.rsMsgLength = Profile::rsMsgLength;
+        params.rsEccLength = Profile::rsEccLength;
+        params.preambleDuration = Profile::preambleDuration;
+        params.shortenCodewords = Profile::shortenCodewords;
+        return params;
+    }
+
+    // A shortened block keeps its last byte for the message length
+    static constexpr size_t messageCapacity() { return Profile::shortenCodewords ? BLOCK - 1 : BLOCK; }
+
+    static size_t transmitFrames(size_t messageLength)
+    {
+        size_t used = messageLength < messageCapacity() ? messageLength : messageCapacity();
+        return frameSize(used, BLOCK, PARITY, Profile::shortenCodewords) * 8 * SYMBOL + PADDING;
+    }
+
+    // Encodes into out, which has room for transmitFrames(length) samples; longer messages are
+    // clipped to messageCapacity(). Returns the samples written.
+    size_t encode(const uint8_t* message, size_t length, int16_t* out)
+    {
+        size_t used = length < messageCapacity() ? length : messageCapacity();
+        std::memcpy(m_block, message, used);
+        std::memset(m_block + used, 0, BLOCK - used);
+        if (Profile::shortenCodewords)
+        {
+            m_block[BLOCK - 1] = static_cast<uint8_t>(used);
+        }
+        m_rs.Encode(m_block, m_codeword);
+
+        uint8_t* frame = m_frameBytes;
+        if (Profile::shortenCodewords)
+        {
+            *frame++ = hammingEncode(static_cast<uint8_t>(used >> 4));
+            *frame++ = hammingEncode(static_cast<uint8_t>(used & 0x0F));
+            frame = std::copy_n(m_codeword, used, frame);
+            std::copy_n(m_codeword + BLOCK, PARITY, frame);
+        }
+        else
+        {
+            std::copy_n(m_codeword, CODEWORD, frame);
+        }
+
+        // Each symbol is a template copy; the phase is carried exactly and only rounded to
+        // pick the template, as in RiifUltrasonic::synthesize()
+        const size_t bits = frameSize(used, BLOCK, PARITY, Profile::shortenCodewords) * 8;
+        double phase = 0.0;
+        for (size_t bit = 0; bit < bits; ++bit)
+        {
+            int tone = (m_frameBytes[bit / 8] >> (7 - bit % 8)) & 1;
+            long step = std::lround(phase / (2 * static_tables::PI) * PHASES) % PHASES;
+            std::copy_n(TEMPLATES.data() + (tone * PHASES + step) * SYMBOL, SYMBOL, out + bit * SYMBOL);
+            phase = std::fmod(phase + ADVANCE[tone], 2 * static_tables::PI);
+        }
+        std::fill_n(out + bits * SYMBOL, PADDING, int16_t(0));
+        return bits * SYMBOL + PADDING;
+    }
+
+    std::vector<int16_t> encode(const std::string& message)
+    {
+        std::vector<int16_t> signal(transmitFrames(message.size()));
+        encode(reinterpret_cast<const uint8_t*>(message.data()), message.size(), signal.data());
+        return signal;
+    }
+
+    // Appends one bit per whole symbol in samples: the stronger of the two tone bins
+    void demodulate(const int16_t* samples, size_t count, BitStream& bits)
+    {
+        for (size_t start = 0; start + SYMBOL <= count; start += SYMBOL)
+        {
+            for (size_t i = 0; i < SYMBOL; ++i)
+            {
+                m_fft[i] = samples[start + i] * (1.0f / 32768.0f);
+            }
+            rdftForward(static_cast<int>(SYMBOL), m_fft, m_ip, TWIDDLES.data());
+            bits.push_back(binPower(TONE_BINS[1]) > binPower(TONE_BINS[0]));
+        }
+    }
+
+    // Corrects demodulated bits back into the message, as RiifUltrasonic::decodeMessage()
+    std::vector<uint8_t> decodeMessage(const BitStream& bits)
+    {
+        m_frame.begin(&m_rs, m_codeword, BLOCK, PARITY, Profile::shortenCodewords);
+        for (size_t pos = 0; !m_frame.done() && pos + 8 <= bits.size(); pos += 8)
+        {
+            m_frame.push(static_cast<uint8_t>(bits.extract(pos, 8)));
+        }
+        if (!m_frame.done() || !m_frame.correct(m_message))
+        {
+            return std::vector<uint8_t>();
+        }
+        return std::vector<uint8_t>(m_message, m_message + m_frame.messageLength());
+    }
+
+    // The compile-time tables, exposed for comparison with the run-time codec
+    static const int16_t* symbolTemplate(int tone, int step) { return TEMPLATES.data() + (tone * PHASES + step) * SYMBOL; }
+    static const float* fftTable() { return TWIDDLES.data(); }
+
+private:
+    static constexpr int PHASES = 16;  // template start phases, as RiifUltrasonic::SYMBOL_TEMPLATE_PHASES
+
+    static constexpr std::array<int16_t, 2 * PHASES * SYMBOL> TEMPLATES =
+        static_tables::symbolTemplates<SYMBOL, PHASES>(Profile::sampleRate, Profile::f0, Profile::df);
+    static constexpr double ADVANCE[2] = {
+        static_tables::wrapPhase(2 * static_tables::PI * Profile::f0 / Profile::sampleRate * SYMBOL),
+        static_tables::wrapPhase(2 * static_tables::PI * (Profile::f0 + Profile::df) / Profile::sampleRate * SYMBOL)};
+    static constexpr std::array<float, SYMBOL / 2> TWIDDLES = static_tables::rdftTable<SYMBOL>();
+
+    uint8_t m_rsWork[RS_WORK];
+    RS::ReedSolomon m_rs;
+    uint8_t m_block[BLOCK];
+    uint8_t m_codeword[CODEWORD];
+    uint8_t m_frameBytes[FRAME_HEADER_BYTES + CODEWORD];
+    uint8_t m_message[BLOCK];
+    FrameAssembler m_frame;
+
+    float m_fft[SYMBOL];
+    int m_ip[static_tables::rdftWorkSize(SYMBOL)];
+
+    float binPower(size_t bin) const { return m_fft[2 * bin] * m_fft[2 * bin] + m_fft[2 * bin + 1] * m_fft[2 * bin + 1]; }
+};
@@ -0,0 +1,416 @@
+#include "pcm_file.h"
+#include "riif_ultrasonic.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t DECODE_BLOCK_FRAMES = 65536;
+
+const uint16_t WAVE_FORMAT_PCM = 0x0001;
+const uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+const uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+// WAV fields are little-endian whatever the host
+uint16_t readLE16(const uint8_t* p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t readLE32(const uint8_t* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void writeLE16(uint8_t* p, uint16_t v)
+{
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+void writeLE32(uint8_t* p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+bool hostIsLittleEndian()
+{
+    const uint16_t probe = 1;
+    uint8_t first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+int16_t toInt16(const uint8_t* p, const PcmFormat& format)
+{
+    switch (format.bitsPerSample)
+    {
+    case 8:
+        return static_cast<int16_t>((p[0] - 128) * 256);
+    case 16:
+        return static_cast<int16_t>(readLE16(p));
+    case 24:
+        return static_cast<int16_t>(readLE16(p + 1));
+    case 32:
+        if (format.isFloat)
+        {
+            uint32_t bits = readLE32(p);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            value = std::max(-1.0f, std::min(1.0f, value));
+            return static_cast<int16_t>(value * 32767.0f);
+        }
+        return static_cast<int16_t>(readLE32(p) >> 16);
+    default:
+        return 0;
+    }
+}
+
+bool validFormat(const PcmFormat& format)
+{
+    if (format.channels <= 0 || format.sampleRate <= 0)
+    {
+        return false;
+    }
+    if (format.isFloat)
+    {
+        return format.bitsPerSample == 32;
+    }
+    return format.bitsPerSample == 8 || format.bitsPerSample == 16 ||
+           format.bitsPerSample == 24 || format.bitsPerSample == 32;
+}
+
+} // namespace
+
+PcmFileReader::PcmFileReader() : m_fd(-1), m_map(nullptr), m_mapSize(0), m_data(nullptr), m_frames(0)
+{
+}
+
+PcmFileReader::~PcmFileReader()
+{
+    close();
+}
+
+bool PcmFileReader::mapFile(const std::string& path)
+{
+    close();
+
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0 || st.st_size <= 0)
+    {
+        close();
+        return false;
+    }
+
+    m_mapSize = static_cast<size_t>(st.st_size);
+    void* map = mmap(nullptr, m_mapSize, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        m_mapSize = 0;
+        close();
+        return false;
+    }
+    m_map = static_cast<uint8_t*>(map);
+    madvise(m_map, m_mapSize, MADV_SEQUENTIAL);
+    return true;
+}
+
+void PcmFileReader::close()
+{
+    if (m_map != nullptr)
+    {
+        munmap(m_map, m_mapSize);
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+    m_fd = -1;
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_data = nullptr;
+    m_frames = 0;
+}
+
+bool PcmFileReader::open(const std::string& path)
+{
+    if (!mapFile(path))
+    {
+        return false;
+    }
+    if (!parseWav())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool PcmFileReader::openRaw(const std::string& path, const PcmFormat& format, size_t headerBytes)
+{
+    if (!validFormat(format) || !mapFile(path) || headerBytes > m_mapSize)
+    {
+        close();
+        return false;
+    }
+    m_format = format;
+    m_data = m_map + headerBytes;
+    m_frames = (m_mapSize - headerBytes) / frameBytes();
+    return true;
+}
+
+bool PcmFileReader::parseWav()
+{
+    if (m_mapSize < 12 || std::memcmp(m_map, "RIFF", 4) != 0 || std::memcmp(m_map + 8, "WAVE", 4) != 0)
+    {
+        return false;
+    }
+
+    // Walk the chunk list; anything besides fmt and data (LIST, fact, ...) is skipped
+    bool haveFormat = false;
+    size_t pos = 12;
+    while (pos + 8 <= m_mapSize)
+    {
+        const uint8_t* chunk = m_map + pos;
+        size_t size = readLE32(chunk + 4);
+        const uint8_t* body = chunk + 8;
+        size_t remaining = m_mapSize - pos - 8;
+
+        if (std::memcmp(chunk, "fmt ", 4) == 0)
+        {
+            if (size < 16 || size > remaining)
+            {
+                return false;
+            }
+            uint16_t tag = readLE16(body);
+            if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 40)
+            {
+                tag = readLE16(body + 24);  // first two bytes of the sub-format GUID
+            }
+            if (tag != WAVE_FORMAT_PCM && tag != WAVE_FORMAT_IEEE_FLOAT)
+            {
+                return false;
+            }
+            m_format.channels = readLE16(body + 2);
+            m_format.sampleRate = static_cast<int>(readLE32(body + 4));
+            m_format.bitsPerSample = readLE16(body + 14);
+            m_format.isFloat = tag == WAVE_FORMAT_IEEE_FLOAT;
+            if (!validFormat(m_format))
+            {
+                return false;
+            }
+            haveFormat = true;
+        }
+        else if (std::memcmp(chunk, "data", 4) == 0)
+        {
+            if (!haveFormat)
+            {
+                return false;
+            }
+            // Streamed WAVs often leave the size at 0 or 0xFFFFFFFF; take the rest of the file
+            if (size == 0 || size > remaining)
+            {
+                size = remaining;
+            }
+            m_data = body;
+            m_frames = size / frameBytes();
+            return true;
+        }
+
+        pos += 8 + size + (size & 1);  // chunks are padded to an even length
+    }
+    return false;
+}
+
+const int16_t* PcmFileReader::samples() const
+{
+    bool aligned = reinterpret_cast<uintptr_t>(m_data) % alignof(int16_t) == 0;
+    if (m_data == nullptr || m_format.channels != 1 || m_format.bitsPerSample != 16 || m_format.isFloat ||
+        !aligned || !hostIsLittleEndian())
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const int16_t*>(m_data);
+}
+
+size_t PcmFileReader::read(size_t first, size_t count, int16_t* out, int channel) const
+{
+    if (m_data == nullptr || first >= m_frames || channel < 0 || channel >= m_format.channels)
+    {
+        return 0;
+    }
+    count = std::min(count, m_frames - first);
+
+    const size_t stride = frameBytes();
+    const uint8_t* p = m_data + first * stride + channel * (m_format.bitsPerSample / 8);
+    for (size_t i = 0; i < count; ++i, p += stride)
+    {
+        out[i] = toInt16(p, m_format);
+    }
+    return count;
+}
+
+void PcmFileReader::release(size_t end) const
+{
+    if (m_map == nullptr)
+    {
+        return;
+    }
+    // Only whole pages strictly behind the read position; the mapping is read-only, so
+    // dropped pages are simply re-read from the file if touched again
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t offset = (m_data - m_map) + std::min(end, m_frames) * frameBytes();
+    size_t length = offset / page * page;
+    if (length > 0)
+    {
+        madvise(m_map, length, MADV_DONTNEED);
+    }
+}
+
+PcmFileWriter::PcmFileWriter() : m_file(nullptr), m_raw(false), m_dataBytes(0)
+{
+}
+
+PcmFileWriter::~PcmFileWriter()
+{
+    close();
+}
+
+bool PcmFileWriter::open(const std::string& path, const PcmFormat& format, bool raw)
+{
+    close();
+    if (format.bitsPerSample != 16 || format.isFloat || !validFormat(format))
+    {
+        return false;
+    }
+
+    m_file = std::fopen(path.c_str(), "wb");
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+    m_format = format;
+    m_raw = raw;
+    m_dataBytes = 0;
+
+    if (!m_raw)
+    {
+        // Placeholder header, the sizes are filled in by close()
+        uint8_t header[44] = {};
+        std::fwrite(header, 1, sizeof(header), m_file);
+    }
+    return std::ferror(m_file) == 0;
+}
+
+bool PcmFileWriter::write(const int16_t* samples, size_t count)
+{
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+
+    if (hostIsLittleEndian())
+    {
+        if (std::fwrite(samples, sizeof(int16_t), count, m_file) != count)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        uint8_t buffer[512];
+        for (size_t i = 0; i < count; )
+        {
+            size_t n = std::min(count - i, sizeof(buffer) / 2);
+            for (size_t j = 0; j < n; ++j)
+            {
+                writeLE16(buffer + 2 * j, static_cast<uint16_t>(samples[i + j]));
+            }
+            if (std::fwrite(buffer, 2, n, m_file) != n)
+            {
+                return false;
+            }
+            i += n;
+        }
+    }
+    m_dataBytes += count * sizeof(int16_t);
+    return true;
+}
+
+bool PcmFileWriter::close()
+{
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    if (!m_raw)
+    {
+        // RIFF sizes are 32-bit; larger streams keep the maximum and readers take the rest of the file
+        uint32_t data_size = static_cast<uint32_t>(std::min<uint64_t>(m_dataBytes, 0xFFFFFFFFu - 36));
+        uint16_t block_align = static_cast<uint16_t>(m_format.channels * 2);
+
+        uint8_t header[44];
+        std::memcpy(header, "RIFF", 4);
+        writeLE32(header + 4, 36 + data_size);
+        std::memcpy(header + 8, "WAVEfmt ", 8);
+        writeLE32(header + 16, 16);
+        writeLE16(header + 20, WAVE_FORMAT_PCM);
+        writeLE16(header + 22, static_cast<uint16_t>(m_format.channels));
+        writeLE32(header + 24, static_cast<uint32_t>(m_format.sampleRate));
+        writeLE32(header + 28, static_cast<uint32_t>(m_format.sampleRate) * block_align);
+        writeLE16(header + 32, block_align);
+        writeLE16(header + 34, 16);
+        std::memcpy(header + 36, "data", 4);
+        writeLE32(header + 40, data_size);
+
+        ok = std::fseek(m_file, 0, SEEK_SET) == 0 && std::fwrite(header, 1, sizeof(header), m_file) == sizeof(header);
+    }
+    ok = std::fclose(m_file) == 0 && ok;
+    m_file = nullptr;
+    return ok;
+}
+
+std::vector<bool> decodePcmFile(RiifUltrasonic& riif, const PcmFileReader& file, int channel)
+{
+    std::vector<bool> bits;
+    if (!file.isOpen() || channel < 0 || channel >= file.format().channels ||
+        !riif.beginReceive(file.format().sampleRate))
+    {
+        return bits;
+    }
+
+    const int16_t* direct = file.samples();
+    std::vector<int16_t> block(direct != nullptr ? 0 : DECODE_BLOCK_FRAMES);
+    for (size_t first = 0; first < file.frameCount(); first += DECODE_BLOCK_FRAMES)
+    {
+        size_t count = std::min(DECODE_BLOCK_FRAMES, file.frameCount() - first);
+        if (direct != nullptr)
+        {
+            riif.receive(direct + first, count, bits);
+        }
+        else
+        {
+            file.read(first, count, block.data(), channel);
+            riif.receive(block.data(), count, bits);
+        }
+        file.release(first + count);
+    }
+    riif.endReceive(bits);
+    return bits;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+
+class RiifUltrasonic;
+
+struct PcmFormat {
+    int sampleRate = 48000;
+    int channels = 1;
+    int bitsPerSample = 16;  // 8, 16, 24 or 32
+    bool isFloat = false;    // 32-bit IEEE float samples
+};
+
+// Read-only memory mapping of a WAV or headerless PCM file. Nothing is copied on open: the
+// sample region is exposed in place and pages are only brought in as they are touched, so
+// recordings larger than RAM can be walked with constant resident memory.
+class PcmFileReader {
+public:
+    PcmFileReader();
+    ~PcmFileReader();
+    PcmFileReader(const PcmFileReader&) = delete;
+    PcmFileReader& operator=(const PcmFileReader&) = delete;
+
+    // WAV (RIFF/WAVE, PCM or IEEE float, plain or extensible fmt chunk)
+    bool open(const std::string& path);
+    // Headerless PCM in the given format, after headerBytes of anything else
+    bool openRaw(const std::string& path, const PcmFormat& format, size_t headerBytes = 0);
+    void close();
+
+    bool isOpen() const { return m_data != nullptr; }
+    const PcmFormat& format() const { return m_format; }
+    size_t frameCount() const { return m_frames; }
+    const uint8_t* data() const { return m_data; }
+
+    // The sample region as 16-bit samples when the file is mono 16-bit, nullptr otherwise
+    const int16_t* samples() const;
+
+    // Convert frames [first, first + count) of one channel to 16-bit, returns the frames written
+    size_t read(size_t first, size_t count, int16_t* out, int channel = 0) const;
+
+    // Hint that frames before `end` will not be read again so their pages can be dropped
+    void release(size_t end) const;
+
+private:
+    int m_fd;
+    uint8_t* m_map;
+    size_t m_mapSize;
+    const uint8_t* m_data;
+    size_t m_frames;
+    PcmFormat m_format;
+
+    bool mapFile(const std::string& path);
+    bool parseWav();
+    size_t frameBytes() const { return static_cast<size_t>(m_format.channels) * (m_format.bitsPerSample / 8); }
+};
+
+// Streams 16-bit PCM to a WAV (or raw) file through a buffered write. The RIFF sizes are
+// patched on close, so the total length does not need to be known up front.
+class PcmFileWriter {
+public:
+    PcmFileWriter();
+    ~PcmFileWriter();
+    PcmFileWriter(const PcmFileWriter&) = delete;
+    PcmFileWriter& operator=(const PcmFileWriter&) = delete;
+
+    // Only 16-bit integer formats are written
+    bool open(const std::string& path, const PcmFormat& format, bool raw = false);
+    // Interleaved samples, count is in samples rather than frames
+    bool write(const int16_t* samples, size_t count);
+    bool close();
+
+private:
+    std::FILE* m_file;
+    PcmFormat m_format;
+    bool m_raw;
+    uint64_t m_dataBytes;
+};
+
+// Decode one channel of a mapped file through the streaming receiver, a block at a time.
+// Mono 16-bit files are passed to the decoder straight from the mapping.
+std::vector<bool> decodePcmFile(RiifUltrasonic& riif, const PcmFileReader& file, int channel = 0);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Bump allocator over one cache-line aligned block. Everything handed out lives until the
+// arena is rewound or reset, so a transaction takes a mark on entry and rewinds to it on
+// exit, and nothing is ever freed individually. Only reserve() touches the heap.
+class Arena {
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    Arena() : m_base(nullptr), m_capacity(0), m_used(0), m_peak(0) {}
+    explicit Arena(size_t capacity) : Arena() { reserve(capacity); }
+    ~Arena() { release(); }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Replace the block with one of at least `capacity` bytes; drops all allocations
+    void reserve(size_t capacity)
+    {
+        release();
+        capacity = roundUp(capacity);
+        if (capacity > 0)
+        {
+            m_base = static_cast<uint8_t*>(::operator new(capacity, std::align_val_t(ALIGNMENT)));
+        }
+        m_capacity = capacity;
+    }
+
+    // Uninitialized storage for `count` objects, aligned to a cache line. Throws
+    // std::bad_alloc if the block is exhausted, like the heap would.
+    template <typename T>
+    T* allocate(size_t count)
+    {
+        size_t bytes = roundUp(count * sizeof(T));
+        if (bytes > m_capacity - m_used)
+        {
+            throw std::bad_alloc();
+        }
+        T* p = reinterpret_cast<T*>(m_base + m_used);
+        m_used += bytes;
+        m_peak = m_used > m_peak ? m_used : m_peak;
+        return p;
+    }
+
+    size_t mark() const { return m_used; }
+    void rewind(size_t mark) { m_used = mark < m_used ? mark : m_used; }
+    void reset() { m_used = 0; }
+
+    size_t used() const { return m_used; }
+    size_t capacity() const { return m_capacity; }
+    size_t peak() const { return m_peak; }
+
+    // Bytes taken by an allocation of `count` objects, for sizing a block up front
+    template <typename T>
+    static size_t footprint(size_t count) { return roundUp(count * sizeof(T)); }
+
+private:
+    uint8_t* m_base;
+    size_t m_capacity;
+    size_t m_used;
+    size_t m_peak;
+
+    static size_t roundUp(size_t bytes) { return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+
+    void release()
+    {
+        if (m_base != nullptr)
+        {
+            ::operator delete(m_base, std::align_val_t(ALIGNMENT));
+        }
+        m_base = nullptr;
+        m_capacity = 0;
+        m_used = 0;
+        m_peak = 0;
+    }
+};
+
+// Rewinds an arena to where it stood when the scope was entered
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena& arena) : m_arena(arena), m_mark(arena.mark()) {}
+    ~ArenaScope() { m_arena.rewind(m_mark); }
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    Arena& m_arena;
+    size_t m_mark;
+};
@@ -0,0 +1,283 @@
+#include "async_receiver.h"
+#include <algorithm>
+#include <cmath>
+#include "onset.h"
+
+AsyncReceiver::AsyncReceiver(const RiifUltrasonic::Parameters& params, int captureRate, Post post)
+    : m_captureRate(captureRate), m_post(std::move(post)), m_scan(0), m_noise(0.0f), m_confirming(false),
+      m_receiving(false),
+      m_failed(0), m_finishing(false), m_ended(false), m_stop(false)
+{
+    m_codec.setParameters(params);
+    const double symbol = static_cast<double>(params.samplesPerFrame) * captureRate / params.sampleRate;
+    m_block = std::max<size_t>(1, static_cast<size_t>(std::lround(symbol / 4)));
+    m_symbol = 4 * m_block;
+    m_step = std::max<size_t>(1, m_symbol / 16);
+    for (int tone = 0; tone < 2; ++tone)
+    {
+        m_coeff[tone] = static_cast<float>(2 * std::cos(2 * M_PI * (params.f0 + tone * params.df) / captureRate));
+    }
+    m_listen.reserve(m_symbol + m_block + onset::ALIGN_SYMBOLS * m_symbol);
+
+    // A capture rate the tones do not fit is over before it starts
+    m_ended = !m_codec.beginReceive(captureRate);
+    m_worker = std::thread(&AsyncReceiver::workerLoop, this);
+}
+
+AsyncReceiver::~AsyncReceiver()
+{
+    // Outstanding requests are answered as after finish(), so no callback is lost and no
+    // awaiting coroutine stays suspended
+    endRequests();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_worker.join();
+    // Without a post function nothing would dispatch them later
+    if (!m_post)
+    {
+        dispatch();
+    }
+}
+
+void AsyncReceiver::push(const int16_t* samples, size_t count)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_finishing || m_ended)
+        {
+            return;
+        }
+        m_input.insert(m_input.end(), samples, samples + count);
+    }
+    m_wake.notify_one();
+}
+
+void AsyncReceiver::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finishing = true;
+    }
+    m_wake.notify_one();
+}
+
+void AsyncReceiver::nextMessage(Handler handler)
+{
+    Message message;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_messages.empty())
+        {
+            message = std::move(m_messages.front());
+            m_messages.pop_front();
+        }
+        else if (!m_ended)
+        {
+            m_requests.push_back(std::move(handler));
+            return;
+        }
+    }
+    // Even a message already waiting is delivered through the loop, never from inside the call
+    post([handler, message]() mutable { handler(std::move(message)); });
+}
+
+size_t AsyncReceiver::dispatch()
+{
+    std::vector<std::function<void()>> jobs;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        jobs.swap(m_ready);
+    }
+    for (std::function<void()>& job : jobs)
+    {
+        job();
+    }
+    return jobs.size();
+}
+
+size_t AsyncReceiver::failedFrames() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_failed;
+}
+
+void AsyncReceiver::workerLoop()
+{
+    std::vector<int16_t> chunk;
+    while (true)
+    {
+        bool flush;
+        bool ended;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || m_finishing || !m_input.empty(); });
+            if (m_stop)
+            {
+                return;
+            }
+            // Swapping keeps both buffers' capacity, so a steady stream stops allocating
+            chunk.clear();
+            chunk.swap(m_input);
+            flush = m_finishing;
+            ended = m_ended;
+        }
+        if (!ended)
+        {
+            process(chunk.data(), chunk.size());
+        }
+        if (!flush)
+        {
+            continue;
+        }
+
+        if (m_receiving)
+        {
+            m_codec.endReceive(m_bits);
+            m_codec.feedFrame(m_bits);
+            completeFrame();
+        }
+        endRequests();
+        return;
+    }
+}
+
+void AsyncReceiver::process(const int16_t* samples, size_t count)
+{
+    size_t pos = 0;
+    while (pos < count)
+    {
+        if (!m_receiving)
+        {
+            size_t used = 0;
+            listen(samples + pos, count - pos, used);
+            pos += used;
+            continue;
+        }
+        // A symbol at a time, so listening resumes right after the frame
+        size_t slice = std::min(count - pos, m_symbol);
+        m_codec.receive(samples + pos, slice, m_bits);
+        pos += slice;
+        if (m_codec.feedFrame(m_bits))
+        {
+            completeFrame();
+        }
+    }
+}
+
+void AsyncReceiver::listen(const int16_t* samples, size_t count, size_t& used)
+{
+    // The receive starts at the grid or PREROLL_BLOCKS ahead of the onset, whichever is
+    // earlier, as the first symbol's window may ramp up under the threshold; that leaves less
+    // than a symbol of lead for the codec's alignment to find.
+    while (true)
+    {
+        size_t need = m_scan + m_block + (m_confirming ? onset::ALIGN_SYMBOLS * m_symbol : 0);
+        if (m_listen.size() < need)
+        {
+            size_t take = std::min(count - used, need - m_listen.size());
+            m_listen.insert(m_listen.end(), samples + used, samples + used + take);
+            used += take;
+            if (m_listen.size() < need)
+            {
+                return;
+            }
+        }
+
+        if (!m_confirming)
+        {
+            m_confirming = onset::heard(&m_listen[m_scan], m_block, m_coeff, m_noise);
+            if (!m_confirming)
+            {
+                skipBlock();
+            }
+            continue;
+        }
+        m_confirming = false;
+        size_t first = m_scan > m_symbol ? m_scan - m_symbol : 0;
+        size_t grid = 0;
+        if (!onset::findGrid(m_listen.data(), first, m_scan + m_block, m_step, m_symbol, m_coeff, grid))
+        {
+            skipBlock();
+            continue;
+        }
+        size_t start = m_scan > PREROLL_BLOCKS * m_block ? m_scan - PREROLL_BLOCKS * m_block : 0;
+        start = std::min(start, grid);
+        m_codec.beginReceive(m_captureRate);
+        m_codec.beginFrame();
+        m_bits.clear();
+        m_codec.receive(m_listen.data() + start, m_listen.size() - start, m_bits);
+        m_receiving = true;
+        m_listen.clear();
+        m_scan = 0;
+        return;
+    }
+}
+
+void AsyncReceiver::skipBlock()
+{
+    // Keeps a symbol of history, where the grid search of the next onset starts
+    m_scan += m_block;
+    if (m_scan > m_symbol)
+    {
+        m_listen.erase(m_listen.begin(), m_listen.begin() + m_block);
+        m_scan -= m_block;
+    }
+}
+
+void AsyncReceiver::completeFrame()
+{
+    m_receiving = false;
+    Message message = m_codec.finishFrame();
+    if (message.empty())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_failed;
+        return;
+    }
+    deliver(std::move(message));
+}
+
+void AsyncReceiver::deliver(Message message)
+{
+    Handler handler;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_requests.empty())
+        {
+            m_messages.push_back(std::move(message));
+            return;
+        }
+        handler = std::move(m_requests.front());
+        m_requests.pop_front();
+    }
+    post([handler, message]() mutable { handler(std::move(message)); });
+}
+
+void AsyncReceiver::endRequests()
+{
+    std::deque<Handler> requests;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ended = true;
+        requests.swap(m_requests);
+    }
+    for (Handler& handler : requests)
+    {
+        post([handler]() { handler(Message()); });
+    }
+}
+
+void AsyncReceiver::post(std::function<void()> job)
+{
+    // The post function is called without the lock held, so it may take the loop's own locks
+    if (m_post)
+    {
+        m_post(std::move(job));
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ready.push_back(std::move(job));
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "riif_ultrasonic.h"
+
+// Streaming receiver for applications built around an event loop. The loop thread hands
+// captured audio to push(), which only copies it; a worker thread owned by the receiver runs
+// onset detection, the baseband front end, the STFT and symbol tracking, and the frame's
+// Reed-Solomon correction. Each corrected message goes to the next request and is delivered
+// back on the loop thread through the post function, so handlers never race the loop's own
+// state.
+//
+// Transmissions are found by their onset, as in the embedded reader (see onset.h): a quarter
+// symbol whose stronger tone stands clear of the tone level heard before it, borne out by a
+// symbol grid over the next few symbols, starts a receive. An onset without a grid was a
+// burst of noise and listening goes on right after it. The receiver listens again once the
+// frame is complete; frames that cannot be corrected are counted and dropped.
+//
+//     AsyncReceiver receiver(params, 48000, [&loop](std::function<void()> job) { loop.post(job); });
+//     receiver.nextMessage([](std::vector<uint8_t> message) { ... });  // callback
+//     std::future<std::vector<uint8_t>> f = receiver.nextMessage().future();
+//     std::vector<uint8_t> message = co_await receiver.nextMessage();  // in a C++20 coroutine
+//
+// Without a post function, completed requests wait for the loop to call dispatch().
+class AsyncReceiver {
+public:
+    using Message = std::vector<uint8_t>;
+    using Handler = std::function<void(Message)>;
+    using Post = std::function<void(std::function<void()>)>;
+
+    // One request for the next message, taken as a future or awaited; the message arrives on
+    // the loop thread either way
+    class MessageRequest {
+    public:
+        explicit MessageRequest(AsyncReceiver& receiver) : m_receiver(&receiver) {}
+
+        std::future<Message> future()
+        {
+            std::shared_ptr<std::promise<Message>> promise = std::make_shared<std::promise<Message>>();
+            m_receiver->nextMessage([promise](Message message) { promise->set_value(std::move(message)); });
+            return promise->get_future();
+        }
+
+        // Awaiter for C++20 coroutines; a template so the header needs no <coroutine>
+        bool await_ready() const { return false; }
+        template <class Handle>
+        void await_suspend(Handle handle)
+        {
+            m_receiver->nextMessage([this, handle](Message message) mutable {
+                m_message = std::move(message);
+                handle.resume();
+            });
+        }
+        Message await_resume() { return std::move(m_message); }
+
+    private:
+        AsyncReceiver* m_receiver;
+        Message m_message;
+    };
+
+    AsyncReceiver(const RiifUltrasonic::Parameters& params, int captureRate, Post post = Post());
+    // Answers every outstanding request with an empty message, through the post function or,
+    // without one, directly on the destroying thread, which should then be the loop thread
+    ~AsyncReceiver();
+    AsyncReceiver(const AsyncReceiver&) = delete;
+    AsyncReceiver& operator=(const AsyncReceiver&) = delete;
+
+    // Queues capture samples for the worker and returns at once
+    void push(const int16_t* samples, size_t count);
+
+    // End of the capture: a transmission still open is decoded from what was heard, then every
+    // outstanding and later request gets an empty message. Later push() calls are ignored.
+    void finish();
+
+    // handler runs on the loop thread with the next message, or an empty one after finish()
+    void nextMessage(Handler handler);
+    MessageRequest nextMessage() { return MessageRequest(*this); }
+
+    // Runs the deliveries waiting for the loop when there is no post function; returns how many
+    size_t dispatch();
+
+    // Frames heard but not corrected
+    size_t failedFrames() const;
+
+private:
+    static constexpr size_t PREROLL_BLOCKS = 2;  // fed to the codec before the onset block, at most
+
+    RiifUltrasonic m_codec;  // used by the worker only
+    const int m_captureRate;
+    const Post m_post;
+    size_t m_block;    // onset block, a quarter symbol at the capture rate
+    size_t m_symbol;   // receive slice, so a finished frame is noticed within a symbol
+    size_t m_step;     // grid search step
+    float m_coeff[2];  // Goertzel coefficients of the tones at the capture rate
+
+    // Worker state
+    std::vector<int16_t> m_listen;  // a symbol of history, the block being scanned and, after an onset, the grid search
+    size_t m_scan;
+    float m_noise;
+    bool m_confirming;  // onset at m_scan, waiting for the samples to confirm it
+    bool m_receiving;
+    BitStream m_bits;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<int16_t> m_input;       // pushed, not yet taken by the worker
+    std::deque<Message> m_messages;     // corrected, no request yet
+    std::deque<Handler> m_requests;     // waiting for a message
+    std::vector<std::function<void()>> m_ready;  // deliveries for dispatch()
+    size_t m_failed;
+    bool m_finishing;
+    bool m_ended;
+    bool m_stop;
+    std::thread m_worker;
+
+    void workerLoop();
+    void process(const int16_t* samples, size_t count);
+    void listen(const int16_t* samples, size_t count, size_t& used);
+    void skipBlock();
+    void completeFrame();
+    void deliver(Message message);
+    void endRequests();
+    void post(std::function<void()> job);
+};
@@ -0,0 +1,100 @@
+#include "baseband.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+const double PI = 3.14159265358979323846;
+}
+
+BasebandFrontEnd::BasebandFrontEnd() : m_inputRate(1.0), m_centerFrequency(0.0), m_decimation(1),
+    m_historyPos(0), m_phase(0), m_ncoPhase(0), m_ncoStep(0)
+{
+    m_ncoTable.resize(size_t(1) << NCO_TABLE_BITS);
+    for (size_t i = 0; i < m_ncoTable.size(); ++i)
+    {
+        double theta = 2 * PI * i / m_ncoTable.size();
+        m_ncoTable[i] = std::complex<float>(std::cos(theta), -std::sin(theta));
+    }
+    designFilter();
+}
+
+void BasebandFrontEnd::configure(double sampleRate, double centerFrequency, int decimation)
+{
+    m_inputRate = sampleRate;
+    m_centerFrequency = centerFrequency;
+    m_decimation = std::max(1, decimation);
+
+    // Phase step in units of 2^-32 turns; wrapping of the accumulator is the modulo 2*pi
+    double turns = centerFrequency / sampleRate;
+    turns -= std::floor(turns);
+    m_ncoStep = static_cast<uint32_t>(std::llround(turns * 4294967296.0));
+
+    designFilter();
+}
+
+void BasebandFrontEnd::designFilter()
+{
+    // Blackman-windowed sinc with its cutoff at half the output rate. The transition band then
+    // ends before any frequency that would alias onto the inner two thirds of the output band.
+    const size_t n = static_cast<size_t>(TAPS_PER_PHASE) * m_decimation;
+    const double cutoff = 0.5 / m_decimation;
+    const double centre = (n - 1) / 2.0;
+
+    m_taps.resize(n);
+    double sum = 0.0;
+    for (size_t k = 0; k < n; ++k)
+    {
+        double x = k - centre;
+        double sinc = x == 0.0 ? 2 * cutoff : std::sin(2 * PI * cutoff * x) / (PI * x);
+        double window = 0.42 - 0.5 * std::cos(2 * PI * k / (n - 1)) + 0.08 * std::cos(4 * PI * k / (n - 1));
+        m_taps[k] = static_cast<float>(sinc * window);
+        sum += m_taps[k];
+    }
+    for (float& tap : m_taps)
+    {
+        tap = static_cast<float>(tap / sum);  // unity gain at DC
+    }
+
+    reset();
+}
+
+void BasebandFrontEnd::reset()
+{
+    m_history.assign(2 * m_taps.size(), std::complex<float>(0.0f, 0.0f));
+    m_historyPos = 0;
+    m_phase = 0;
+    m_ncoPhase = 0;
+}
+
+void BasebandFrontEnd::process(const int16_t* input, size_t count, std::vector<std::complex<float>>& output)
+{
+    const size_t taps = m_taps.size();
+    const int shift = 32 - NCO_TABLE_BITS;
+    output.reserve(output.size() + (count + m_phase) / m_decimation);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::complex<float> mixed = m_ncoTable[m_ncoPhase >> shift] * (input[i] / 32768.0f);
+        m_ncoPhase += m_ncoStep;
+
+        m_history[m_historyPos] = mixed;
+        m_history[m_historyPos + taps] = mixed;
+        m_historyPos = m_historyPos == 0 ? taps - 1 : m_historyPos - 1;
+
+        if (++m_phase < m_decimation)
+        {
+            continue;
+        }
+        m_phase = 0;
+
+        // Newest sample first, matching the tap order h[0], h[1], ...
+        const std::complex<float>* window = &m_history[m_historyPos + 1];
+        float re = 0.0f, im = 0.0f;
+        for (size_t k = 0; k < taps; ++k)
+        {
+            re += m_taps[k] * window[k].real();
+            im += m_taps[k] * window[k].imag();
+        }
+        output.emplace_back(re, im);
+    }
+}
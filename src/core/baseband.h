@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+
+// Receive front end: mixes the tone band down to 0 Hz with a numerically controlled
+// oscillator, low-pass filters it and keeps every D-th sample. The filter is evaluated in
+// polyphase form, only the retained outputs are computed, so the cost per input sample is
+// one complex multiply for the mixer plus taps / D multiply-adds.
+class BasebandFrontEnd {
+public:
+    BasebandFrontEnd();
+
+    // Retune for a new sample rate, band centre and decimation factor. Clears the filter state.
+    void configure(double sampleRate, double centerFrequency, int decimation);
+    void reset();
+
+    // Mix, filter and decimate a block of 16-bit PCM, appending the baseband samples to output.
+    // State carries over between calls so a stream may be fed in pieces of any size.
+    void process(const int16_t* input, size_t count, std::vector<std::complex<float>>& output);
+
+    int decimation() const { return m_decimation; }
+    double inputRate() const { return m_inputRate; }
+    double outputRate() const { return m_inputRate / m_decimation; }
+    double centerFrequency() const { return m_centerFrequency; }
+
+    static constexpr int TAPS_PER_PHASE = 16;
+
+private:
+    static constexpr int NCO_TABLE_BITS = 12;
+
+    double m_inputRate;
+    double m_centerFrequency;
+    int m_decimation;
+
+    std::vector<float> m_taps;
+    // Delay line stored twice so the filter always reads one contiguous window
+    std::vector<std::complex<float>> m_history;
+    size_t m_historyPos;
+    int m_phase;
+
+    // 32-bit phase accumulator indexing a table of exp(-j*theta)
+    std::vector<std::complex<float>> m_ncoTable;
+    uint32_t m_ncoPhase;
+    uint32_t m_ncoStep;
+
+    void designFilter();
+};
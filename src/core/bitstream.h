@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bits packed into 64-bit words, first bit in the most significant position, so a stream of
+// bytes and the symbols demodulated from it share one layout. Symbols of any width up to 64
+// bits are appended and extracted whole, and bytes move in and out a word at a time.
+// Capacity is kept across clear(), like a vector's.
+class BitStream {
+public:
+    BitStream() : m_bits(0) {}
+    explicit BitStream(const std::vector<bool>& bits) : m_bits(0)
+    {
+        reserve(bits.size());
+        for (bool bit : bits)
+        {
+            push_back(bit);
+        }
+    }
+
+    size_t size() const { return m_bits; }
+    bool empty() const { return m_bits == 0; }
+    void clear() { m_bits = 0; }
+    void reserve(size_t bits) { m_words.reserve((bits + 63) / 64); }
+    const std::vector<uint64_t>& words() const { return m_words; }
+
+    bool operator[](size_t i) const { return (m_words[i / 64] >> (63 - i % 64)) & 1; }
+
+    void push_back(bool bit)
+    {
+        size_t shift = 63 - m_bits % 64;
+        if (shift == 63)
+        {
+            openWord(m_bits / 64);
+        }
+        m_words[m_bits / 64] |= static_cast<uint64_t>(bit) << shift;
+        ++m_bits;
+    }
+
+    // The low `width` bits of value, most significant first
+    void append(uint64_t value, unsigned width)
+    {
+        if (width == 0)
+        {
+            return;
+        }
+        if (width < 64)
+        {
+            value &= (uint64_t(1) << width) - 1;
+        }
+        size_t used = m_bits % 64;
+        if (used == 0)
+        {
+            openWord(m_bits / 64);
+        }
+        size_t room = 64 - used;
+        if (width <= room)
+        {
+            m_words[m_bits / 64] |= value << (room - width);
+        }
+        else
+        {
+            m_words[m_bits / 64] |= value >> (width - room);
+            openWord(m_bits / 64 + 1);
+            m_words[m_bits / 64 + 1] = value << (64 - (width - room));
+        }
+        m_bits += width;
+    }
+
+    void appendBytes(const uint8_t* bytes, size_t count)
+    {
+        // Whole words where the stream is word aligned, a byte at a time elsewhere
+        size_t i = 0;
+        if (m_bits % 64 == 0)
+        {
+            for (; i + 8 <= count; i += 8)
+            {
+                uint64_t word = 0;
+                for (size_t b = 0; b < 8; ++b)
+                {
+                    word = (word << 8) | bytes[i + b];
+                }
+                openWord(m_bits / 64);
+                m_words[m_bits / 64] = word;
+                m_bits += 64;
+            }
+        }
+        for (; i < count; ++i)
+        {
+            append(bytes[i], 8);
+        }
+    }
+
+    // `width` bits starting at bit `pos` as an integer, most significant first; the caller
+    // keeps pos + width within size()
+    uint64_t extract(size_t pos, unsigned width) const
+    {
+        if (width == 0)
+        {
+            return 0;
+        }
+        size_t word = pos / 64;
+        size_t offset = pos % 64;
+        uint64_t value = m_words[word] << offset;
+        if (offset + width > 64)
+        {
+            value |= m_words[word + 1] >> (64 - offset);
+        }
+        return value >> (64 - width);
+    }
+
+    uint8_t byteAt(size_t index) const { return static_cast<uint8_t>(extract(index * 8, 8)); }
+
+    // Whole bytes from bit `pos`; returns how many fit in the stream
+    size_t extractBytes(size_t pos, uint8_t* bytes, size_t count) const
+    {
+        size_t available = pos < m_bits ? (m_bits - pos) / 8 : 0;
+        count = count < available ? count : available;
+        for (size_t i = 0; i < count; ++i)
+        {
+            bytes[i] = static_cast<uint8_t>(extract(pos + i * 8, 8));
+        }
+        return count;
+    }
+
+    std::vector<bool> toBools() const
+    {
+        std::vector<bool> bits(m_bits);
+        for (size_t i = 0; i < m_bits; ++i)
+        {
+            bits[i] = (*this)[i];
+        }
+        return bits;
+    }
+
+    bool operator==(const BitStream& other) const
+    {
+        if (m_bits != other.m_bits)
+        {
+            return false;
+        }
+        size_t full = m_bits / 64;
+        for (size_t i = 0; i < full; ++i)
+        {
+            if (m_words[i] != other.m_words[i])
+            {
+                return false;
+            }
+        }
+        size_t rest = m_bits % 64;
+        return rest == 0 || extract(full * 64, static_cast<unsigned>(rest)) == other.extract(full * 64, static_cast<unsigned>(rest));
+    }
+    bool operator!=(const BitStream& other) const { return !(*this == other); }
+
+private:
+    std::vector<uint64_t> m_words;
+    size_t m_bits;
+
+    // Makes `index` the last word, zeroed so bits can be OR-ed in; words left over from
+    // before a clear() are dropped
+    void openWord(size_t index)
+    {
+        m_words.resize(index + 1);
+        m_words[index] = 0;
+    }
+};
@@ -0,0 +1,192 @@
+#include "diagnostics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const float DB_PER_LEVEL = 0.5f;
+
+// Binary dump layout, all little-endian:
+//   "RIFD", uint16 version, uint16 0
+//   uint32 bins, frames, symbols
+//   float32 firstBinHz, binHz, frameSeconds, referenceDb, dbPerLevel
+//   frames x bins uint8 levels, dB = referenceDb - (255 - level) * dbPerLevel (0 is at or below)
+//   frames x float32 mag0, mag1, floor0, floor1
+//   symbols x (float32 mag0, mag1, floor0, floor1, uint8 bit)
+const char BINARY_MAGIC[4] = {'R', 'I', 'F', 'D'};
+const uint16_t BINARY_VERSION = 1;
+
+void putLE16(std::vector<uint8_t>& out, uint16_t v)
+{
+    out.push_back(static_cast<uint8_t>(v));
+    out.push_back(static_cast<uint8_t>(v >> 8));
+}
+
+void putLE32(std::vector<uint8_t>& out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+}
+
+void putFloat(std::vector<uint8_t>& out, float v)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    putLE32(out, bits);
+}
+
+float referenceDb(const std::vector<float>& magnitudes)
+{
+    float peak = 0.0f;
+    for (float m : magnitudes)
+    {
+        peak = std::max(peak, m);
+    }
+    return peak > 0.0f ? 20.0f * std::log10(peak) : 0.0f;
+}
+
+// Grey levels of the spectrogram, 255 at the reference
+std::vector<uint8_t> quantize(const std::vector<float>& magnitudes, float reference)
+{
+    std::vector<uint8_t> levels(magnitudes.size());
+    for (size_t i = 0; i < magnitudes.size(); ++i)
+    {
+        float below = magnitudes[i] > 0.0f ? (reference - 20.0f * std::log10(magnitudes[i])) / DB_PER_LEVEL : 255.0f;
+        levels[i] = static_cast<uint8_t>(255.0f - std::min(255.0f, std::max(0.0f, std::round(below))));
+    }
+    return levels;
+}
+
+} // namespace
+
+bool DiagnosticSnapshot::writePGM(std::ostream& out) const
+{
+    if (bins == 0 || frames.empty())
+    {
+        return false;
+    }
+    std::vector<uint8_t> levels = quantize(magnitudes, referenceDb(magnitudes));
+    out << "P5\n" << bins << " " << frames.size() << "\n255\n";
+    out.write(reinterpret_cast<const char*>(levels.data()), static_cast<std::streamsize>(levels.size()));
+    return static_cast<bool>(out);
+}
+
+bool DiagnosticSnapshot::writeBinary(std::ostream& out) const
+{
+    const float reference = referenceDb(magnitudes);
+    std::vector<uint8_t> data(BINARY_MAGIC, BINARY_MAGIC + sizeof(BINARY_MAGIC));
+    putLE16(data, BINARY_VERSION);
+    putLE16(data, 0);
+    putLE32(data, static_cast<uint32_t>(bins));
+    putLE32(data, static_cast<uint32_t>(frames.size()));
+    putLE32(data, static_cast<uint32_t>(symbols.size()));
+    putFloat(data, static_cast<float>(firstBinHz));
+    putFloat(data, static_cast<float>(binHz));
+    putFloat(data, static_cast<float>(frameSeconds));
+    putFloat(data, reference);
+    putFloat(data, DB_PER_LEVEL);
+
+    std::vector<uint8_t> levels = quantize(magnitudes, reference);
+    data.insert(data.end(), levels.begin(), levels.end());
+    for (const DiagnosticFrame& f : frames)
+    {
+        putFloat(data, f.mag0);
+        putFloat(data, f.mag1);
+        putFloat(data, f.floor0);
+        putFloat(data, f.floor1);
+    }
+    for (const DiagnosticSymbol& s : symbols)
+    {
+        putFloat(data, s.mag0);
+        putFloat(data, s.mag1);
+        putFloat(data, s.floor0);
+        putFloat(data, s.floor1);
+        data.push_back(s.bit);
+    }
+    out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(out);
+}
+
+void DiagnosticRing::configure(size_t capacity)
+{
+    m_capacity = capacity;
+    m_magnitudes.assign(capacity * m_bins, 0.0f);
+    m_frames.assign(capacity, DiagnosticFrame{});
+    m_symbols.assign(capacity, DiagnosticSymbol{});
+    clear();
+}
+
+void DiagnosticRing::setLayout(size_t bins, double firstBinHz, double binHz, double frameSeconds)
+{
+    if (bins != m_bins)
+    {
+        m_bins = bins;
+        m_magnitudes.assign(m_capacity * bins, 0.0f);
+        clear();
+    }
+    m_firstBinHz = firstBinHz;
+    m_binHz = binHz;
+    m_frameSeconds = frameSeconds;
+}
+
+void DiagnosticRing::pushFrame(const float* magnitudes, const DiagnosticFrame& frame)
+{
+    if (m_capacity == 0)
+    {
+        return;
+    }
+    // Rotate the negative frequencies in front so the row ascends
+    float* row = &m_magnitudes[m_frameHead * m_bins];
+    const size_t half = m_bins / 2;
+    std::copy(magnitudes + m_bins - half, magnitudes + m_bins, row);
+    std::copy(magnitudes, magnitudes + m_bins - half, row + half);
+    m_frames[m_frameHead] = frame;
+    m_frameHead = (m_frameHead + 1) % m_capacity;
+    m_frameCount = std::min(m_frameCount + 1, m_capacity);
+}
+
+void DiagnosticRing::pushSymbol(const DiagnosticSymbol& symbol)
+{
+    if (m_capacity == 0)
+    {
+        return;
+    }
+    m_symbols[m_symbolHead] = symbol;
+    m_symbolHead = (m_symbolHead + 1) % m_capacity;
+    m_symbolCount = std::min(m_symbolCount + 1, m_capacity);
+}
+
+DiagnosticSnapshot DiagnosticRing::snapshot() const
+{
+    DiagnosticSnapshot snap;
+    snap.bins = m_bins;
+    snap.firstBinHz = m_firstBinHz;
+    snap.binHz = m_binHz;
+    snap.frameSeconds = m_frameSeconds;
+    snap.magnitudes.reserve(m_frameCount * m_bins);
+    snap.frames.reserve(m_frameCount);
+    for (size_t i = 0; i < m_frameCount; ++i)
+    {
+        size_t slot = (m_frameHead + m_capacity - m_frameCount + i) % m_capacity;
+        snap.magnitudes.insert(snap.magnitudes.end(), m_magnitudes.begin() + slot * m_bins,
+                               m_magnitudes.begin() + (slot + 1) * m_bins);
+        snap.frames.push_back(m_frames[slot]);
+    }
+    snap.symbols.reserve(m_symbolCount);
+    for (size_t i = 0; i < m_symbolCount; ++i)
+    {
+        snap.symbols.push_back(m_symbols[(m_symbolHead + m_capacity - m_symbolCount + i) % m_capacity]);
+    }
+    return snap;
+}
+
+void DiagnosticRing::clear()
+{
+    m_frameHead = 0;
+    m_frameCount = 0;
+    m_symbolHead = 0;
+    m_symbolCount = 0;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Receiver measurements kept for field tuning, so f0, df and samplesPerFrame can be judged
+// from a capture without recording the raw audio
+
+// One analysis window: the two tone bins and the noise floor under each
+struct DiagnosticFrame {
+    float mag0;
+    float mag1;
+    float floor0;
+    float floor1;
+};
+
+// One symbol decision, with what it was decided on
+struct DiagnosticSymbol {
+    float mag0;
+    float mag1;
+    float floor0;
+    float floor1;
+    uint8_t bit;
+};
+
+// A copy of the ring, oldest entry first
+struct DiagnosticSnapshot {
+    size_t bins = 0;            // magnitudes per frame, in ascending frequency
+    double firstBinHz = 0.0;    // frequency of the first magnitude
+    double binHz = 0.0;         // spacing of the magnitudes
+    double frameSeconds = 0.0;  // spacing of the frames
+    std::vector<float> magnitudes;  // frames.size() rows of bins
+    std::vector<DiagnosticFrame> frames;
+    std::vector<DiagnosticSymbol> symbols;
+
+    // Spectrogram as an 8-bit binary PGM: a row per frame, time running down, low frequencies
+    // on the left, 0.5 dB per grey level below the loudest magnitude
+    bool writePGM(std::ostream& out) const;
+
+    // Compact little-endian dump: the spectrogram at the PGM's 8 bits per magnitude with its
+    // scale, then the tone measurements and symbol decisions as float32 (see diagnostics.cpp
+    // for the layout)
+    bool writeBinary(std::ostream& out) const;
+};
+
+// Bounded ring of the most recent frames and symbols. All storage is allocated by
+// configure() and setLayout(); pushing only copies.
+class DiagnosticRing {
+public:
+    DiagnosticRing() : m_capacity(0), m_bins(0), m_firstBinHz(0.0), m_binHz(0.0), m_frameSeconds(0.0),
+                       m_frameHead(0), m_frameCount(0), m_symbolHead(0), m_symbolCount(0) {}
+
+    // Keep up to capacity frames and as many symbols; 0 turns recording off
+    void configure(size_t capacity);
+    bool enabled() const { return m_capacity > 0; }
+
+    // Spectrum layout of the frames to come; a change of bins drops what was recorded
+    void setLayout(size_t bins, double firstBinHz, double binHz, double frameSeconds);
+
+    // magnitudes are in FFT order over a complex baseband: the top half of the bins holds the
+    // negative frequencies, and is stored first
+    void pushFrame(const float* magnitudes, const DiagnosticFrame& frame);
+    void pushSymbol(const DiagnosticSymbol& symbol);
+
+    DiagnosticSnapshot snapshot() const;
+    void clear();
+
+private:
+    size_t m_capacity;
+    size_t m_bins;
+    double m_firstBinHz;
+    double m_binHz;
+    double m_frameSeconds;
+
+    std::vector<float> m_magnitudes;  // m_capacity rows of m_bins
+    std::vector<DiagnosticFrame> m_frames;
+    size_t m_frameHead;
+    size_t m_frameCount;
+    std::vector<DiagnosticSymbol> m_symbols;
+    size_t m_symbolHead;
+    size_t m_symbolCount;
+};
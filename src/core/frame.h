@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "../reed-solomon/rs.hpp"
+
+// On-air frame layout shared by RiifUltrasonic and the embedded reader. A full frame is the
+// whole Reed-Solomon codeword. A shortened frame is the message length as two extended
+// Hamming (8,4) bytes (high nibble first), the message bytes and the parity; the zero padding
+// of the block and its last byte, which repeats the length, are implied.
+static constexpr size_t FRAME_HEADER_BYTES = 2;
+
+inline size_t frameSize(size_t messageLength, size_t blockSize, size_t parity, bool shortened)
+{
+    return shortened ? FRAME_HEADER_BYTES + messageLength + parity : blockSize + parity;
+}
+
+// Extended Hamming (8,4): distance 4, so one flipped bit per byte is corrected and two are
+// detected
+inline uint8_t hammingEncode(uint8_t nibble)
+{
+    uint8_t d0 = nibble & 1, d1 = (nibble >> 1) & 1, d2 = (nibble >> 2) & 1, d3 = (nibble >> 3) & 1;
+    uint8_t code = static_cast<uint8_t>((nibble & 0x0F) | ((d0 ^ d1 ^ d3) << 4) | ((d0 ^ d2 ^ d3) << 5) |
+                                        ((d1 ^ d2 ^ d3) << 6));
+    uint8_t parity = 0;
+    for (uint8_t v = code; v != 0; v &= static_cast<uint8_t>(v - 1))
+    {
+        parity ^= 1;
+    }
+    return static_cast<uint8_t>(code | (parity << 7));
+}
+
+inline int hammingDecode(uint8_t byte)
+{
+    for (uint8_t nibble = 0; nibble < 16; ++nibble)
+    {
+        uint8_t diff = static_cast<uint8_t>(byte ^ hammingEncode(nibble));
+        if ((diff & (diff - 1)) == 0)
+        {
+            return nibble;
+        }
+    }
+    return -1;
+}
+
+// Rebuilds a received frame byte by byte: bytes go to their codeword positions and through
+// the codec's streaming syndromes in codeword order, so correct() is left with error
+// location at most. Works on caller-owned buffers and never allocates.
+class FrameAssembler {
+public:
+    FrameAssembler() : m_rs(nullptr), m_codeword(nullptr), m_blockSize(0), m_parity(0), m_shortened(false),
+                       m_bytes(0), m_frameBytes(0), m_length(0), m_header(0), m_failed(true) {}
+
+    // codeword holds blockSize + parity bytes; a null codec leaves the frame failed
+    void begin(RS::ReedSolomon* rs, uint8_t* codeword, size_t blockSize, size_t parity, bool shortened)
+    {
+        m_rs = rs;
+        m_codeword = codeword;
+        m_blockSize = blockSize;
+        m_parity = parity;
+        m_shortened = shortened;
+        m_bytes = 0;
+        m_frameBytes = shortened ? 0 : frameSize(blockSize, blockSize, parity, false);
+        m_length = shortened ? 0 : blockSize;
+        m_header = 0;
+        m_failed = rs == nullptr;
+        if (!m_failed)
+        {
+            m_rs->BeginSyndromes();
+        }
+    }
+
+    void abandon() { m_failed = true; }
+
+    // Complete, or known not to decode
+    bool done() const { return m_failed || (m_frameBytes != 0 && m_bytes == m_frameBytes); }
+    size_t messageLength() const { return m_length; }
+
+    void push(uint8_t byte)
+    {
+        size_t index = m_bytes++;
+        if (!m_shortened)
+        {
+            m_codeword[index] = byte;
+            m_rs->PushSyndromes(byte);
+            return;
+        }
+
+        // The message bytes take the front of the block; the padding and the length byte are
+        // filled in before the parity arrives
+        if (index < FRAME_HEADER_BYTES)
+        {
+            int nibble = hammingDecode(byte);
+            if (nibble < 0)
+            {
+                m_failed = true;
+                return;
+            }
+            m_header = static_cast<uint8_t>(m_header << 4 | nibble);
+            if (index + 1 < FRAME_HEADER_BYTES)
+            {
+                return;
+            }
+            m_length = m_header;
+            if (m_length >= m_blockSize)
+            {
+                m_failed = true;
+                return;
+            }
+            m_frameBytes = frameSize(m_length, m_blockSize, m_parity, true);
+        }
+        else if (index < FRAME_HEADER_BYTES + m_length)
+        {
+            m_codeword[index - FRAME_HEADER_BYTES] = byte;
+            m_rs->PushSyndromes(byte);
+        }
+        else
+        {
+            m_codeword[m_blockSize + index - FRAME_HEADER_BYTES - m_length] = byte;
+            m_rs->PushSyndromes(byte);
+            return;
+        }
+
+        if (index + 1 == FRAME_HEADER_BYTES + m_length)
+        {
+            for (size_t i = m_length; i + 1 < m_blockSize; ++i)
+            {
+                m_codeword[i] = 0;
+            }
+            m_codeword[m_blockSize - 1] = static_cast<uint8_t>(m_length);
+            m_rs->PushZeros(m_blockSize - 1 - m_length);
+            m_rs->PushSyndromes(m_codeword[m_blockSize - 1]);
+        }
+    }
+
+    // Corrects the complete codeword into message (blockSize bytes); messageLength() of them
+    // are the message. A clean codeword is copied out as is.
+    bool correct(uint8_t* message)
+    {
+        if (m_failed || m_frameBytes == 0 || m_bytes < m_frameBytes || m_rs->DecodeStreamed(m_codeword, message) != 0)
+        {
+            return false;
+        }
+        // A header corrupted beyond repair shows up as a length the codeword does not confirm
+        return !m_shortened || message[m_blockSize - 1] == m_length;
+    }
+
+private:
+    RS::ReedSolomon* m_rs;
+    uint8_t* m_codeword;
+    size_t m_blockSize;
+    size_t m_parity;
+    bool m_shortened;
+    size_t m_bytes;       // frame bytes received
+    size_t m_frameBytes;  // frame size, 0 until the header has been read
+    size_t m_length;      // message bytes
+    uint8_t m_header;
+    bool m_failed;
+};
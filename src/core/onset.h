@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Transmission onset and symbol grid search, shared by the embedded reader and AsyncReceiver.
+// Both measure the two tones with Goertzel filters, whose coefficients (2 cos(w) of each
+// tone at the capture rate) the caller provides. Nothing here allocates.
+//
+// An onset is a block, a quarter symbol, whose stronger tone stands clear of the level heard
+// before it. It only starts a receive once a symbol grid after it is confirmed: a burst of
+// noise crosses the onset threshold, but it does not pick one tone per symbol for
+// ALIGN_SYMBOLS symbols.
+namespace onset {
+
+constexpr float LEVEL = 0.05f;  // tone amplitude, relative to full scale
+constexpr float RATIO = 4.0f;   // over the tone level heard before the onset
+constexpr float NOISE_SMOOTHING = 0.1f;
+constexpr size_t ALIGN_SYMBOLS = 4;  // symbols scored for each candidate grid
+
+// Tone amplitude over n samples, relative to full scale
+inline float toneLevel(const int16_t* x, size_t n, float coeff)
+{
+    float s1 = 0.0f, s2 = 0.0f;
+    for (size_t i = 0; i < n; ++i)
+    {
+        float s = x[i] * (1.0f / 32768.0f) + coeff * s1 - s2;
+        s2 = s1;
+        s1 = s;
+    }
+    float power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+    return std::sqrt(power > 0.0f ? power : 0.0f) * 2.0f / n;
+}
+
+// Whether a block is an onset; otherwise its level is folded into the noise estimate
+inline bool heard(const int16_t* block, size_t n, const float coeff[2], float& noise)
+{
+    float level0 = toneLevel(block, n, coeff[0]);
+    float level1 = toneLevel(block, n, coeff[1]);
+    float level = level0 > level1 ? level0 : level1;
+    if (level > LEVEL && level > RATIO * noise)
+    {
+        return true;
+    }
+    noise += NOISE_SMOOTHING * (level - noise);
+    return false;
+}
+
+// The transmission starts at most a symbol before the onset block and by its end. Each
+// candidate start in [first, last] is scored by how clearly the ALIGN_SYMBOLS symbols from it
+// pick one tone; one symbol early loses a symbol's worth, so the earliest clear winner is the
+// grid. x must hold last + ALIGN_SYMBOLS * symbol samples. Returns false, leaving start
+// alone, when no candidate bears the onset out.
+inline bool findGrid(const int16_t* x, size_t first, size_t last, size_t step, size_t symbol, const float coeff[2],
+                     size_t& start)
+{
+    float best = -1.0f;
+    size_t bestStart = first;
+    for (size_t candidate = first; candidate <= last; candidate += step)
+    {
+        float score = 0.0f;
+        for (size_t k = 0; k < ALIGN_SYMBOLS; ++k)
+        {
+            const int16_t* s = x + candidate + k * symbol;
+            score += std::fabs(toneLevel(s, symbol, coeff[1]) - toneLevel(s, symbol, coeff[0]));
+        }
+        if (score > best)
+        {
+            best = score;
+            bestStart = candidate;
+        }
+    }
+    if (best < LEVEL * ALIGN_SYMBOLS)
+    {
+        return false;
+    }
+    start = bestStart;
+    return true;
+}
+
+}
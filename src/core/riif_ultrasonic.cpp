@@ -1,5 +1,7 @@
 #include "riif_ultrasonic.h"
 #include "fft_impl.hpp"
+#include "encryption/encryption.h"
+#include "trace.h"
 #include <cmath>
 #include <algorithm>
 #include <random>
@@ -9,207 +11,1133 @@
 #include <bitset>
 #include <deque>
 #include <chrono>
+#include <limits>
 
 const double PI = 3.14159265358979323846;
 
-RiifUltrasonic::RiifUltrasonic() : m_current_byte(0), m_bit_count(0), rs(nullptr), rs_work_buffer(nullptr)
+namespace {
+
+// Frame byte at bit pos, MSB first
+uint8_t frameByte(const BitStream& bits, size_t pos)
+{
+    return static_cast<uint8_t>(bits.extract(pos, 8));
+}
+
+uint8_t frameByte(const std::vector<bool>& bits, size_t pos)
+{
+    uint8_t byte = 0;
+    for (size_t b = 0; b < 8; ++b)
+    {
+        byte = static_cast<uint8_t>((byte << 1) | (bits[pos + b] ? 1 : 0));
+    }
+    return byte;
+}
+
+// The bits from pos on
+BitStream bitsFrom(const BitStream& bits, size_t pos)
+{
+    BitStream tail;
+    for (; pos < bits.size(); pos += 32)
+    {
+        unsigned width = static_cast<unsigned>(std::min<size_t>(32, bits.size() - pos));
+        tail.append(bits.extract(pos, width), width);
+    }
+    return tail;
+}
+
+} // namespace
+
+RiifUltrasonic::RiifUltrasonic() : m_profile(nullptr), m_current_byte(0), m_bit_count(0),
+    m_spectrum_bins(0), m_spectrum_head(0), m_spectrum_count(0), m_noise_frames(0), m_noise_subwindow(0),
+    m_frequency_offset(0.0), m_rx(), m_frame(), m_frame_bit(0)
 {
     std::cout << "Entering RiifUltrasonic constructor..." << std::endl;
-    m_params = {
-        DEFAULT_SAMPLE_RATE,
-        DEFAULT_SAMPLES_PER_FRAME,
-        DEFAULT_BITS_IN_MARKER,
-        DEFAULT_MARKER_FRAMES,
-        DEFAULT_F0,
-        DEFAULT_DF,
-        DEFAULT_NUM_FREQS,
-        DEFAULT_RS_MSG_LENGTH,
-        DEFAULT_RS_ECC_LENGTH,
-        DEFAULT_PREAMBLE_DURATION};
-    initializeFrequencies();
+    // The default profile has no codec until setParameters() selects one, it only serves decode
+    m_default_profile.reset(new CodecProfile());
+    buildProfile(*m_default_profile, Parameters(), false);
+    m_profile = m_default_profile.get();
     std::cout << "RiifUltrasonic constructor completed." << std::endl;
 }
 
 RiifUltrasonic::~RiifUltrasonic()
 {
-    delete rs;
-    delete[] rs_work_buffer;
 }
 
-void RiifUltrasonic::setParameters(const Parameters &params)
+RiifUltrasonic::CodecProfile::~CodecProfile()
 {
-    std::cout << "Entering setParameters..." << std::endl;
+    // The codec lives in the arena, only its destructor has to run
+    if (rs != nullptr)
+    {
+        rs->~ReedSolomon();
+    }
+}
 
-    m_params = params;
-    std::cout << "Parameters assigned." << std::endl;
+void RiifUltrasonic::setParameters(const Parameters &params)
+{
+    selectProfile(registerProfile(params));
+}
 
-    initializeFrequencies();
-    std::cout << "Frequencies initialized." << std::endl;
+int RiifUltrasonic::registerProfile(const Parameters &params)
+{
+    for (size_t i = 0; i < m_profiles.size(); ++i)
+    {
+        if (m_profiles[i]->params == params)
+        {
+            return static_cast<int>(i);
+        }
+    }
 
-    std::cout << "Checking existing objects..." << std::endl;
+    std::unique_ptr<CodecProfile> profile(new CodecProfile());
+    buildProfile(*profile, params, true);
+    m_profiles.push_back(std::move(profile));
+    return static_cast<int>(m_profiles.size() - 1);
+}
 
-    // Safely delete existing objects
-    if (rs != nullptr) {
-        std::cout << "Deleting existing RS object..." << std::endl;
-        delete rs;
-        rs = nullptr;
-        std::cout << "Deleted existing RS object." << std::endl;
-    } else {
-        std::cout << "No existing RS object to delete." << std::endl;
+bool RiifUltrasonic::selectProfile(int id)
+{
+    if (id < 0 || static_cast<size_t>(id) >= m_profiles.size())
+    {
+        return false;
     }
+    // Everything the codec needs was built at registration, so switching is a pointer swap.
+    // A receive or frame in progress belongs to the old profile and is abandoned.
+    m_profile = m_profiles[id].get();
+    m_rx.active = false;
+    m_frame.abandon();
+    return true;
+}
 
-    if (rs_work_buffer != nullptr) {
-        std::cout << "Deleting existing RS work buffer..." << std::endl;
-        delete[] rs_work_buffer;
-        rs_work_buffer = nullptr;
-        std::cout << "Deleted existing RS work buffer." << std::endl;
-    } else {
-        std::cout << "No existing RS work buffer to delete." << std::endl;
+int RiifUltrasonic::activeProfile() const
+{
+    for (size_t i = 0; i < m_profiles.size(); ++i)
+    {
+        if (m_profiles[i].get() == m_profile)
+        {
+            return static_cast<int>(i);
+        }
     }
+    return -1;
+}
 
-    std::cout << "Calculating RS work size..." << std::endl;
-    size_t work_size = RS::ReedSolomon::getWorkSize_bytes(m_params.rsMsgLength, m_params.rsEccLength);
-    std::cout << "RS work size calculated: " << work_size << " bytes" << std::endl;
+void RiifUltrasonic::buildProfile(CodecProfile &profile, const Parameters &params, bool withCodec)
+{
+    profile.params = params;
+    initializeFrequencies(profile);
+    selectFrontEnd(profile, params.sampleRate);
+    buildSymbolTemplates(profile);
 
-    std::cout << "Allocating RS work buffer..." << std::endl;
-    rs_work_buffer = new uint8_t[work_size];
-    std::cout << "RS work buffer allocated." << std::endl;
+    // Output buffers sized once, nothing pending until the next prepare()
+    profile.tx.codeword.assign(params.rsMsgLength + params.rsEccLength, 0);
+    profile.tx.frame.assign(FRAME_HEADER_BYTES + profile.tx.codeword.size(), 0);
+    profile.tx.frameBytes = 0;
+    profile.tx.bit = 0;
+    profile.tx.sample = 0;
+    profile.tx.padding = 0;
 
-    std::cout << "Creating new RS object..." << std::endl;
-    rs = new RS::ReedSolomon(m_params.rsMsgLength, m_params.rsEccLength, rs_work_buffer);
-    std::cout << "RS object created." << std::endl;
+    if (!withCodec)
+    {
+        return;
+    }
 
-    std::cout << "setParameters completed successfully." << std::endl;
+    // Codec context: the RS codec, its workspace and the message and codeword scratch in one
+    // aligned block
+    size_t work_size = RS::ReedSolomon::getWorkSize_bytes(params.rsMsgLength, params.rsEccLength);
+    size_t codeword_size = params.rsMsgLength + params.rsEccLength;
+    profile.codecArena.reserve(Arena::footprint<RS::ReedSolomon>(1) + Arena::footprint<uint8_t>(work_size) +
+                               Arena::footprint<uint8_t>(params.rsMsgLength) +
+                               Arena::footprint<uint8_t>(codeword_size));
+    profile.rsWork = profile.codecArena.allocate<uint8_t>(work_size);
+    profile.messageScratch = profile.codecArena.allocate<uint8_t>(params.rsMsgLength);
+    profile.codewordScratch = profile.codecArena.allocate<uint8_t>(codeword_size);
+    profile.rs = new (profile.codecArena.allocate<RS::ReedSolomon>(1))
+        RS::ReedSolomon(params.rsMsgLength, params.rsEccLength, profile.rsWork);
+
+    // Every channel that fits the native rate fits no higher capture rate either, so these
+    // are all the plan will ever need
+    if (params.planChannels > 1)
+    {
+        profile.plan.reset(new RiifUltrasonic());
+        for (int channel = 0; channelFits(params, channel, params.sampleRate); ++channel)
+        {
+            Parameters plan = channelParameters(params, channel);
+            plan.planChannels = 1;
+            profile.plan->registerProfile(plan);
+        }
+    }
 }
 
-void RiifUltrasonic::initializeFrequencies()
+void RiifUltrasonic::initializeFrequencies(CodecProfile &profile)
 {
-    m_frequencies.clear();
-    for (int i = 0; i < m_params.numFreqs; ++i)
+    profile.frequencies.clear();
+    for (int i = 0; i < profile.params.numFreqs; ++i)
     {
-        m_frequencies.push_back(m_params.f0 + i * m_params.df);
+        profile.frequencies.push_back(profile.params.f0 + i * profile.params.df);
     }
 }
 
 std::vector<int16_t> RiifUltrasonic::encode(const std::string &message)
 {
-    std::vector<uint8_t> data(message.begin(), message.end());
-    std::vector<uint8_t> encoded = rsEncode(data);
+    RIIF_TRACE_SCOPE("encode");
+    // Repeated broadcasts (store beacons and the like) are served from the cache
+    size_t key = std::hash<std::string>()(message);
+    auto hit = m_profile->waveformIndex.find(key);
+    if (hit != m_profile->waveformIndex.end() && hit->second->message == message)
+    {
+        m_profile->waveformCache.splice(m_profile->waveformCache.begin(), m_profile->waveformCache, hit->second);
+        return hit->second->signal;
+    }
 
-    std::vector<int> tones;
-    generateTones(encoded, tones);
     std::vector<int16_t> signal;
-    generateWaveform(tones, signal);
-
-    size_t minSize = m_params.samplesPerFrame * (tones.size() + m_params.preambleDuration / m_params.samplesPerFrame);
-    signal.resize(minSize, 0);
+    if (!prepare(message))
+    {
+        return signal;
+    }
+    signal.resize(pendingFrames());
+    render(signal.data(), signal.size());
 
+    if (hit != m_profile->waveformIndex.end())
+    {
+        // Hash collision: the newer message takes the slot
+        m_profile->waveformCache.erase(hit->second);
+        m_profile->waveformIndex.erase(hit);
+    }
+    else if (m_profile->waveformCache.size() >= WAVEFORM_CACHE_ENTRIES)
+    {
+        m_profile->waveformIndex.erase(m_profile->waveformCache.back().key);
+        m_profile->waveformCache.pop_back();
+    }
+    m_profile->waveformCache.push_front(CachedWaveform{key, message, signal});
+    m_profile->waveformIndex[key] = m_profile->waveformCache.begin();
     return signal;
 }
 
-void RiifUltrasonic::generateTones(const std::vector<uint8_t> &encoded, std::vector<int> &tones)
+void RiifUltrasonic::buildSymbolTemplates(CodecProfile &profile)
 {
-    tones.clear();
-    tones.reserve(encoded.size() * 8);
+    // With the raised-cosine shaping every symbol of a tone is the same waveform up to its
+    // starting phase, so each tone is rendered once per phase step and synthesis becomes a
+    // copy. Rounding the start phase to a step costs nothing at the receiver, which only
+    // looks at tone magnitudes, and the window hides the step at the symbol edges.
+    const int spf = profile.params.samplesPerFrame;
+    std::vector<double> window(spf);
+    for (int i = 0; i < spf; ++i)
+    {
+        window[i] = 0.5 * (1 - std::cos(2 * M_PI * i / spf));
+    }
 
-    for (uint8_t byte : encoded)
+    profile.symbolTemplates.resize(2 * SYMBOL_TEMPLATE_PHASES * static_cast<size_t>(spf));
+    for (int tone = 0; tone < 2; ++tone)
     {
-        for (int i = 7; i >= 0; --i)
+        double w = 2 * M_PI * (profile.params.f0 + tone * profile.params.df) / profile.params.sampleRate;
+        profile.symbolAdvance[tone] = std::fmod(w * spf, 2 * M_PI);
+        for (int p = 0; p < SYMBOL_TEMPLATE_PHASES; ++p)
         {
-            int bit = (byte >> i) & 1;
-            tones.push_back(bit);
+            int16_t* shape = &profile.symbolTemplates[(tone * SYMBOL_TEMPLATE_PHASES + p) * static_cast<size_t>(spf)];
+            double start = 2 * M_PI * p / SYMBOL_TEMPLATE_PHASES;
+            for (int i = 0; i < spf; ++i)
+            {
+                shape[i] = static_cast<int16_t>(std::sin(start + w * i) * window[i] * 32767);
+            }
         }
     }
+
+    profile.waveformCache.clear();
+    profile.waveformIndex.clear();
+    profile.batchWorkers.clear();
+}
+
+bool RiifUltrasonic::prepare(const std::string &message)
+{
+    if (m_profile->rs == nullptr)
+    {
+        return false;
+    }
+
+    size_t used = loadMessage(reinterpret_cast<const uint8_t*>(message.data()), message.size(),
+                              m_profile->messageScratch);
+    transmitBlock(*m_profile->rs, m_profile->messageScratch, used, m_profile->tx);
+    return true;
 }
 
-void RiifUltrasonic::generateWaveform(const std::vector<int> &tones, std::vector<int16_t> &signal)
+size_t RiifUltrasonic::messageCapacity() const
 {
-    signal.clear();
-    signal.reserve(tones.size() * m_params.samplesPerFrame);
+    // A shortened block keeps its last byte for the message length
+    const Parameters& params = m_profile->params;
+    return params.shortenCodewords ? params.rsMsgLength - 1 : params.rsMsgLength;
+}
 
-    double phase = 0.0;
-    double phaseIncrement0 = 2 * M_PI * m_params.f0 / m_params.sampleRate;
-    double phaseIncrement1 = 2 * M_PI * (m_params.f0 + m_params.df) / m_params.sampleRate;
+size_t RiifUltrasonic::loadMessage(const uint8_t *message, size_t length, uint8_t *block) const
+{
+    // The block always holds rsMsgLength bytes: shorter messages are zero padded
+    const size_t block_size = m_profile->params.rsMsgLength;
+    size_t used = std::min(length, messageCapacity());
+    std::copy_n(message, used, block);
+    std::fill(block + used, block + block_size, uint8_t(0));
+    if (m_profile->params.shortenCodewords)
+    {
+        block[block_size - 1] = static_cast<uint8_t>(used);
+    }
+    return used;
+}
+
+size_t RiifUltrasonic::frameBytes(size_t messageLength) const
+{
+    const Parameters& params = m_profile->params;
+    return frameSize(messageLength, params.rsMsgLength, params.rsEccLength, params.shortenCodewords);
+}
 
-    for (size_t j = 0; j < tones.size(); ++j)
+void RiifUltrasonic::transmitBlock(RS::ReedSolomon &rs, const uint8_t *block, size_t messageLength, TransmitState &tx) const
+{
+    const Parameters& params = m_profile->params;
     {
-        int tone = tones[j];
-        double phaseIncrement = tone == 0 ? phaseIncrement0 : phaseIncrement1;
+        RIIF_TRACE_SCOPE("rs.encode");
+        rs.Encode(block, tx.codeword.data());
+    }
 
-        for (int i = 0; i < m_params.samplesPerFrame; ++i)
-        {
-            double sample = std::sin(phase);
+    // A shortened code leaves out the padding and the length byte, which the receiver knows
+    // from the header, so only the message and the parity are sent
+    uint8_t* frame = tx.frame.data();
+    if (params.shortenCodewords)
+    {
+        *frame++ = hammingEncode(static_cast<uint8_t>(messageLength >> 4));
+        *frame++ = hammingEncode(static_cast<uint8_t>(messageLength & 0x0F));
+        frame = std::copy_n(tx.codeword.begin(), messageLength, frame);
+        std::copy_n(tx.codeword.begin() + params.rsMsgLength, params.rsEccLength, frame);
+    }
+    else
+    {
+        std::copy(tx.codeword.begin(), tx.codeword.end(), frame);
+    }
+    tx.frameBytes = frameBytes(messageLength);
+    startTransmit(tx);
+}
 
-            // Apply smoothing
-            double smoothFactor = 0.5 * (1 - std::cos(2 * M_PI * i / m_params.samplesPerFrame));
-            sample *= smoothFactor;
+bool RiifUltrasonic::prepareSealed(const ChaCha20Poly1305 &aead, const uint8_t *nonce, const uint8_t *payload, size_t length)
+{
+    if (m_profile->rs == nullptr || length + ChaCha20Poly1305::TAG_SIZE > messageCapacity())
+    {
+        return false;
+    }
 
-            signal.push_back(static_cast<int16_t>(sample * 32767));
+    // Ciphertext and tag go straight into the block the codec encodes, then the padding
+    uint8_t* block = m_profile->messageScratch;
+    size_t used = length + ChaCha20Poly1305::TAG_SIZE;
+    const size_t block_size = m_profile->params.rsMsgLength;
+    aead.seal(nonce, nullptr, 0, payload, block, length, block + length);
+    std::fill(block + used, block + block_size, uint8_t(0));
+    if (m_profile->params.shortenCodewords)
+    {
+        block[block_size - 1] = static_cast<uint8_t>(used);
+    }
+    transmitBlock(*m_profile->rs, block, used, m_profile->tx);
+    return true;
+}
 
-            phase += phaseIncrement;
-            if (phase >= 2 * M_PI)
-            {
-                phase -= 2 * M_PI;
-            }
+bool RiifUltrasonic::openSealed(const BitStream &bits, const ChaCha20Poly1305 &aead, const uint8_t *nonce,
+                                uint8_t *payload, size_t length)
+{
+    beginFrame();
+    feedFrame(bits);
+    return openFrame(aead, nonce, payload, length);
+}
+
+bool RiifUltrasonic::openSealed(const std::vector<bool> &bits, const ChaCha20Poly1305 &aead, const uint8_t *nonce,
+                                uint8_t *payload, size_t length)
+{
+    beginFrame();
+    feedFrame(bits);
+    return openFrame(aead, nonce, payload, length);
+}
+
+bool RiifUltrasonic::openFrame(const ChaCha20Poly1305 &aead, const uint8_t *nonce, uint8_t *payload, size_t length)
+{
+    size_t used;
+    if (!correctFrame(used) || length + ChaCha20Poly1305::TAG_SIZE > used ||
+        (m_profile->params.shortenCodewords && length + ChaCha20Poly1305::TAG_SIZE != used))
+    {
+        return false;
+    }
+
+    const uint8_t* block = m_profile->messageScratch;
+    return aead.open(nonce, nullptr, 0, block, payload, length, block + length);
+}
+
+std::vector<uint8_t> RiifUltrasonic::decodeMessage(const BitStream &bits)
+{
+    beginFrame();
+    feedFrame(bits);
+    return finishFrame();
+}
+
+std::vector<uint8_t> RiifUltrasonic::decodeMessage(const std::vector<bool> &bits)
+{
+    beginFrame();
+    feedFrame(bits);
+    return finishFrame();
+}
+
+void RiifUltrasonic::beginFrame()
+{
+    const Parameters& params = m_profile->params;
+    m_frame_bit = 0;
+    m_frame.begin(m_profile->rs, m_profile->codewordScratch, params.rsMsgLength, params.rsEccLength,
+                  params.shortenCodewords);
+}
+
+bool RiifUltrasonic::feedFrame(const BitStream &bits)
+{
+    return feedFrameBits(bits);
+}
+
+bool RiifUltrasonic::feedFrame(const std::vector<bool> &bits)
+{
+    return feedFrameBits(bits);
+}
+
+template <typename Bits>
+bool RiifUltrasonic::feedFrameBits(const Bits &bits)
+{
+    while (!m_frame.done() && m_frame_bit + 8 <= bits.size())
+    {
+        m_frame.push(frameByte(bits, m_frame_bit));
+        m_frame_bit += 8;
+    }
+    return m_frame.done();
+}
+
+std::vector<uint8_t> RiifUltrasonic::finishFrame()
+{
+    size_t length;
+    if (!correctFrame(length))
+    {
+        return std::vector<uint8_t>();
+    }
+    return std::vector<uint8_t>(m_profile->messageScratch, m_profile->messageScratch + length);
+}
+
+bool RiifUltrasonic::correctFrame(size_t &messageLength)
+{
+    RIIF_TRACE_SCOPE("rs.decode");
+    if (!m_frame.done() || !m_frame.correct(m_profile->messageScratch))
+    {
+        return false;
+    }
+    messageLength = m_frame.messageLength();
+    return true;
+}
+
+void RiifUltrasonic::startTransmit(TransmitState &tx) const
+{
+    tx.bit = 0;
+    tx.sample = 0;
+    tx.phase = 0.0;
+    tx.shape = nullptr;
+    tx.padding = m_profile->params.samplesPerFrame * (m_profile->params.preambleDuration / m_profile->params.samplesPerFrame);
+}
+
+size_t RiifUltrasonic::transmitFrames(size_t messageLength) const
+{
+    return frameBytes(messageLength) * 8 * m_profile->params.samplesPerFrame +
+           m_profile->params.samplesPerFrame * (m_profile->params.preambleDuration / m_profile->params.samplesPerFrame);
+}
+
+size_t RiifUltrasonic::pendingFrames() const
+{
+    size_t bits = m_profile->tx.frameBytes * 8;
+    if (m_profile->tx.bit >= bits)
+    {
+        return m_profile->tx.padding;
+    }
+    return (bits - m_profile->tx.bit) * m_profile->params.samplesPerFrame - m_profile->tx.sample + m_profile->tx.padding;
+}
+
+size_t RiifUltrasonic::render(int16_t *out, size_t frames)
+{
+    RIIF_TRACE_SCOPE("render");
+    return synthesize(m_profile->tx, out, frames);
+}
+
+size_t RiifUltrasonic::synthesize(TransmitState &tx, int16_t *out, size_t frames) const
+{
+    // Synthesis resumes exactly where the previous call stopped, mid-symbol if need be. The
+    // oscillator phase is carried across symbols exactly and only rounded to pick a template.
+    const size_t bits = tx.frameBytes * 8;
+    const size_t spf = m_profile->params.samplesPerFrame;
+
+    size_t written = 0;
+    while (written < frames && tx.bit < bits)
+    {
+        if (tx.sample == 0)
+        {
+            int tone = (tx.frame[tx.bit / 8] >> (7 - tx.bit % 8)) & 1;
+            long step = std::lround(tx.phase / (2 * M_PI) * SYMBOL_TEMPLATE_PHASES) % SYMBOL_TEMPLATE_PHASES;
+            tx.shape = &m_profile->symbolTemplates[(tone * SYMBOL_TEMPLATE_PHASES + step) * spf];
+            tx.phase = std::fmod(tx.phase + m_profile->symbolAdvance[tone], 2 * M_PI);
+        }
+
+        size_t run = std::min(frames - written, spf - tx.sample);
+        std::copy_n(tx.shape + tx.sample, run, out + written);
+        written += run;
+        tx.sample += static_cast<int>(run);
+        if (tx.sample == m_profile->params.samplesPerFrame)
+        {
+            tx.sample = 0;
+            ++tx.bit;
         }
     }
+
+    // Trailing silence
+    size_t silence = std::min(frames - written, tx.padding);
+    std::fill_n(out + written, silence, int16_t(0));
+    tx.padding -= silence;
+    return written + silence;
 }
 
-std::vector<uint8_t> RiifUltrasonic::rsEncode(const std::vector<uint8_t> &data)
+RiifUltrasonic::EncodedBatch RiifUltrasonic::encodeBatch(const std::vector<std::string> &messages)
 {
-    std::vector<uint8_t> encoded(m_params.rsMsgLength + m_params.rsEccLength, 0);
-    rs->Encode(data.data(), encoded.data());
-    return encoded;
+    return encodeBatch(messages.data(), messages.size());
+}
+
+RiifUltrasonic::EncodedBatch RiifUltrasonic::encodeBatch(const std::string *messages, size_t count)
+{
+    RIIF_TRACE_SCOPE("encodeBatch");
+    EncodedBatch batch;
+    if (m_profile->rs == nullptr)
+    {
+        return batch;
+    }
+
+    // Transmission lengths follow from the message lengths alone, so the arena layout is known
+    // up front and each worker writes its messages in place
+    batch.offsets.resize(count + 1);
+    batch.offsets[0] = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        batch.offsets[i + 1] = batch.offsets[i] + transmitFrames(std::min(messages[i].size(), messageCapacity()));
+    }
+    batch.samples.resize(batch.offsets[count]);
+
+    // The codec keeps its polynomials in its work buffer, so each worker gets its own
+    ThreadPool& pool = ThreadPool::shared();
+    const size_t codeword_length = m_profile->params.rsMsgLength + m_profile->params.rsEccLength;
+    while (m_profile->batchWorkers.size() < pool.workerCount())
+    {
+        std::unique_ptr<BatchWorker> worker(new BatchWorker());
+        worker->rsWork.resize(RS::ReedSolomon::getWorkSize_bytes(m_profile->params.rsMsgLength, m_profile->params.rsEccLength));
+        worker->rs.reset(new RS::ReedSolomon(m_profile->params.rsMsgLength, m_profile->params.rsEccLength, worker->rsWork.data()));
+        worker->data.resize(m_profile->params.rsMsgLength);
+        worker->tx.codeword.resize(codeword_length);
+        worker->tx.frame.resize(FRAME_HEADER_BYTES + codeword_length);
+        m_profile->batchWorkers.push_back(std::move(worker));
+    }
+
+    pool.parallelFor(count, [&](size_t w, size_t i) {
+        RIIF_TRACE_SCOPE("encodeBatch.message");
+        BatchWorker& worker = *m_profile->batchWorkers[w];
+        const std::string& message = messages[i];
+        size_t used = loadMessage(reinterpret_cast<const uint8_t*>(message.data()), message.size(), worker.data.data());
+        transmitBlock(*worker.rs, worker.data.data(), used, worker.tx);
+        synthesize(worker.tx, batch.samples.data() + batch.offsets[i], batch.offsets[i + 1] - batch.offsets[i]);
+    });
+    return batch;
 }
 
 std::vector<bool> RiifUltrasonic::decode(const std::vector<int16_t>& signal) {
-    std::vector<float> normalizedSignal;
-    normalizeAmplitude(signal, normalizedSignal);
+    return decode(signal, m_profile->params.sampleRate);
+}
+
+std::vector<bool> RiifUltrasonic::decode(const std::vector<int16_t>& signal, int captureRate) {
+    return decode(signal.data(), signal.size(), captureRate);
+}
 
+std::vector<bool> RiifUltrasonic::decode(const int16_t* samples, size_t count, int captureRate) {
+    RIIF_TRACE_SCOPE("decode");
     std::vector<bool> decoded_bits;
-    size_t frame_size = m_params.samplesPerFrame;
-
-    for (size_t i = 0; i < normalizedSignal.size(); i += frame_size) {
-        size_t frame_end = std::min(i + frame_size, normalizedSignal.size());
-        std::vector<float> frame(normalizedSignal.begin() + i, normalizedSignal.begin() + frame_end);
-        
-        auto fft_result = performFFT(frame);
-        auto demodulated_data = demodulateFFT(fft_result);
-
-        if (!demodulated_data.empty()) {
-            decoded_bits.push_back(demodulated_data[0] == 1);
-        } else {
-            decoded_bits.push_back(false);  // Default to 0 if no bit detected
+    if (!beginReceive(captureRate))
+    {
+        return decoded_bits;
+    }
+    receive(samples, count, decoded_bits);
+    endReceive(decoded_bits);
+    return decoded_bits;
+}
+
+void RiifUltrasonic::decode(const int16_t* samples, size_t count, int captureRate, BitStream& bits) {
+    RIIF_TRACE_SCOPE("decode");
+    bits.clear();
+    if (!beginReceive(captureRate))
+    {
+        return;
+    }
+    receive(samples, count, bits);
+    endReceive(bits);
+}
+
+RiifUltrasonic::Parameters RiifUltrasonic::channelParameters(const Parameters &params, int channel) const
+{
+    Parameters shifted = params;
+    shifted.f0 += channel * PLAN_CHANNEL_SPACING * params.df;
+    return shifted;
+}
+
+bool RiifUltrasonic::channelFits(const Parameters &params, int channel, int sampleRate) const
+{
+    if (channel < 0 || channel >= std::min(params.planChannels, MAX_PLAN_CHANNELS))
+    {
+        return false;
+    }
+    // Both tones and the main lobe of the upper one below Nyquist
+    double top = channelParameters(params, channel).f0 + params.df + double(params.sampleRate) / params.samplesPerFrame;
+    return top < std::min(params.sampleRate, sampleRate) / 2.0;
+}
+
+RiifUltrasonic::BandSurvey RiifUltrasonic::surveyBand(const int16_t* samples, size_t count, int captureRate)
+{
+    RIIF_TRACE_SCOPE("survey");
+    BandSurvey survey;
+    const Parameters& params = m_profile->params;
+    if (captureRate <= 0 || count < static_cast<size_t>(FFT_SIZE))
+    {
+        return survey;
+    }
+
+    // Mean power spectrum of half overlapping Hann windowed blocks
+    std::vector<float> window(FFT_SIZE);
+    for (int i = 0; i < FFT_SIZE; ++i)
+    {
+        window[i] = static_cast<float>(0.5 * (1 - std::cos(2 * M_PI * i / FFT_SIZE)));
+    }
+    std::vector<double> power(FFT_SIZE / 2 + 1, 0.0);
+    std::vector<float> block(FFT_SIZE);
+    size_t blocks = 0;
+    for (size_t start = 0; start + FFT_SIZE <= count; start += FFT_SIZE / 2, ++blocks)
+    {
+        for (int i = 0; i < FFT_SIZE; ++i)
+        {
+            block[i] = samples[start + i] / 32768.0f * window[i];
+        }
+        std::vector<std::complex<float>> spectrum = performFFT(block);
+        for (size_t k = 0; k < power.size(); ++k)
+        {
+            power[k] += std::norm(spectrum[k]);
         }
     }
 
-    return decoded_bits;
+    // Noise under a tone is the mean over its main lobe, a symbol rate either side, since
+    // anything there leaks into the tone's detector
+    const double bin_hz = double(captureRate) / FFT_SIZE;
+    const double lobe = std::max(bin_hz, double(params.sampleRate) / params.samplesPerFrame);
+    auto tone_noise = [&](double freq) {
+        long lo = std::max(0L, std::lround((freq - lobe) / bin_hz));
+        long hi = std::min(static_cast<long>(power.size()) - 1, std::lround((freq + lobe) / bin_hz));
+        double sum = 0.0;
+        for (long k = lo; k <= hi; ++k)
+        {
+            sum += power[k];
+        }
+        return std::sqrt(sum / ((hi - lo + 1) * blocks));
+    };
+
+    for (int channel = 0; channelFits(params, channel, captureRate); ++channel)
+    {
+        Parameters plan = channelParameters(params, channel);
+        survey.noise.push_back(std::max(tone_noise(plan.f0), tone_noise(plan.f0 + plan.df)));
+        if (survey.best < 0 || survey.noise.back() < survey.noise[survey.best])
+        {
+            survey.best = channel;
+        }
+    }
+    return survey;
 }
 
-std::vector<uint8_t> RiifUltrasonic::rsDecode(const std::vector<uint8_t> &encoded_data)
+std::vector<int16_t> RiifUltrasonic::encodeOnChannel(const std::string &message, int channel)
 {
-    if (encoded_data.size() != m_params.rsMsgLength + m_params.rsEccLength)
+    const Parameters& params = m_profile->params;
+    if (m_profile->plan == nullptr || !channelFits(params, channel, params.sampleRate))
     {
-        return std::vector<uint8_t>();
+        return std::vector<int16_t>();
     }
+    RiifUltrasonic& plan = *m_profile->plan;
 
-    std::vector<uint8_t> decoded(m_params.rsMsgLength, 0);
-    int result = rs->Decode(encoded_data.data(), decoded.data());
+    // The plan header goes out on every channel at once, each at an equal share of full scale,
+    // so interference on some channels leaves it readable on the others
+    int channels = 0;
+    while (channelFits(params, channels, params.sampleRate))
+    {
+        ++channels;
+    }
+    const size_t header_samples = PLAN_HEADER_BYTES * 8 * params.samplesPerFrame;
+    std::vector<int32_t> mix(header_samples, 0);
+    std::vector<int16_t> signal(header_samples);
+    TransmitState header;
+    header.frame.assign(PLAN_HEADER_BYTES, hammingEncode(static_cast<uint8_t>(channel)));
+    header.frameBytes = PLAN_HEADER_BYTES;
+    for (int c = 0; c < channels; ++c)
+    {
+        plan.selectProfile(c);
+        plan.startTransmit(header);
+        header.padding = 0;
+        plan.synthesize(header, signal.data(), signal.size());
+        for (size_t i = 0; i < header_samples; ++i)
+        {
+            mix[i] += signal[i];
+        }
+    }
+    for (size_t i = 0; i < header_samples; ++i)
+    {
+        signal[i] = static_cast<int16_t>(mix[i] / channels);
+    }
 
-    if (result != 0)
+    plan.selectProfile(channel);
+    std::vector<int16_t> frame = plan.encode(message);
+    if (frame.empty())
+    {
+        return frame;
+    }
+    signal.insert(signal.end(), frame.begin(), frame.end());
+    return signal;
+}
+
+int RiifUltrasonic::readPlanHeader(const int16_t* samples, size_t count, int captureRate)
+{
+    const Parameters& params = m_profile->params;
+    if (m_profile->plan == nullptr)
+    {
+        return -1;
+    }
+    RiifUltrasonic& plan = *m_profile->plan;
+
+    // Only the header's stretch of the capture is received on each channel, with as much
+    // again after it for the grid to settle; the most common valid reading wins and ties go
+    // to the lower channel
+    const size_t header_bits = PLAN_HEADER_BYTES * 8;
+    const double header_span = 2.0 * header_bits * params.samplesPerFrame * captureRate / params.sampleRate;
+    const size_t span = std::min(count, static_cast<size_t>(header_span));
+    int votes[MAX_PLAN_CHANNELS] = {};
+    BitStream bits;
+    for (int channel = 0; channelFits(params, channel, captureRate); ++channel)
+    {
+        plan.selectProfile(channel);
+        plan.decode(samples, span, captureRate, bits);
+        int reading = bits.size() >= header_bits ? hammingDecode(frameByte(bits, 0)) : -1;
+        if (channelFits(params, reading, captureRate))
+        {
+            ++votes[reading];
+        }
+    }
+
+    int announced = static_cast<int>(std::max_element(votes, votes + MAX_PLAN_CHANNELS) - votes);
+    return votes[announced] > 0 ? announced : -1;
+}
+
+std::vector<uint8_t> RiifUltrasonic::decodeAdaptive(const int16_t* samples, size_t count, int captureRate)
+{
+    RIIF_TRACE_SCOPE("decodeAdaptive");
+    if (m_profile->plan == nullptr)
     {
         return std::vector<uint8_t>();
     }
 
-    return decoded;
+    // Without a header there is no channel to try: a full decode per channel would cost the
+    // whole pipeline times the channel count, on exactly the captures too noisy to read
+    const int announced = readPlanHeader(samples, count, captureRate);
+    if (announced < 0)
+    {
+        return std::vector<uint8_t>();
+    }
+    RiifUltrasonic& plan = *m_profile->plan;
+    BitStream bits;
+    plan.selectProfile(announced);
+    plan.decode(samples, count, captureRate, bits);
+    return plan.decodeMessage(bitsFrom(bits, PLAN_HEADER_BYTES * 8));
+}
+
+bool RiifUltrasonic::beginReceive(int captureRate)
+{
+    m_rx.active = false;
+
+    // The tones have to be representable at the capture rate
+    if (captureRate <= 0 || m_profile->params.f0 + m_profile->params.df >= captureRate / 2.0)
+    {
+        return false;
+    }
+
+    // A capture at another rate only retargets the front end and the symbol grid, the
+    // samples themselves are never resampled
+    selectFrontEnd(*m_profile, captureRate);
+
+    const double rate_ratio = static_cast<double>(captureRate) / m_profile->params.sampleRate;
+    const int decimation = m_profile->rx->frontend.decimation();
+    m_rx.frameSize = m_profile->rx->basebandFrame;
+    m_rx.hop = std::max<size_t>(1, static_cast<size_t>(analysisHop(m_profile->params) * rate_ratio / decimation));
+    m_rx.period = m_profile->params.samplesPerFrame * rate_ratio / decimation;
+    m_rx.stage = ReceiveState::ACQUIRE;
+    m_rx.base = 0;
+    m_rx.frames.clear();
+    m_rx.frameBase = 0;
+    m_rx.nextFrame = 0;
+    m_rx.active = true;
+
+    m_profile->rx->frontend.reset();
+    m_baseband.clear();
+    m_frequency_offset = 0.0;
+
+    const double output_rate = m_profile->rx->frontend.outputRate();
+    m_diagnostics.setLayout(m_profile->rx->basebandFftSize, m_profile->rx->frontend.centerFrequency() - output_rate / 2,
+                            output_rate / m_profile->rx->basebandFftSize, m_rx.hop / output_rate);
+    return true;
+}
+
+void RiifUltrasonic::receive(const int16_t* samples, size_t count, BitStream& bits)
+{
+    receiveBits(samples, count, bits);
+}
+
+void RiifUltrasonic::receive(const int16_t* samples, size_t count, std::vector<bool>& bits)
+{
+    receiveBits(samples, count, bits);
+}
+
+void RiifUltrasonic::endReceive(BitStream& bits)
+{
+    endReceiveBits(bits);
+}
+
+void RiifUltrasonic::endReceive(std::vector<bool>& bits)
+{
+    endReceiveBits(bits);
+}
+
+template <typename Bits>
+void RiifUltrasonic::receiveBits(const int16_t* samples, size_t count, Bits& bits)
+{
+    RIIF_TRACE_SCOPE("receive");
+    if (!m_rx.active)
+    {
+        return;
+    }
+    // Everything downstream of the front end runs on the decimated complex baseband
+    m_profile->rx->frontend.process(samples, count, m_baseband);
+    runReceiver(false, bits);
+}
+
+template <typename Bits>
+void RiifUltrasonic::endReceiveBits(Bits& bits)
+{
+    RIIF_TRACE_SCOPE("receive");
+    if (!m_rx.active)
+    {
+        return;
+    }
+    runReceiver(true, bits);
+    m_rx.active = false;
+}
+
+template <typename Bits>
+void RiifUltrasonic::runReceiver(bool flush, Bits& bits)
+{
+    ReceiveState& rx = m_rx;
+    const size_t available = rx.base + m_baseband.size();
+
+    if (rx.stage == ReceiveState::ACQUIRE)
+    {
+        // Acquisition: the spectral peaks over the first symbols give the carrier offset, then
+        // the overlapping analysis restarts on the compensated bins
+        size_t length = ACQUISITION_SYMBOLS * rx.frameSize;
+        if (!flush && available < length + rx.frameSize)
+        {
+            return;
+        }
+        RIIF_TRACE_SCOPE("acquire");
+        analyzeSTFT(m_baseband, rx.hop, rx.frames, length);
+        m_frequency_offset = acquireFrequencyOffset(rx.frames);
+        rx.analysisOffset = m_frequency_offset;
+
+        rx.frames.clear();
+        resetSpectrumHistory(m_profile->rx->basebandFftSize);
+        rx.stage = ReceiveState::ALIGN;
+    }
+
+    advanceSTFT(flush);
+
+    if (rx.stage == ReceiveState::ALIGN)
+    {
+        // Pick the frame phase whose windows line up with the symbols
+        size_t needed = static_cast<size_t>(std::ceil(rx.period / rx.hop)) * ACQUISITION_SYMBOLS;
+        if (!flush && rx.nextFrame < needed)
+        {
+            return;
+        }
+        RIIF_TRACE_SCOPE("align");
+        rx.tau = static_cast<double>(selectAlignment(rx.frames, rx.hop, rx.period));
+        rx.drift = 0.0;
+        rx.prevTau = 0.0;
+        rx.prevTf = ToneFrame{};
+        rx.prevBit = -1;
+        rx.stage = ReceiveState::TRACK;
+    }
+
+    trackSymbols(flush, bits);
+
+    // Drop what the loop can no longer reach: the next boundary window starts after the last
+    // symbol and the floors are read ahead of the grid. Trimming in large steps keeps the
+    // erase cost amortized.
+    size_t keep = static_cast<size_t>(std::max(0.0, std::min(rx.prevTau, rx.tau)));
+    keep = std::max(keep, rx.base);
+    if (keep - rx.base > m_baseband.size() / 2)
+    {
+        m_baseband.erase(m_baseband.begin(), m_baseband.begin() + (keep - rx.base));
+        rx.base = keep;
+    }
+    size_t keep_frame = std::max(rx.frameBase, keep / rx.hop);
+    if (keep_frame - rx.frameBase > rx.frames.size() / 2)
+    {
+        rx.frames.erase(rx.frames.begin(), rx.frames.begin() + (keep_frame - rx.frameBase));
+        rx.frameBase = keep_frame;
+    }
+}
+
+void RiifUltrasonic::advanceSTFT(bool flush)
+{
+    // Windows are analysed once they are complete; at the end of the stream the last ones
+    // are taken short, as over a finished recording. The bins stay on the acquired offset so
+    // the result does not depend on how the stream was split.
+    ReceiveState& rx = m_rx;
+    const size_t available = rx.base + m_baseband.size();
+    while (true)
+    {
+        size_t start = rx.nextFrame * rx.hop;
+        if (start >= available || (!flush && start + rx.frameSize > available))
+        {
+            break;
+        }
+        const ToneFrame tf = analyzeFrame(m_baseband, start - rx.base, rx.analysisOffset);
+        rx.frames.push_back(tf);
+        ++rx.nextFrame;
+
+        size_t newest = (m_spectrum_head + SPECTRUM_HISTORY_SIZE - 1) % SPECTRUM_HISTORY_SIZE;
+        m_diagnostics.pushFrame(&m_spectrum_history[newest * m_spectrum_bins],
+                                DiagnosticFrame{tf.mag0, tf.mag1, tf.floor0, tf.floor1});
+    }
+}
+
+template <typename Bits>
+void RiifUltrasonic::trackSymbols(bool flush, Bits& bits)
+{
+    // Symbol timing recovery. The grid starts at the STFT alignment and is then steered by a
+    // Gardner-style detector: at every transition between unlike symbols a window centred on
+    // the expected boundary should hold equal shares of both tones. The share of each tone is
+    // taken relative to its own symbol so unequal tone levels do not bias the estimate.
+    ReceiveState& rx = m_rx;
+    const size_t total = rx.base + m_baseband.size();
+    const size_t frame_size = rx.frameSize;
+    const double period = rx.period;
+
+    while (true) {
+        size_t start = static_cast<size_t>(std::lround(rx.tau));
+        // The floor is read one sub-window ahead, where the tracker has settled
+        size_t grid_index = start / rx.hop + NOISE_FLOOR_SUBWINDOW_FRAMES;
+        if (flush) {
+            if (rx.tau + period / 2 > total || start >= total || rx.frames.empty()) {
+                break;
+            }
+            grid_index = std::min(grid_index, rx.frameBase + rx.frames.size() - 1);
+        } else if (start + frame_size > total || grid_index >= rx.nextFrame) {
+            break;
+        }
+
+        ToneFrame tf = measureTonesAt(m_baseband, start - rx.base, m_frequency_offset);
+        const ToneFrame& grid = rx.frames[grid_index - rx.frameBase];
+        tf.floor0 = grid.floor0;
+        tf.floor1 = grid.floor1;
+        int bit = decideBit(tf);
+        bits.push_back(bit == 1);
+        m_diagnostics.pushSymbol(DiagnosticSymbol{tf.mag0, tf.mag1, tf.floor0, tf.floor1, static_cast<uint8_t>(bit)});
+        trackFrequencyOffset(m_baseband, start - rx.base, tf, bit);
+
+        size_t mid = static_cast<size_t>(std::lround(rx.prevTau + period / 2));
+        if (rx.prevBit >= 0 && bit != rx.prevBit && mid + frame_size <= total) {
+            ToneFrame boundary = measureTonesAt(m_baseband, mid - rx.base, m_frequency_offset);
+            float prev_pure = rx.prevBit ? rx.prevTf.mag1 : rx.prevTf.mag0;
+            float next_pure = bit ? tf.mag1 : tf.mag0;
+            if (prev_pure > 0.0f && next_pure > 0.0f) {
+                double prev_share = (rx.prevBit ? boundary.mag1 : boundary.mag0) / prev_pure;
+                double next_share = (bit ? boundary.mag1 : boundary.mag0) / next_pure;
+                if (prev_share + next_share > 0.0) {
+                    // Positive error: the boundary window sits past the true boundary, the grid is late
+                    double error = (next_share - prev_share) / (prev_share + next_share) * period / 2;
+                    rx.tau -= TIMING_LOOP_GAIN * error;
+                    rx.drift -= TIMING_DRIFT_GAIN * error;
+                }
+            }
+        }
+
+        rx.prevTau = rx.tau;
+        rx.prevTf = tf;
+        rx.prevBit = bit;
+        rx.tau += period + rx.drift;
+    }
+}
+
+size_t RiifUltrasonic::analysisHop(const Parameters &params) const
+{
+    size_t frame_size = params.samplesPerFrame;
+    size_t hop = params.analysisHop > 0 ? params.analysisHop : frame_size / 4;
+    return std::max<size_t>(1, std::min(hop, frame_size));
+}
+
+void RiifUltrasonic::analyzeSTFT(const std::vector<std::complex<float>>& signal, size_t hop, std::vector<ToneFrame>& frames, size_t length)
+{
+    length = std::min(length, signal.size());
+
+    resetSpectrumHistory(m_profile->rx->basebandFftSize);
+
+    frames.clear();
+    frames.reserve(length / hop + 1);
+
+    for (size_t i = 0; i < length; i += hop)
+    {
+        frames.push_back(analyzeFrame(signal, i, m_frequency_offset));
+    }
+}
+
+RiifUltrasonic::ToneFrame RiifUltrasonic::analyzeFrame(const std::vector<std::complex<float>>& signal, size_t start, double offset)
+{
+    size_t frame_end = std::min(start + m_profile->rx->basebandFrame, signal.size());
+    const auto& spectrum = performBasebandFFT(signal.data() + start, frame_end - start);
+    pushSpectrum(spectrum);
+    ToneFrame tf = measureTones(spectrum, basebandBin(m_profile->params.f0 + offset),
+                                basebandBin(m_profile->params.f0 + m_profile->params.df + offset));
+    tf.peak = static_cast<float>(findDominantFrequency(spectrum));
+    return tf;
+}
+
+size_t RiifUltrasonic::selectAlignment(const std::vector<ToneFrame>& frames, size_t hop, double period)
+{
+    // A window that straddles a symbol boundary mixes both tones and pulls the tone contrast
+    // towards its mean, so the best-aligned phase is the one where the contrast varies most.
+    // Using the variance rather than the magnitude keeps a steady interferer on one tone from
+    // biasing the choice. Only the start of the signal is used, the timing loop follows any
+    // drift from there. The period need not be a whole number of hops (or samples), so each
+    // window is binned by where it starts within its symbol.
+    size_t hopsPerFrame = static_cast<size_t>(std::ceil(period / hop));
+    ArenaScope scope(m_profile->rx->scratchArena);
+    double* sum = m_profile->rx->scratchArena.allocate<double>(hopsPerFrame);
+    double* sum_sq = m_profile->rx->scratchArena.allocate<double>(hopsPerFrame);
+    size_t* count = m_profile->rx->scratchArena.allocate<size_t>(hopsPerFrame);
+    std::fill_n(sum, hopsPerFrame, 0.0);
+    std::fill_n(sum_sq, hopsPerFrame, 0.0);
+    std::fill_n(count, hopsPerFrame, size_t(0));
+    size_t acquisition = std::min(frames.size(), hopsPerFrame * ACQUISITION_SYMBOLS);
+    for (size_t k = 0; k < acquisition; ++k)
+    {
+        size_t p = std::min(hopsPerFrame - 1, static_cast<size_t>(std::fmod(k * hop, period) / hop));
+        double contrast = frames[k].mag1 - frames[k].mag0;
+        sum[p] += contrast;
+        sum_sq[p] += contrast * contrast;
+        count[p]++;
+    }
+
+    size_t best = 0;
+    double best_score = -1.0;
+    for (size_t p = 0; p < hopsPerFrame; ++p)
+    {
+        if (count[p] == 0)
+        {
+            continue;
+        }
+        double mean = sum[p] / count[p];
+        double score = sum_sq[p] / count[p] - mean * mean;
+        if (score > best_score)
+        {
+            best_score = score;
+            best = p;
+        }
+    }
+    return best * hop;
+}
+
+void RiifUltrasonic::resetSpectrumHistory(size_t bins)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+
+    // assign() keeps the storage when the size is unchanged, so restarting does not allocate
+    m_spectrum_bins = bins;
+    m_spectrum_history.assign(SPECTRUM_HISTORY_SIZE * bins, 0.0f);
+    m_spectrum_head = 0;
+    m_spectrum_count = 0;
+    m_spectrum_sum.assign(bins, 0.0);
+    m_avg_spectrum.assign(bins, 0.0f);
+
+    m_noise_floor.assign(bins, 0.0f);
+    m_noise_current_min.assign(bins, inf);
+    m_noise_subwindow_min.assign(bins * NOISE_FLOOR_SUBWINDOWS, inf);
+    m_noise_past_min.assign(bins, inf);
+    m_noise_frames = 0;
+    m_noise_subwindow = 0;
+}
+
+void RiifUltrasonic::pushSpectrum(const std::vector<std::complex<float>>& spectrum)
+{
+    if (m_spectrum_bins != spectrum.size())
+    {
+        resetSpectrumHistory(spectrum.size());
+    }
+
+    // Overwrite the oldest slot in place and keep the running sum in step with the ring
+    float* slot = &m_spectrum_history[m_spectrum_head * m_spectrum_bins];
+    bool full = m_spectrum_count == SPECTRUM_HISTORY_SIZE;
+    for (size_t i = 0; i < spectrum.size(); ++i)
+    {
+        float mag = std::abs(spectrum[i]);
+        m_spectrum_sum[i] += full ? mag - slot[i] : mag;
+        slot[i] = mag;
+    }
+    m_spectrum_head = (m_spectrum_head + 1) % SPECTRUM_HISTORY_SIZE;
+    m_spectrum_count = std::min<size_t>(m_spectrum_count + 1, SPECTRUM_HISTORY_SIZE);
+
+    updateNoiseFloor();
+}
+
+void RiifUltrasonic::updateNoiseFloor()
+{
+    const std::vector<float>& avg = calculateAverageSpectrum();
+    const size_t bins = avg.size();
+
+    for (size_t i = 0; i < bins; ++i)
+    {
+        m_noise_current_min[i] = std::min(m_noise_current_min[i], avg[i]);
+        m_noise_floor[i] = NOISE_FLOOR_BIAS * std::min(m_noise_current_min[i], m_noise_past_min[i]);
+    }
+
+    if (++m_noise_frames < NOISE_FLOOR_SUBWINDOW_FRAMES)
+    {
+        return;
+    }
+
+    // Sub-window complete: retire the oldest minimum and rebuild the minimum over the window
+    float* retired = &m_noise_subwindow_min[m_noise_subwindow * bins];
+    std::copy(m_noise_current_min.begin(), m_noise_current_min.end(), retired);
+    m_noise_subwindow = (m_noise_subwindow + 1) % NOISE_FLOOR_SUBWINDOWS;
+    m_noise_frames = 0;
+
+    std::fill(m_noise_past_min.begin(), m_noise_past_min.end(), std::numeric_limits<float>::infinity());
+    for (int w = 0; w < NOISE_FLOOR_SUBWINDOWS; ++w)
+    {
+        const float* sub = &m_noise_subwindow_min[w * bins];
+        for (size_t i = 0; i < bins; ++i)
+        {
+            m_noise_past_min[i] = std::min(m_noise_past_min[i], sub[i]);
+        }
+    }
+    std::fill(m_noise_current_min.begin(), m_noise_current_min.end(), std::numeric_limits<float>::infinity());
 }
 
 void RiifUltrasonic::addPreamble(std::vector<int16_t> &signal)
 {
-    for (int i = 0; i < m_params.preambleDuration; ++i)
+    for (int i = 0; i < m_profile->params.preambleDuration; ++i)
     {
-        double t = static_cast<double>(i) / m_params.sampleRate;
-        double freq = m_frequencies[0] + (m_frequencies[m_params.numFreqs - 1] - m_frequencies[0]) * i / m_params.preambleDuration;
+        double t = static_cast<double>(i) / m_profile->params.sampleRate;
+        double freq = m_profile->frequencies[0] + (m_profile->frequencies[m_profile->params.numFreqs - 1] - m_profile->frequencies[0]) * i / m_profile->params.preambleDuration;
         signal.push_back(static_cast<int16_t>(32767 * std::sin(2 * PI * freq * t)));
     }
 }
@@ -218,7 +1146,7 @@ void RiifUltrasonic::addTone(std::vector<int16_t> &signal, double freq, int dura
 {
     for (int i = 0; i < duration; ++i)
     {
-        double t = static_cast<double>(i) / m_params.sampleRate;
+        double t = static_cast<double>(i) / m_profile->params.sampleRate;
         int16_t sample = static_cast<int16_t>(32767 * std::sin(2 * PI * freq * t));
         signal.push_back(sample);
     }
@@ -227,14 +1155,14 @@ void RiifUltrasonic::addTone(std::vector<int16_t> &signal, double freq, int dura
 size_t RiifUltrasonic::detectPreamble(const std::vector<float> &signal)
 {
     float threshold = 0.1f; // Adjust this value based on your signal characteristics
-    for (size_t i = 0; i < signal.size() - m_params.preambleDuration; ++i)
+    for (size_t i = 0; i < signal.size() - m_profile->params.preambleDuration; ++i)
     {
         float energy = 0;
-        for (size_t j = 0; j < m_params.preambleDuration; ++j)
+        for (size_t j = 0; j < m_profile->params.preambleDuration; ++j)
         {
             energy += signal[i + j] * signal[i + j];
         }
-        if (energy > threshold * m_params.preambleDuration)
+        if (energy > threshold * m_profile->params.preambleDuration)
         {
             return i;
         }
@@ -251,7 +1179,8 @@ void RiifUltrasonic::prepareFFT(int n)
 
 std::vector<std::complex<float>> RiifUltrasonic::performFFT(const std::vector<float> &frame)
 {
-    int n = 1024; // Fixed size to ensure consistency
+    RIIF_TRACE_SCOPE("fft");
+    int n = FFT_SIZE; // Fixed size to ensure consistency
     
     if (frame.size() > n) {
         throw std::runtime_error("Input frame size exceeds FFT size");
@@ -279,38 +1208,274 @@ std::vector<std::complex<float>> RiifUltrasonic::performFFT(const std::vector<fl
     return result;
 }
 
-std::vector<uint8_t> RiifUltrasonic::demodulateFFT(const std::vector<std::complex<float>> &fft_result)
+void RiifUltrasonic::selectFrontEnd(CodecProfile &profile, int captureRate)
 {
-    std::vector<uint8_t> demodulated;
-    const float magnitude_threshold = 0.1f;
-    const float relative_threshold = 1.2f;
+    if (profile.rx != nullptr && profile.rx->captureRate == captureRate)
+    {
+        return;
+    }
+    for (const std::unique_ptr<CaptureFrontEnd>& fe : profile.frontEnds)
+    {
+        if (fe->captureRate == captureRate)
+        {
+            profile.rx = fe.get();
+            return;
+        }
+    }
+    std::unique_ptr<CaptureFrontEnd> fe(new CaptureFrontEnd());
+    configureFrontEnd(*fe, profile.params, captureRate);
+    profile.rx = fe.get();
+    profile.frontEnds.push_back(std::move(fe));
+}
 
-    size_t fft_size = (fft_result.size() - 1) * 2;
-    size_t bin0_center = static_cast<size_t>(m_params.f0 * fft_size / m_params.sampleRate);
-    size_t bin1_center = static_cast<size_t>((m_params.f0 + m_params.df) * fft_size / m_params.sampleRate);
+void RiifUltrasonic::configureFrontEnd(CaptureFrontEnd &fe, const Parameters &params, int captureRate)
+{
+    // Centre the band on the tone pair and decimate as far as the band allows: the tones, a
+    // carrier offset of up to half a spacing and two main lobes either side have to fit in the
+    // alias-free part of the output band, and a symbol has to keep enough samples to analyse.
+    // The symbol keeps its duration, so at another capture rate it spans a fractional number
+    // of samples.
+    fe.captureRate = captureRate;
+    const double fs = captureRate;
+    const int spf = static_cast<int>(params.samplesPerFrame * fs / params.sampleRate);
+    double spacing = std::abs(params.df);
+    double center = params.f0 + params.df / 2;
+    double edge = spacing + 2.0 * params.sampleRate / params.samplesPerFrame;
 
-    float mag0 = std::abs(fft_result[bin0_center]);
-    float mag1 = std::abs(fft_result[bin1_center]);
+    int decimation = MAX_DECIMATION;
+    while (decimation > 1 && (fs / decimation * BASEBAND_PASSBAND < edge || spf / decimation < MIN_BASEBAND_FRAME))
+    {
+        decimation /= 2;
+    }
+    fe.frontend.configure(fs, center, decimation);
 
-    int detected_bit = -1;
-    if (mag0 > magnitude_threshold || mag1 > magnitude_threshold)
+    fe.basebandFrame = std::max(1, spf / decimation);
+    fe.basebandFftSize = 2;
+    while (fe.basebandFftSize < static_cast<int>(fe.basebandFrame))
     {
-        detected_bit = (mag1 > mag0 * relative_threshold) ? 1 : 0;
+        fe.basebandFftSize *= 2;
     }
-    else
+    fe.basebandFftWorkArea.assign(2 + static_cast<size_t>(std::ceil(std::sqrt(fe.basebandFftSize))), 0);
+    fe.basebandFftSinCosTable.assign(fe.basebandFftSize / 2, 0.0f);
+    fe.basebandFftBuffer.resize(2 * fe.basebandFftSize);
+    fe.basebandSpectrum.resize(fe.basebandFftSize);
+
+    // Per-transaction scratch: the acquisition offsets and the alignment statistics
+    const double rate_ratio = fs / params.sampleRate;
+    size_t hop = std::max<size_t>(1, static_cast<size_t>(analysisHop(params) * rate_ratio / decimation));
+    size_t hops_per_symbol = fe.basebandFrame / hop + 2;
+    size_t acquisition_frames = ACQUISITION_SYMBOLS * fe.basebandFrame / hop + 1;
+    fe.scratchArena.reserve(Arena::footprint<double>(acquisition_frames) +
+                            2 * Arena::footprint<double>(hops_per_symbol) + Arena::footprint<size_t>(hops_per_symbol));
+}
+
+const std::vector<std::complex<float>>& RiifUltrasonic::performBasebandFFT(const std::complex<float>* samples, size_t count)
+{
+    RIIF_TRACE_SCOPE("fft");
+    const size_t n = m_profile->rx->basebandFftSize;
+    if (count > n) {
+        throw std::runtime_error("Input frame size exceeds FFT size");
+    }
+
+    std::fill(m_profile->rx->basebandFftBuffer.begin(), m_profile->rx->basebandFftBuffer.end(), 0.0f);
+    for (size_t i = 0; i < count; ++i)
     {
-        detected_bit = 0; // Default to 0 if neither magnitude is significant
+        m_profile->rx->basebandFftBuffer[2 * i] = samples[i].real();
+        m_profile->rx->basebandFftBuffer[2 * i + 1] = samples[i].imag();
     }
 
-    demodulated.push_back(detected_bit);
-    return demodulated;
+    cdft(2 * n, -1, m_profile->rx->basebandFftBuffer.data(), m_profile->rx->basebandFftWorkArea.data(), m_profile->rx->basebandFftSinCosTable.data());
+
+    for (size_t k = 0; k < n; ++k)
+    {
+        m_profile->rx->basebandSpectrum[k] = std::complex<float>(m_profile->rx->basebandFftBuffer[2 * k], m_profile->rx->basebandFftBuffer[2 * k + 1]);
+    }
+    return m_profile->rx->basebandSpectrum;
+}
+
+size_t RiifUltrasonic::basebandBin(double freq) const
+{
+    // Bins below the band centre wrap to the top half of the transform
+    long n = m_profile->rx->basebandFftSize;
+    long k = std::lround((freq - m_profile->rx->frontend.centerFrequency()) * n / m_profile->rx->frontend.outputRate());
+    return static_cast<size_t>(((k % n) + n) % n);
+}
+
+float RiifUltrasonic::toneMagnitude(const std::vector<std::complex<float>> &signal, size_t start, double freq)
+{
+    // Single-bin DFT over one baseband frame at an arbitrary frequency, scaled like an FFT bin
+    size_t end = std::min(start + m_profile->rx->basebandFrame, signal.size());
+    double w = -2 * PI * (freq - m_profile->rx->frontend.centerFrequency()) / m_profile->rx->frontend.outputRate();
+    const std::complex<double> step(std::cos(w), std::sin(w));
+    std::complex<double> rotor(1.0, 0.0);
+    std::complex<double> acc(0.0, 0.0);
+    for (size_t i = start; i < end; ++i)
+    {
+        acc += std::complex<double>(signal[i]) * rotor;
+        rotor *= step;
+    }
+    return static_cast<float>(std::abs(acc));
 }
 
-int RiifUltrasonic::findDominantFrequency(const std::vector<std::complex<float>> &fft_result)
+RiifUltrasonic::ToneFrame RiifUltrasonic::measureTonesAt(const std::vector<std::complex<float>> &signal, size_t start, double offset)
 {
-    // Implement frequency detection logic here
-    // For now, we'll just return 0
-    return 0;
+    // Evaluated exactly on the offset-compensated tones rather than on the nearest FFT bin
+    ToneFrame tf = {};
+    tf.mag0 = toneMagnitude(signal, start, m_profile->params.f0 + offset);
+    tf.mag1 = toneMagnitude(signal, start, m_profile->params.f0 + m_profile->params.df + offset);
+    return tf;
+}
+
+size_t RiifUltrasonic::toneBin(double freq, size_t fft_size) const
+{
+    return static_cast<size_t>(std::lround(freq * fft_size / m_profile->params.sampleRate));
+}
+
+double RiifUltrasonic::acquireFrequencyOffset(const std::vector<ToneFrame>& frames)
+{
+    float strongest = 0.0f;
+    for (const ToneFrame& tf : frames)
+    {
+        strongest = std::max(strongest, std::max(tf.mag0, tf.mag1));
+    }
+
+    // Offset of each strong peak from the tone it is closest to. Most frames hold a single
+    // tone whatever their alignment, so the median rejects the ones that caught a transition
+    ArenaScope scope(m_profile->rx->scratchArena);
+    double* offsets = m_profile->rx->scratchArena.allocate<double>(frames.size());
+    size_t count = 0;
+    for (const ToneFrame& tf : frames)
+    {
+        if (tf.peak <= 0.0f || std::max(tf.mag0, tf.mag1) < 0.5f * strongest)
+        {
+            continue;
+        }
+        double d0 = tf.peak - m_profile->params.f0;
+        double d1 = tf.peak - (m_profile->params.f0 + m_profile->params.df);
+        offsets[count++] = std::abs(d0) < std::abs(d1) ? d0 : d1;
+    }
+    if (count == 0)
+    {
+        return 0.0;
+    }
+
+    std::nth_element(offsets, offsets + count / 2, offsets + count);
+    return offsets[count / 2];
+}
+
+void RiifUltrasonic::trackFrequencyOffset(const std::vector<std::complex<float>> &signal, size_t start, const ToneFrame &tf, int bit)
+{
+    // Only follow symbols with a clear decision, probing the decided tone a quarter of the
+    // main lobe either side of the current estimate
+    float own = bit ? tf.mag1 : tf.mag0;
+    float other = bit ? tf.mag0 : tf.mag1;
+    if (own < 2.0f * other || own <= MAGNITUDE_THRESHOLD)
+    {
+        return;
+    }
+
+    double freq = (bit ? m_profile->params.f0 + m_profile->params.df : m_profile->params.f0) + m_frequency_offset;
+    double delta = m_profile->params.sampleRate / (4.0 * m_profile->params.samplesPerFrame);
+    float upper = toneMagnitude(signal, start, freq + delta);
+    float lower = toneMagnitude(signal, start, freq - delta);
+    if (upper + lower <= 0.0f)
+    {
+        return;
+    }
+
+    // For a rectangular frame the discriminator slope at +-1/4 lobe is about 0.858 per lobe width
+    double error = (upper - lower) / (upper + lower) * m_profile->params.sampleRate / (0.858 * m_profile->params.samplesPerFrame);
+    m_frequency_offset += FREQUENCY_LOOP_GAIN * error;
+    m_frequency_offset = std::max(-m_profile->params.df / 2, std::min(m_profile->params.df / 2, m_frequency_offset));
+}
+
+RiifUltrasonic::ToneFrame RiifUltrasonic::measureTones(const std::vector<std::complex<float>> &fft_result, size_t bin0_center, size_t bin1_center)
+{
+    bool haveFloor = m_noise_floor.size() == fft_result.size();
+
+    ToneFrame tf = {};
+    tf.mag0 = std::abs(fft_result[bin0_center]);
+    tf.mag1 = std::abs(fft_result[bin1_center]);
+    tf.floor0 = haveFloor ? m_noise_floor[bin0_center] : 0.0f;
+    tf.floor1 = haveFloor ? m_noise_floor[bin1_center] : 0.0f;
+    return tf;
+}
+
+int RiifUltrasonic::demodulateFFT(const std::vector<std::complex<float>> &fft_result)
+{
+    size_t fft_size = (fft_result.size() - 1) * 2;
+    ToneFrame tf = measureTones(fft_result, toneBin(m_profile->params.f0 + m_frequency_offset, fft_size),
+                                toneBin(m_profile->params.f0 + m_profile->params.df + m_frequency_offset, fft_size));
+    return decideBit(tf);
+}
+
+int RiifUltrasonic::decideBit(const ToneFrame &tf) const
+{
+    float strongest = std::max(tf.mag0, tf.mag1);
+    if (tf.floor0 > 0.0f && tf.floor1 > 0.0f)
+    {
+        // Adaptive thresholds: the tone has to clear the quieter floor, then each bin is
+        // judged by what it carries above its own floor (capped so a tone that has been
+        // on for the whole window cannot hide itself)
+        if (strongest <= NOISE_FLOOR_MARGIN * std::min(tf.floor0, tf.floor1))
+        {
+            return 0;
+        }
+        float cap = NOISE_FLOOR_CAP * strongest;
+        float excess0 = tf.mag0 - std::min(tf.floor0, cap);
+        float excess1 = tf.mag1 - std::min(tf.floor1, cap);
+        return excess1 > excess0 ? 1 : 0;
+    }
+
+    if (tf.mag0 > MAGNITUDE_THRESHOLD || tf.mag1 > MAGNITUDE_THRESHOLD)
+    {
+        return (tf.mag1 > tf.mag0 * RELATIVE_THRESHOLD) ? 1 : 0;
+    }
+    return 0; // Default to 0 if neither magnitude is significant
+}
+
+double RiifUltrasonic::findDominantFrequency(const std::vector<std::complex<float>> &spectrum)
+{
+    // Strongest bin within half a tone spacing of the tone set, refined by fitting a parabola
+    // through it and its neighbours. Takes a baseband spectrum, bins are signed offsets from
+    // the band centre.
+    const long n = static_cast<long>(spectrum.size());
+    const double center = m_profile->rx->frontend.centerFrequency();
+    const double bin_hz = m_profile->rx->frontend.outputRate() / n;
+    long lo = std::lround((m_profile->params.f0 - m_profile->params.df / 2 - center) / bin_hz);
+    long hi = std::lround((m_profile->params.f0 + m_profile->params.df * 1.5 - center) / bin_hz);
+    lo = std::max(lo, -n / 2 + 1);
+    hi = std::min(hi, n / 2 - 2);
+    if (lo > hi)
+    {
+        return 0.0;
+    }
+
+    auto magnitude = [&](long k) { return std::abs(spectrum[((k % n) + n) % n]); };
+
+    long peak = lo;
+    float peak_mag = 0.0f;
+    for (long k = lo; k <= hi; ++k)
+    {
+        float mag = magnitude(k);
+        if (mag > peak_mag)
+        {
+            peak_mag = mag;
+            peak = k;
+        }
+    }
+    if (peak_mag <= 0.0f)
+    {
+        return 0.0;
+    }
+
+    float a = magnitude(peak - 1);
+    float b = peak_mag;
+    float c = magnitude(peak + 1);
+    float denom = a - 2 * b + c;
+    double delta = denom != 0.0f ? 0.5 * (a - c) / denom : 0.0;
+
+    return center + (peak + delta) * bin_hz;
 }
 
 void RiifUltrasonic::normalizeAmplitude(const std::vector<int16_t> &input, std::vector<float> &output)
@@ -326,9 +1491,7 @@ void RiifUltrasonic::normalizeAmplitude(const std::vector<int16_t> &input, std::
 bool RiifUltrasonic::processFrame(const std::vector<float> &frame)
 {
     auto fft_result = performFFT(frame);
-    auto demodulated_data = demodulateFFT(fft_result);
-
-    m_rxBuffer.insert(m_rxBuffer.end(), demodulated_data.begin(), demodulated_data.end());
+    m_rxBuffer.push_back(static_cast<float>(demodulateFFT(fft_result)));
 
     return true;
 }
@@ -336,39 +1499,47 @@ bool RiifUltrasonic::processFrame(const std::vector<float> &frame)
 std::vector<uint8_t> RiifUltrasonic::demodulateFrame(const std::vector<float> &frame)
 {
     std::vector<std::complex<float>> fftResult = performFFT(frame);
-    std::vector<uint8_t> demodulated = demodulateFFT(fftResult);
-    return demodulated;
+    return std::vector<uint8_t>(1, static_cast<uint8_t>(demodulateFFT(fftResult)));
 }
 
-std::vector<float> RiifUltrasonic::calculateAverageSpectrum()
+const std::vector<float>& RiifUltrasonic::calculateAverageSpectrum()
 {
-    std::vector<float> avg_spectrum(m_spectrum_history[0].size(), 0.0f);
-    for (const auto &spectrum : m_spectrum_history)
+    // O(bins): the ring keeps a running sum of its magnitudes
+    float scale = m_spectrum_count > 0 ? 1.0f / m_spectrum_count : 0.0f;
+    for (size_t i = 0; i < m_spectrum_sum.size(); ++i)
     {
-        for (size_t i = 0; i < spectrum.size(); ++i)
-        {
-            avg_spectrum[i] += std::abs(spectrum[i]);
-        }
+        m_avg_spectrum[i] = static_cast<float>(m_spectrum_sum[i]) * scale;
     }
-    for (auto &mag : avg_spectrum)
-    {
-        mag /= m_spectrum_history.size();
-    }
-    return avg_spectrum;
+    return m_avg_spectrum;
 }
 
-std::vector<float> RiifUltrasonic::normalizeSpectrum(const std::vector<float> &spectrum)
+const std::vector<float>& RiifUltrasonic::normalizeSpectrum(const std::vector<float> &spectrum)
 {
     float max_magnitude = *std::max_element(spectrum.begin(), spectrum.end());
-    std::vector<float> normalized_spectrum(spectrum.size());
+    m_normalized_spectrum.resize(spectrum.size());
     for (size_t i = 0; i < spectrum.size(); ++i)
     {
-        normalized_spectrum[i] = spectrum[i] / max_magnitude;
+        m_normalized_spectrum[i] = spectrum[i] / max_magnitude;
     }
-    return normalized_spectrum;
+    return m_normalized_spectrum;
 }
 
 const RiifUltrasonic::Parameters& RiifUltrasonic::getParameters() const
 {
-    return m_params;
+    return m_profile->params;
+}
+
+void RiifUltrasonic::enableDiagnostics(size_t frames)
+{
+    m_diagnostics.configure(frames);
+}
+
+DiagnosticSnapshot RiifUltrasonic::diagnostics() const
+{
+    return m_diagnostics.snapshot();
+}
+
+double RiifUltrasonic::getFrequencyOffset() const
+{
+    return m_frequency_offset;
 }
@@ -0,0 +1,14 @@
+#pragma once
+
+// Compile-time codec configuration for RiifUltrasonicT and EmbeddedReader; derive and
+// override what differs. The defaults match RiifUltrasonic::Parameters.
+struct StaticProfile {
+    static constexpr int sampleRate = 48000;
+    static constexpr int samplesPerFrame = 1024;
+    static constexpr double f0 = 15000.0;
+    static constexpr double df = 500.0;
+    static constexpr int rsMsgLength = 223;
+    static constexpr int rsEccLength = 32;
+    static constexpr int preambleDuration = 256;
+    static constexpr bool shortenCodewords = false;
+};
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Table generators that run at compile time, for codecs whose parameters are compile-time
+// constants: the results land in read-only data instead of being built by a constructor.
+// The trigonometry is evaluated in double precision and the tables are built with the same
+// expressions as their run-time counterparts, so they agree to the last bit or within one
+// unit of the stored type.
+namespace static_tables {
+
+constexpr double PI = 3.14159265358979323846;
+
+namespace detail {
+
+constexpr long roundToLong(double x)
+{
+    return x < 0 ? -static_cast<long>(-x + 0.5) : static_cast<long>(x + 0.5);
+}
+
+// Taylor series, accurate to a few ulp over [-pi/4, pi/4]
+constexpr double sineKernel(double x)
+{
+    double x2 = x * x, term = x, sum = x;
+    for (int n = 1; n < 12; ++n)
+    {
+        term *= -x2 / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double cosineKernel(double x)
+{
+    double x2 = x * x, term = 1.0, sum = 1.0;
+    for (int n = 1; n < 12; ++n)
+    {
+        term *= -x2 / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+} // namespace detail
+
+// sin and cos of |x| up to a few thousand radians; std::sin is not constexpr before C++26
+constexpr double sine(double x)
+{
+    // Reduce to a quarter turn around the nearest multiple of pi/2
+    long quadrant = detail::roundToLong(x / (PI / 2));
+    double r = x - quadrant * (PI / 2);
+    switch (((quadrant % 4) + 4) % 4)
+    {
+    case 0: return detail::sineKernel(r);
+    case 1: return detail::cosineKernel(r);
+    case 2: return -detail::sineKernel(r);
+    default: return -detail::cosineKernel(r);
+    }
+}
+
+constexpr double cosine(double x)
+{
+    return sine(x + PI / 2);
+}
+
+// std::fmod(x, 2 * PI) for x >= 0, and as exactly: every step takes off the largest
+// power-of-two multiple of 2 PI that fits, which the subtraction represents without rounding
+constexpr double wrapPhase(double x)
+{
+    const double turn = 2 * PI;
+    while (x >= turn)
+    {
+        double step = turn;
+        while (step * 2 <= x)
+        {
+            step *= 2;
+        }
+        x -= step;
+    }
+    return x;
+}
+
+constexpr bool isPowerOfTwo(size_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+constexpr int log2(size_t n)
+{
+    int bits = 0;
+    while (n > 1)
+    {
+        n >>= 1;
+        ++bits;
+    }
+    return bits;
+}
+
+// Raised-cosine (Hann) window over n samples, 0.5 * (1 - cos(2 pi i / n))
+template <size_t N>
+constexpr std::array<double, N> hannWindow()
+{
+    std::array<double, N> window = {};
+    for (size_t i = 0; i < N; ++i)
+    {
+        window[i] = 0.5 * (1 - cosine(2 * PI * i / N));
+    }
+    return window;
+}
+
+// Hann-windowed sine symbols of two tones, f0 and f0 + df, each rendered from Phases evenly
+// spaced start phases: [tone][phase][sample], full scale. RiifUltrasonic builds the same
+// templates at run time.
+template <size_t N, int Phases>
+constexpr std::array<int16_t, 2 * Phases * N> symbolTemplates(int sampleRate, double f0, double df)
+{
+    const std::array<double, N> window = hannWindow<N>();
+    std::array<int16_t, 2 * Phases * N> shapes = {};
+    for (int tone = 0; tone < 2; ++tone)
+    {
+        double w = 2 * PI * (f0 + tone * df) / sampleRate;
+        for (int p = 0; p < Phases; ++p)
+        {
+            double start = 2 * PI * p / Phases;
+            for (size_t i = 0; i < N; ++i)
+            {
+                shapes[(tone * Phases + p) * N + i] = static_cast<int16_t>(sine(start + w * i) * window[i] * 32767);
+            }
+        }
+    }
+    return shapes;
+}
+
+// Ooura rdft() of length N: the ip work area it needs and the cos/sin table it would build on
+// first use, twiddles first and the real-split table behind them (makewt and makect).
+// rdftForward() transforms over such a table without writing it; it still uses ip past its
+// two-entry header as scratch for the bit reversal on every call.
+constexpr size_t rdftWorkSize(size_t n)
+{
+    return 2 + (size_t(1) << (log2(n / 2) / 2));
+}
+
+template <size_t N>
+constexpr std::array<float, N / 2> rdftTable()
+{
+    static_assert(isPowerOfTwo(N) && N >= 16, "rdft lengths are powers of two");
+    std::array<float, N / 2> w = {};
+
+    // makewt(nw): cos/sin of the first octant, then bit-reversed in complex pairs
+    const int nw = N >> 2;
+    const int nwh = nw >> 1;
+    float delta = static_cast<float>(PI / 4 / nwh);
+    w[0] = 1;
+    w[1] = 0;
+    w[nwh] = static_cast<float>(cosine(delta * nwh));
+    w[nwh + 1] = w[nwh];
+    for (int j = 2; j < nwh; j += 2)
+    {
+        float x = static_cast<float>(cosine(delta * j));
+        float y = static_cast<float>(sine(delta * j));
+        w[j] = x;
+        w[j + 1] = y;
+        w[nw - j] = y;
+        w[nw - j + 1] = x;
+    }
+    const int pairs = nw / 2;
+    const int bits = log2(static_cast<size_t>(pairs));
+    for (int i = 0; i < pairs; ++i)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; ++b)
+        {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        if (i < r)
+        {
+            float re = w[2 * i], im = w[2 * i + 1];
+            w[2 * i] = w[2 * r];
+            w[2 * i + 1] = w[2 * r + 1];
+            w[2 * r] = re;
+            w[2 * r + 1] = im;
+        }
+    }
+
+    // makect(nc) at w + nw
+    const int nc = N >> 2;
+    const int nch = nc >> 1;
+    delta = static_cast<float>(PI / 4 / nch);
+    w[nw] = static_cast<float>(cosine(delta * nch));
+    w[nw + nch] = 0.5f * w[nw];
+    for (int j = 1; j < nch; ++j)
+    {
+        w[nw + j] = static_cast<float>(0.5 * cosine(delta * j));
+        w[nw + nc - j] = static_cast<float>(0.5 * sine(delta * j));
+    }
+    return w;
+}
+
+} // namespace static_tables
@@ -0,0 +1,106 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) : m_fn(nullptr), m_count(0), m_next(0), m_busy(0),
+    m_generation(0), m_stop(false), m_error(nullptr)
+{
+    m_threads.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i + 1);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& t : m_threads)
+    {
+        t.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& fn)
+{
+    std::lock_guard<std::mutex> job(m_jobMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fn = &fn;
+        m_count = count;
+        m_next = 0;
+        m_busy = m_threads.size();
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    runJob(0);
+
+    // Workers may still be inside fn, even after a throw, so always wait them out before
+    // fn goes out of scope
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busy == 0; });
+    m_fn = nullptr;
+    std::exception_ptr error = m_error;
+    m_error = nullptr;
+    lock.unlock();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::workerLoop(size_t worker)
+{
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+        if (m_stop)
+        {
+            return;
+        }
+        seen = m_generation;
+
+        lock.unlock();
+        runJob(worker);
+        lock.lock();
+
+        if (--m_busy == 0)
+        {
+            m_done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::runJob(size_t worker)
+{
+    size_t index;
+    while ((index = m_next.fetch_add(1)) < m_count)
+    {
+        try
+        {
+            (*m_fn)(worker, index);
+        }
+        catch (...)
+        {
+            // The first exception goes to the caller; the indices left are not handed out
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error)
+            {
+                m_error = std::current_exception();
+            }
+            m_next = m_count;
+        }
+    }
+}
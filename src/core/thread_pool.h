@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <exception>
+
+// Fixed set of worker threads for data-parallel loops. The calling thread joins in as
+// worker 0, so a pool with no threads of its own still runs everything inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Workers available to a loop, including the caller
+    size_t workerCount() const { return m_threads.size() + 1; }
+
+    // Run fn(worker, index) for every index in [0, count) and return when all are done.
+    // Indices are handed out dynamically; worker is in [0, workerCount()). If fn throws, the
+    // remaining indices are skipped and the first exception is rethrown here once every
+    // worker has left fn.
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)>& fn);
+
+    // Process-wide pool sized to the hardware
+    static ThreadPool& shared();
+
+private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_jobMutex;  // one loop at a time
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t, size_t)>* m_fn;
+    size_t m_count;
+    std::atomic<size_t> m_next;
+    size_t m_busy;
+    size_t m_generation;
+    bool m_stop;
+    std::exception_ptr m_error;  // first exception thrown by the current loop
+
+    void workerLoop(size_t worker);
+    void runJob(size_t worker);
+};
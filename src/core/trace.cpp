@@ -0,0 +1,175 @@
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace trace {
+
+namespace {
+
+struct Slot {
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> begin;
+    std::atomic<uint64_t> end;
+};
+
+// Single writer, any number of readers. The writer claims an index before overwriting its
+// slot and publishes it after, so a reader that copied a slot mid-write sees the claim and
+// drops it (the sequence lock pattern with one counter per ring).
+struct Ring {
+    explicit Ring(uint32_t id) : thread(id), claimed(0), published(0), cleared(0) {}
+
+    const uint32_t thread;
+    std::atomic<uint64_t> claimed;
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> cleared;  // events before this index were dropped by clear()
+    Slot slots[EVENTS_PER_THREAD];
+};
+
+// Rings outlive their threads so a dump after a worker exits still has its events; the
+// registry is never destroyed because threads may record during static destruction
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+};
+
+Registry& registry()
+{
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+Ring& threadRing()
+{
+    thread_local Ring* ring = nullptr;
+    if (ring == nullptr)
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.rings.emplace_back(new Ring(static_cast<uint32_t>(reg.rings.size() + 1)));
+        ring = reg.rings.back().get();
+    }
+    return *ring;
+}
+
+void appendEscaped(std::ostream& out, const char* text)
+{
+    for (; *text != '\0'; ++text)
+    {
+        if (*text == '"' || *text == '\\')
+        {
+            out << '\\';
+        }
+        out << *text;
+    }
+}
+
+} // namespace
+
+uint64_t now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void record(const char* name, uint64_t begin, uint64_t end)
+{
+    Ring& ring = threadRing();
+    uint64_t index = ring.published.load(std::memory_order_relaxed);
+    ring.claimed.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Slot& slot = ring.slots[index % EVENTS_PER_THREAD];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.begin.store(begin, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    ring.published.store(index + 1, std::memory_order_release);
+}
+
+std::vector<Event> collect()
+{
+    std::vector<Ring*> rings;
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto& ring : reg.rings)
+        {
+            rings.push_back(ring.get());
+        }
+    }
+
+    std::vector<Event> events;
+    std::vector<Event> copied;
+    for (Ring* ring : rings)
+    {
+        uint64_t last = ring->published.load(std::memory_order_acquire);
+        uint64_t first = last > EVENTS_PER_THREAD ? last - EVENTS_PER_THREAD : 0;
+        first = std::max(first, ring->cleared.load(std::memory_order_relaxed));
+        copied.clear();
+        for (uint64_t i = first; i < last; ++i)
+        {
+            const Slot& slot = ring->slots[i % EVENTS_PER_THREAD];
+            copied.push_back(Event{slot.name.load(std::memory_order_relaxed), slot.begin.load(std::memory_order_relaxed),
+                                   slot.end.load(std::memory_order_relaxed), ring->thread});
+        }
+
+        // Slots the writer claimed meanwhile may hold a mix of old and new event
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = ring->claimed.load(std::memory_order_relaxed);
+        uint64_t valid = claimed > EVENTS_PER_THREAD ? claimed - EVENTS_PER_THREAD : 0;
+        for (uint64_t i = std::max(first, valid); i < last; ++i)
+        {
+            events.push_back(copied[i - first]);
+        }
+    }
+    return events;
+}
+
+void writeChromeJson(std::ostream& out)
+{
+    // Complete ("X") events in microseconds from the earliest one, one process, a track per
+    // recording thread
+    std::vector<Event> events = collect();
+    uint64_t origin = UINT64_MAX;
+    for (const Event& e : events)
+    {
+        origin = std::min(origin, e.begin);
+    }
+
+    std::ostringstream body;
+    body.setf(std::ios::fixed);
+    body.precision(3);
+    body << "{\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const Event& e = events[i];
+        body << (i == 0 ? "\n" : ",\n") << "{\"name\":\"";
+        appendEscaped(body, e.name);
+        body << "\",\"cat\":\"riif\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+             << ",\"ts\":" << (e.begin - origin) / 1000.0 << ",\"dur\":" << (e.end - e.begin) / 1000.0 << "}";
+    }
+    body << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    out << body.str();
+}
+
+std::string chromeJson()
+{
+    std::ostringstream out;
+    writeChromeJson(out);
+    return out.str();
+}
+
+void clear()
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto& ring : reg.rings)
+    {
+        ring->cleared.store(ring->published.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+} // namespace trace
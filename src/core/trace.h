@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Scoped trace events for per-transaction timelines. Every thread records into its own ring
+// of the most recent events, so recording takes no lock and never allocates after the
+// thread's first event; writeChromeJson() collects all rings into the Chrome trace format,
+// which chrome://tracing and Perfetto open directly.
+//
+// The codec is instrumented with RIIF_TRACE_SCOPE, which compiles to nothing unless the
+// library is built with RIIF_ENABLE_TRACE. The functions below are always available, so a
+// caller can dump unconditionally and gets an empty trace from an uninstrumented build.
+namespace trace {
+
+struct Event {
+    const char* name;  // a string literal, recorded by pointer
+    uint64_t begin;    // nanoseconds on the steady clock
+    uint64_t end;
+    uint32_t thread;   // order in which threads first recorded, from 1
+};
+
+// Most recent events kept per thread
+static constexpr size_t EVENTS_PER_THREAD = 4096;
+
+uint64_t now();
+void record(const char* name, uint64_t begin, uint64_t end);
+
+// Snapshot of the events in every ring, oldest first per thread. Safe while other threads
+// are recording; events overwritten during the copy are left out.
+std::vector<Event> collect();
+void writeChromeJson(std::ostream& out);
+std::string chromeJson();
+
+// Drops the recorded events; rings stay allocated for their threads
+void clear();
+
+class Scope {
+public:
+    explicit Scope(const char* name) : m_name(name), m_begin(now()) {}
+    ~Scope() { record(m_name, m_begin, now()); }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    const char* m_name;
+    uint64_t m_begin;
+};
+
+} // namespace trace
+
+#define RIIF_TRACE_CONCAT_(a, b) a##b
+#define RIIF_TRACE_CONCAT(a, b) RIIF_TRACE_CONCAT_(a, b)
+
+#ifdef RIIF_ENABLE_TRACE
+#define RIIF_TRACE_SCOPE(name) ::trace::Scope RIIF_TRACE_CONCAT(riif_trace_scope_, __LINE__)(name)
+#else
+#define RIIF_TRACE_SCOPE(name) ((void)0)
+#endif
@@ -0,0 +1,5 @@
+#include "embedded_reader.h"
+
+// The default profile compiled into riif_ultrasonic_embedded, without exceptions, RTTI or the
+// heap, so its footprint can be checked on the host (see tests/check_embedded.cmake)
+template class EmbeddedReader<EmbeddedProfile>;
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include "../core/frame.h"
+#include "../core/onset.h"
+#include "../core/static_profile.h"
+#include "../core/static_tables.h"
+#include "../reed-solomon/rs.hpp"
+
+// Receive-only codec for embedded readers. Every buffer is a member sized from the profile at
+// compile time, so a reader can live in static storage and never touches the heap; nothing
+// here throws or pulls in iostreams. Build with RIIF_EMBEDDED to strip those from the codec
+// as well (see the riif_ultrasonic_embedded target).
+//
+// The signal path is cut down to fit: the two tones are measured per symbol with Goertzel
+// filters instead of the FFT front end, the symbol grid is found once at the start of the
+// transmission, and neither carrier offset nor sample clock drift is tracked. Frames are the
+// same as RiifUltrasonic's with matching Parameters.
+
+// Reader configuration, the same compile-time profile RiifUltrasonicT takes
+using EmbeddedProfile = StaticProfile;
+
+template <class Profile>
+class EmbeddedReader {
+public:
+    enum Status { LISTENING, RECEIVING, COMPLETE, FAILED };
+
+    static constexpr size_t SYMBOL = Profile::samplesPerFrame;
+    static constexpr size_t BLOCK = Profile::rsMsgLength;
+    static constexpr size_t CODEWORD = Profile::rsMsgLength + Profile::rsEccLength;
+    static constexpr size_t RS_WORK = RS::ReedSolomon::getWorkSize_bytes(Profile::rsMsgLength, Profile::rsEccLength);
+
+    EmbeddedReader()
+        : m_rs(Profile::rsMsgLength, Profile::rsEccLength, m_rsWork)
+    {
+        static_assert(CODEWORD < 256, "Reed-Solomon codewords are at most 255 bytes");
+        static_assert(SYMBOL % ONSET_BLOCK == 0 && SYMBOL % ALIGN_STEP == 0, "symbol length must divide into the search steps");
+        static_assert(Profile::f0 + Profile::df < Profile::sampleRate / 2.0, "tones above Nyquist");
+        reset();
+    }
+    EmbeddedReader(const EmbeddedReader&) = delete;
+    EmbeddedReader& operator=(const EmbeddedReader&) = delete;
+
+    // Back to listening for the next transmission
+    void reset()
+    {
+        m_status = LISTENING;
+        m_count = 0;
+        m_scan = 0;
+        m_noise = 0.0f;
+        m_onset = 0;
+        m_position = 0;
+        m_byte = 0;
+        m_bits = 0;
+        m_length = 0;
+        m_frame.begin(&m_rs, m_codeword, BLOCK, Profile::rsEccLength, Profile::shortenCodewords);
+    }
+
+    // Feed capture samples in blocks of any size. Returns COMPLETE once a frame has been
+    // corrected into message(), FAILED if it cannot be; samples after that are ignored until
+    // reset().
+    Status push(const int16_t* samples, size_t count)
+    {
+        while (count > 0 && (m_status == LISTENING || m_status == RECEIVING))
+        {
+            size_t n = BUFFER - m_count < count ? BUFFER - m_count : count;
+            std::memcpy(m_samples + m_count, samples, n * sizeof(int16_t));
+            m_count += n;
+            samples += n;
+            count -= n;
+            run();
+        }
+        return m_status;
+    }
+
+    Status status() const { return m_status; }
+    const uint8_t* message() const { return m_message; }
+    size_t messageLength() const { return m_length; }
+
+    // Worst-case RAM of a reader: its own buffers plus the deepest stack of a decode.
+    // tests/check_embedded.cmake checks STACK_BYTES against the deepest call chain from
+    // push() in the compiler's call graph (1760 bytes with GCC 12 -Os on x86-64); the rest
+    // is margin for the library calls, which have no frame in the graph.
+    static constexpr size_t STACK_BYTES = 2048;
+    static constexpr size_t ramBytes() { return sizeof(EmbeddedReader) + STACK_BYTES; }
+
+private:
+    static constexpr size_t ONSET_BLOCK = SYMBOL / 4;
+    static constexpr size_t ALIGN_STEP = SYMBOL / 16;
+    // History before the onset, the search span and the symbols scored for each candidate
+    static constexpr size_t BUFFER = (onset::ALIGN_SYMBOLS + 3) * SYMBOL;
+
+    // Goertzel coefficients of the two tones, 2 cos(w)
+    static constexpr float COEFF[2] = {
+        static_cast<float>(2 * static_tables::cosine(2 * static_tables::PI * Profile::f0 / Profile::sampleRate)),
+        static_cast<float>(2 * static_tables::cosine(2 * static_tables::PI * (Profile::f0 + Profile::df) / Profile::sampleRate))};
+
+    int16_t m_samples[BUFFER];
+    size_t m_count;       // samples buffered
+    size_t m_scan;        // next onset block while listening
+    size_t m_onset;       // onset block that started the search
+    size_t m_position;    // start of the next symbol while receiving
+    float m_noise;
+
+    uint8_t m_byte;
+    int m_bits;
+    uint8_t m_rsWork[RS_WORK];
+    RS::ReedSolomon m_rs;
+    uint8_t m_codeword[CODEWORD];
+    uint8_t m_message[BLOCK];
+    size_t m_length;
+    FrameAssembler m_frame;
+    Status m_status;
+
+    void run()
+    {
+        if (m_status == LISTENING)
+        {
+            listen();
+        }
+        if (m_status == RECEIVING)
+        {
+            receive();
+        }
+        // Keep the buffer from filling: drop what no stage will look at again, which is
+        // everything before the earliest candidate grid while aligning
+        const bool aligning = m_status == RECEIVING && m_position == SIZE_MAX;
+        size_t keep = m_position;
+        if (m_status == LISTENING)
+        {
+            keep = m_scan > SYMBOL ? m_scan - SYMBOL : 0;
+        }
+        else if (aligning)
+        {
+            keep = m_onset > SYMBOL ? m_onset - SYMBOL : 0;
+        }
+        if (m_count == BUFFER && keep > 0)
+        {
+            std::memmove(m_samples, m_samples + keep, (m_count - keep) * sizeof(int16_t));
+            m_count -= keep;
+            m_scan = m_scan > keep ? m_scan - keep : 0;
+            m_onset = m_onset > keep ? m_onset - keep : 0;
+            m_position = aligning ? m_position : m_position - keep;
+        }
+    }
+
+    void listen()
+    {
+        while (m_scan + ONSET_BLOCK <= m_count)
+        {
+            if (onset::heard(m_samples + m_scan, ONSET_BLOCK, COEFF, m_noise))
+            {
+                m_onset = m_scan;
+                m_status = RECEIVING;
+                m_position = SIZE_MAX;  // grid not found yet
+                return;
+            }
+            m_scan += ONSET_BLOCK;
+        }
+    }
+
+    void receive()
+    {
+        if (m_position == SIZE_MAX && !align())
+        {
+            return;
+        }
+        while (m_status == RECEIVING && m_position + SYMBOL <= m_count)
+        {
+            const int16_t* symbol = m_samples + m_position;
+            int bit = onset::toneLevel(symbol, SYMBOL, COEFF[1]) > onset::toneLevel(symbol, SYMBOL, COEFF[0]);
+            m_position += SYMBOL;
+            m_byte = static_cast<uint8_t>(m_byte << 1 | bit);
+            if (++m_bits < 8)
+            {
+                continue;
+            }
+            m_frame.push(m_byte);
+            m_bits = 0;
+            if (m_frame.done())
+            {
+                bool ok = m_frame.correct(m_message);
+                m_length = ok ? m_frame.messageLength() : 0;
+                m_status = ok ? COMPLETE : FAILED;
+            }
+        }
+    }
+
+    // An onset that no candidate grid bears out was a burst of noise, and listening resumes
+    // after it
+    bool align()
+    {
+        size_t first = m_onset > SYMBOL ? m_onset - SYMBOL : 0;
+        size_t last = m_onset + ONSET_BLOCK;
+        if (last + onset::ALIGN_SYMBOLS * SYMBOL > m_count)
+        {
+            return false;
+        }
+        if (!onset::findGrid(m_samples, first, last, ALIGN_STEP, SYMBOL, COEFF, m_position))
+        {
+            m_status = LISTENING;
+            m_scan = m_onset + ONSET_BLOCK;
+            m_position = 0;
+            return false;
+        }
+        return true;
+    }
+};
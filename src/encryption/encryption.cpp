@@ -0,0 +1,606 @@
+#include "encryption.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define RIIF_CHACHA_SSE2 1
+#if defined(__GNUC__) || defined(__clang__)
+#define RIIF_CHACHA_AVX2 1
+#endif
+#elif defined(__ARM_NEON) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define RIIF_CHACHA_NEON 1
+#endif
+
+namespace {
+
+const size_t CHACHA_BLOCK = 64;
+
+inline uint32_t load32(const uint8_t* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline void store32(uint8_t* p, uint32_t v)
+{
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+    p[2] = static_cast<uint8_t>(v >> 16);
+    p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+inline void store64(uint8_t* p, uint64_t v)
+{
+    store32(p, static_cast<uint32_t>(v));
+    store32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+inline uint32_t rotl(uint32_t v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+// ---- ChaCha20 -------------------------------------------------------------------------------
+
+void initState(uint32_t state[16], const uint8_t* key, uint32_t counter, const uint8_t* nonce)
+{
+    state[0] = 0x61707865;  // "expand 32-byte k"
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; ++i)
+    {
+        state[4 + i] = load32(key + 4 * i);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; ++i)
+    {
+        state[13 + i] = load32(nonce + 4 * i);
+    }
+}
+
+#define CHACHA_QR(a, b, c, d) \
+    a += b; d ^= a; d = rotl(d, 16); \
+    c += d; b ^= c; b = rotl(b, 12); \
+    a += b; d ^= a; d = rotl(d, 8); \
+    c += d; b ^= c; b = rotl(b, 7);
+
+void chachaBlock(const uint32_t state[16], uint8_t out[CHACHA_BLOCK])
+{
+    uint32_t x[16];
+    std::memcpy(x, state, sizeof(x));
+    for (int round = 0; round < 10; ++round)
+    {
+        CHACHA_QR(x[0], x[4], x[8], x[12])
+        CHACHA_QR(x[1], x[5], x[9], x[13])
+        CHACHA_QR(x[2], x[6], x[10], x[14])
+        CHACHA_QR(x[3], x[7], x[11], x[15])
+        CHACHA_QR(x[0], x[5], x[10], x[15])
+        CHACHA_QR(x[1], x[6], x[11], x[12])
+        CHACHA_QR(x[2], x[7], x[8], x[13])
+        CHACHA_QR(x[3], x[4], x[9], x[14])
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        store32(out + 4 * i, x[i] + state[i]);
+    }
+    secureWipe(x, sizeof(x));
+}
+
+// One block at a time; handles any length, including the tail the wide kernels leave
+void chachaScalar(uint32_t state[16], const uint8_t* in, uint8_t* out, size_t length)
+{
+    uint8_t block[CHACHA_BLOCK];
+    while (length > 0)
+    {
+        chachaBlock(state, block);
+        size_t n = std::min(length, CHACHA_BLOCK);
+        for (size_t i = 0; i < n; ++i)
+        {
+            out[i] = in[i] ^ block[i];
+        }
+        ++state[12];
+        in += n;
+        out += n;
+        length -= n;
+    }
+    secureWipe(block, sizeof(block));
+}
+
+// The wide kernels run one block per vector lane ("vertical" layout: vector i holds word i
+// of every block), then transpose groups of four words back into block order for the XOR.
+// Each returns the number of bytes it processed, always whole multiples of its width.
+typedef size_t (*ChaChaKernel)(uint32_t* state, const uint8_t* in, uint8_t* out, size_t length);
+
+#if RIIF_CHACHA_SSE2
+
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define CHACHA_QR128(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 16); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 12); \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 8); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 7);
+
+size_t chachaSse2(uint32_t* state, const uint8_t* in, uint8_t* out, size_t length)
+{
+    const size_t width = 4 * CHACHA_BLOCK;
+    const __m128i lanes = _mm_set_epi32(3, 2, 1, 0);
+    size_t done = 0;
+    for (; length - done >= width; done += width, state[12] += 4)
+    {
+        __m128i s[16], x[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            s[i] = _mm_set1_epi32(static_cast<int>(state[i]));
+        }
+        s[12] = _mm_add_epi32(s[12], lanes);
+        for (int i = 0; i < 16; ++i)
+        {
+            x[i] = s[i];
+        }
+
+        for (int round = 0; round < 10; ++round)
+        {
+            CHACHA_QR128(x[0], x[4], x[8], x[12])
+            CHACHA_QR128(x[1], x[5], x[9], x[13])
+            CHACHA_QR128(x[2], x[6], x[10], x[14])
+            CHACHA_QR128(x[3], x[7], x[11], x[15])
+            CHACHA_QR128(x[0], x[5], x[10], x[15])
+            CHACHA_QR128(x[1], x[6], x[11], x[12])
+            CHACHA_QR128(x[2], x[7], x[8], x[13])
+            CHACHA_QR128(x[3], x[4], x[9], x[14])
+        }
+
+        for (int g = 0; g < 4; ++g)
+        {
+            __m128i a = _mm_add_epi32(x[4 * g], s[4 * g]);
+            __m128i b = _mm_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+            __m128i c = _mm_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+            __m128i d = _mm_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+            __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+            __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+            __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+            __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+            __m128i blocks[4] = {_mm_unpacklo_epi64(ab_lo, cd_lo), _mm_unpackhi_epi64(ab_lo, cd_lo),
+                                 _mm_unpacklo_epi64(ab_hi, cd_hi), _mm_unpackhi_epi64(ab_hi, cd_hi)};
+            for (int k = 0; k < 4; ++k)
+            {
+                size_t offset = done + k * CHACHA_BLOCK + 16 * g;
+                __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + offset));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + offset), _mm_xor_si128(data, blocks[k]));
+            }
+        }
+    }
+    return done;
+}
+
+#endif
+
+#if RIIF_CHACHA_AVX2
+
+#define ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define CHACHA_QR256(a, b, c, d) \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 12); \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = ROTL256(b, 7);
+
+__attribute__((target("avx2")))
+size_t chachaAvx2(uint32_t* state, const uint8_t* in, uint8_t* out, size_t length)
+{
+    const size_t width = 8 * CHACHA_BLOCK;
+    const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    // Rotations by whole bytes are a byte shuffle
+    const __m256i rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                          13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+                                         14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+    size_t done = 0;
+    for (; length - done >= width; done += width, state[12] += 8)
+    {
+        __m256i s[16], x[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            s[i] = _mm256_set1_epi32(static_cast<int>(state[i]));
+        }
+        s[12] = _mm256_add_epi32(s[12], lanes);
+        for (int i = 0; i < 16; ++i)
+        {
+            x[i] = s[i];
+        }
+
+        for (int round = 0; round < 10; ++round)
+        {
+            CHACHA_QR256(x[0], x[4], x[8], x[12])
+            CHACHA_QR256(x[1], x[5], x[9], x[13])
+            CHACHA_QR256(x[2], x[6], x[10], x[14])
+            CHACHA_QR256(x[3], x[7], x[11], x[15])
+            CHACHA_QR256(x[0], x[5], x[10], x[15])
+            CHACHA_QR256(x[1], x[6], x[11], x[12])
+            CHACHA_QR256(x[2], x[7], x[8], x[13])
+            CHACHA_QR256(x[3], x[4], x[9], x[14])
+        }
+
+        // Transposing within 128-bit lanes leaves block k in the low half and block k + 4 in
+        // the high half; pairs of word groups are then joined across the halves
+        __m256i t[4][4];
+        for (int g = 0; g < 4; ++g)
+        {
+            __m256i a = _mm256_add_epi32(x[4 * g], s[4 * g]);
+            __m256i b = _mm256_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+            __m256i c = _mm256_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+            __m256i d = _mm256_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+            __m256i ab_lo = _mm256_unpacklo_epi32(a, b);
+            __m256i cd_lo = _mm256_unpacklo_epi32(c, d);
+            __m256i ab_hi = _mm256_unpackhi_epi32(a, b);
+            __m256i cd_hi = _mm256_unpackhi_epi32(c, d);
+            t[g][0] = _mm256_unpacklo_epi64(ab_lo, cd_lo);
+            t[g][1] = _mm256_unpackhi_epi64(ab_lo, cd_lo);
+            t[g][2] = _mm256_unpacklo_epi64(ab_hi, cd_hi);
+            t[g][3] = _mm256_unpackhi_epi64(ab_hi, cd_hi);
+        }
+        for (int k = 0; k < 4; ++k)
+        {
+            for (int half = 0; half < 2; ++half)
+            {
+                __m256i low = _mm256_permute2x128_si256(t[2 * half][k], t[2 * half + 1][k], 0x20);
+                __m256i high = _mm256_permute2x128_si256(t[2 * half][k], t[2 * half + 1][k], 0x31);
+                size_t first = done + k * CHACHA_BLOCK + 32 * half;
+                size_t second = first + 4 * CHACHA_BLOCK;
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + first));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + second));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + first), _mm256_xor_si256(a, low));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + second), _mm256_xor_si256(b, high));
+            }
+        }
+    }
+    _mm256_zeroupper();
+    return done + chachaSse2(state, in + done, out + done, length - done);
+}
+
+#endif
+
+#if RIIF_CHACHA_NEON
+
+#define ROTLN(v, n) vorrq_u32(vshlq_n_u32(v, n), vshrq_n_u32(v, 32 - (n)))
+#define CHACHA_QRN(a, b, c, d) \
+    a = vaddq_u32(a, b); d = veorq_u32(d, a); d = ROTLN(d, 16); \
+    c = vaddq_u32(c, d); b = veorq_u32(b, c); b = ROTLN(b, 12); \
+    a = vaddq_u32(a, b); d = veorq_u32(d, a); d = ROTLN(d, 8); \
+    c = vaddq_u32(c, d); b = veorq_u32(b, c); b = ROTLN(b, 7);
+
+size_t chachaNeon(uint32_t* state, const uint8_t* in, uint8_t* out, size_t length)
+{
+    const size_t width = 4 * CHACHA_BLOCK;
+    const uint32_t lane_values[4] = {0, 1, 2, 3};
+    const uint32x4_t lanes = vld1q_u32(lane_values);
+    size_t done = 0;
+    for (; length - done >= width; done += width, state[12] += 4)
+    {
+        uint32x4_t s[16], x[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            s[i] = vdupq_n_u32(state[i]);
+        }
+        s[12] = vaddq_u32(s[12], lanes);
+        for (int i = 0; i < 16; ++i)
+        {
+            x[i] = s[i];
+        }
+
+        for (int round = 0; round < 10; ++round)
+        {
+            CHACHA_QRN(x[0], x[4], x[8], x[12])
+            CHACHA_QRN(x[1], x[5], x[9], x[13])
+            CHACHA_QRN(x[2], x[6], x[10], x[14])
+            CHACHA_QRN(x[3], x[7], x[11], x[15])
+            CHACHA_QRN(x[0], x[5], x[10], x[15])
+            CHACHA_QRN(x[1], x[6], x[11], x[12])
+            CHACHA_QRN(x[2], x[7], x[8], x[13])
+            CHACHA_QRN(x[3], x[4], x[9], x[14])
+        }
+
+        for (int g = 0; g < 4; ++g)
+        {
+            uint32x4x2_t ab = vtrnq_u32(vaddq_u32(x[4 * g], s[4 * g]), vaddq_u32(x[4 * g + 1], s[4 * g + 1]));
+            uint32x4x2_t cd = vtrnq_u32(vaddq_u32(x[4 * g + 2], s[4 * g + 2]), vaddq_u32(x[4 * g + 3], s[4 * g + 3]));
+            uint32x4_t blocks[4] = {vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0])),
+                                    vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1])),
+                                    vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0])),
+                                    vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1]))};
+            for (int k = 0; k < 4; ++k)
+            {
+                size_t offset = done + k * CHACHA_BLOCK + 16 * g;
+                vst1q_u8(out + offset, veorq_u8(vld1q_u8(in + offset), vreinterpretq_u8_u32(blocks[k])));
+            }
+        }
+    }
+    return done;
+}
+
+#endif
+
+struct ChaChaImplementation {
+    ChaChaKernel kernel;  // nullptr: scalar only
+    const char* name;
+};
+
+ChaChaImplementation detectImplementation()
+{
+#if RIIF_CHACHA_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return ChaChaImplementation{chachaAvx2, "avx2"};
+    }
+#endif
+#if RIIF_CHACHA_SSE2
+    return ChaChaImplementation{chachaSse2, "sse2"};
+#elif RIIF_CHACHA_NEON
+    return ChaChaImplementation{chachaNeon, "neon"};
+#else
+    return ChaChaImplementation{nullptr, "scalar"};
+#endif
+}
+
+const ChaChaImplementation& chachaImplementation()
+{
+    static const ChaChaImplementation implementation = detectImplementation();
+    return implementation;
+}
+
+void chachaXor(uint32_t state[16], const uint8_t* in, uint8_t* out, size_t length)
+{
+    const ChaChaImplementation& impl = chachaImplementation();
+    size_t done = impl.kernel != nullptr ? impl.kernel(state, in, out, length) : 0;
+    chachaScalar(state, in + done, out + done, length - done);
+}
+
+// ---- Poly1305 -------------------------------------------------------------------------------
+
+// Radix 2^26 so every product fits in 64 bits on any target
+struct Poly1305 {
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+    uint8_t buffer[16];
+    size_t buffered;
+};
+
+void polyInit(Poly1305& st, const uint8_t* key)
+{
+    st.r[0] = load32(key + 0) & 0x3ffffff;
+    st.r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    st.r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    st.r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    st.r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 5; ++i)
+    {
+        st.h[i] = 0;
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        st.pad[i] = load32(key + 16 + 4 * i);
+    }
+    st.buffered = 0;
+}
+
+void polyBlocks(Poly1305& st, const uint8_t* m, size_t bytes, uint32_t hibit)
+{
+    const uint32_t mask = 0x3ffffff;
+    const uint64_t r0 = st.r[0], r1 = st.r[1], r2 = st.r[2], r3 = st.r[3], r4 = st.r[4];
+    const uint64_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = st.h[0], h1 = st.h[1], h2 = st.h[2], h3 = st.h[3], h4 = st.h[4];
+
+    for (; bytes >= 16; m += 16, bytes -= 16)
+    {
+        h0 += load32(m + 0) & mask;
+        h1 += (load32(m + 3) >> 2) & mask;
+        h2 += (load32(m + 6) >> 4) & mask;
+        h3 += (load32(m + 9) >> 6) & mask;
+        h4 += (load32(m + 12) >> 8) | hibit;
+
+        uint64_t d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+        uint64_t d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + h4 * s2;
+        uint64_t d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + h4 * s3;
+        uint64_t d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + h4 * s4;
+        uint64_t d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + h4 * r0;
+
+        uint32_t c = static_cast<uint32_t>(d0 >> 26);
+        h0 = static_cast<uint32_t>(d0) & mask;
+        d1 += c; c = static_cast<uint32_t>(d1 >> 26); h1 = static_cast<uint32_t>(d1) & mask;
+        d2 += c; c = static_cast<uint32_t>(d2 >> 26); h2 = static_cast<uint32_t>(d2) & mask;
+        d3 += c; c = static_cast<uint32_t>(d3 >> 26); h3 = static_cast<uint32_t>(d3) & mask;
+        d4 += c; c = static_cast<uint32_t>(d4 >> 26); h4 = static_cast<uint32_t>(d4) & mask;
+        h0 += c * 5; c = h0 >> 26; h0 &= mask;
+        h1 += c;
+    }
+
+    st.h[0] = h0; st.h[1] = h1; st.h[2] = h2; st.h[3] = h3; st.h[4] = h4;
+}
+
+void polyUpdate(Poly1305& st, const uint8_t* m, size_t bytes)
+{
+    const uint32_t hibit = 1u << 24;  // the 2^128 bit of every full block
+    if (bytes == 0)
+    {
+        return;
+    }
+    if (st.buffered > 0)
+    {
+        size_t n = std::min(16 - st.buffered, bytes);
+        std::memcpy(st.buffer + st.buffered, m, n);
+        st.buffered += n;
+        m += n;
+        bytes -= n;
+        if (st.buffered < 16)
+        {
+            return;
+        }
+        polyBlocks(st, st.buffer, 16, hibit);
+        st.buffered = 0;
+    }
+    size_t whole = bytes & ~size_t(15);
+    polyBlocks(st, m, whole, hibit);
+    std::memcpy(st.buffer, m + whole, bytes - whole);
+    st.buffered = bytes - whole;
+}
+
+// Zero padding up to the next 16-byte boundary, as the AEAD construction requires
+void polyPad(Poly1305& st)
+{
+    static const uint8_t zeros[16] = {};
+    if (st.buffered > 0)
+    {
+        polyUpdate(st, zeros, 16 - st.buffered);
+    }
+}
+
+void polyFinish(Poly1305& st, uint8_t* tag)
+{
+    const uint32_t mask = 0x3ffffff;
+    if (st.buffered > 0)
+    {
+        // A short final block carries its 1 bit right after the message instead of at 2^128
+        st.buffer[st.buffered] = 1;
+        std::fill(st.buffer + st.buffered + 1, st.buffer + 16, uint8_t(0));
+        polyBlocks(st, st.buffer, 16, 0);
+    }
+
+    uint32_t h0 = st.h[0], h1 = st.h[1], h2 = st.h[2], h3 = st.h[3], h4 = st.h[4];
+    uint32_t c = h1 >> 26; h1 &= mask;
+    h2 += c; c = h2 >> 26; h2 &= mask;
+    h3 += c; c = h3 >> 26; h3 &= mask;
+    h4 += c; c = h4 >> 26; h4 &= mask;
+    h0 += c * 5; c = h0 >> 26; h0 &= mask;
+    h1 += c;
+
+    // h - p, selected without a branch when h >= p
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= mask;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= mask;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= mask;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= mask;
+    uint32_t g4 = h4 + c - (1u << 26);
+    uint32_t select = (g4 >> 31) - 1;
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+    h3 = (h3 & ~select) | (g3 & select);
+    h4 = (h4 & ~select) | (g4 & select);
+
+    // Back to 4 x 32 bits, then add the pad mod 2^128
+    uint32_t w0 = h0 | (h1 << 26);
+    uint32_t w1 = (h1 >> 6) | (h2 << 20);
+    uint32_t w2 = (h2 >> 12) | (h3 << 14);
+    uint32_t w3 = (h3 >> 18) | (h4 << 8);
+    uint64_t f = static_cast<uint64_t>(w0) + st.pad[0];
+    store32(tag, static_cast<uint32_t>(f));
+    f = static_cast<uint64_t>(w1) + st.pad[1] + (f >> 32);
+    store32(tag + 4, static_cast<uint32_t>(f));
+    f = static_cast<uint64_t>(w2) + st.pad[2] + (f >> 32);
+    store32(tag + 8, static_cast<uint32_t>(f));
+    f = static_cast<uint64_t>(w3) + st.pad[3] + (f >> 32);
+    store32(tag + 12, static_cast<uint32_t>(f));
+
+    secureWipe(&st, sizeof(st));
+}
+
+} // namespace
+
+ChaCha20Poly1305::ChaCha20Poly1305(const uint8_t* key)
+{
+    std::memcpy(m_key, key, KEY_SIZE);
+}
+
+ChaCha20Poly1305::~ChaCha20Poly1305()
+{
+    secureWipe(m_key, sizeof(m_key));
+}
+
+void ChaCha20Poly1305::macCiphertext(const uint8_t* nonce, const uint8_t* aad, size_t aadLength,
+                                     const uint8_t* ciphertext, size_t length, uint8_t* tag) const
+{
+    // The one-time Poly1305 key is the first half of keystream block 0
+    uint32_t state[16];
+    uint8_t block[CHACHA_BLOCK];
+    initState(state, m_key, 0, nonce);
+    chachaBlock(state, block);
+
+    Poly1305 mac;
+    polyInit(mac, block);
+    polyUpdate(mac, aad, aadLength);
+    polyPad(mac);
+    polyUpdate(mac, ciphertext, length);
+    polyPad(mac);
+    uint8_t lengths[16];
+    store64(lengths, aadLength);
+    store64(lengths + 8, length);
+    polyUpdate(mac, lengths, sizeof(lengths));
+    polyFinish(mac, tag);
+
+    secureWipe(state, sizeof(state));
+    secureWipe(block, sizeof(block));
+}
+
+void ChaCha20Poly1305::seal(const uint8_t* nonce, const uint8_t* aad, size_t aadLength,
+                            const uint8_t* in, uint8_t* out, size_t length, uint8_t* tag) const
+{
+    chacha20(m_key, 1, nonce, in, out, length);
+    macCiphertext(nonce, aad, aadLength, out, length, tag);
+}
+
+bool ChaCha20Poly1305::open(const uint8_t* nonce, const uint8_t* aad, size_t aadLength,
+                            const uint8_t* in, uint8_t* out, size_t length, const uint8_t* tag) const
+{
+    uint8_t expected[TAG_SIZE];
+    macCiphertext(nonce, aad, aadLength, in, length, expected);
+    bool valid = constantTimeEqual(expected, tag, TAG_SIZE);
+    if (valid)
+    {
+        chacha20(m_key, 1, nonce, in, out, length);
+    }
+    return valid;
+}
+
+void ChaCha20Poly1305::chacha20(const uint8_t* key, uint32_t counter, const uint8_t* nonce,
+                                const uint8_t* in, uint8_t* out, size_t length)
+{
+    uint32_t state[16];
+    initState(state, key, counter, nonce);
+    chachaXor(state, in, out, length);
+    secureWipe(state, sizeof(state));
+}
+
+void ChaCha20Poly1305::poly1305(const uint8_t* key, const uint8_t* message, size_t length, uint8_t* tag)
+{
+    Poly1305 mac;
+    polyInit(mac, key);
+    polyUpdate(mac, message, length);
+    polyFinish(mac, tag);
+}
+
+const char* ChaCha20Poly1305::implementation()
+{
+    return chachaImplementation().name;
+}
+
+bool constantTimeEqual(const uint8_t* a, const uint8_t* b, size_t length)
+{
+    uint8_t diff = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+void secureWipe(void* data, size_t length)
+{
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i)
+    {
+        p[i] = 0;
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// ChaCha20-Poly1305 authenticated encryption (RFC 8439). Payloads are processed in one pass
+// from input to output, which may be the same buffer, so a message can be sealed straight
+// into the codec's message block and opened straight out of it. The keystream is generated
+// several blocks at a time with SSE2/AVX2 or NEON where the CPU has them.
+class ChaCha20Poly1305 {
+public:
+    static constexpr size_t KEY_SIZE = 32;
+    static constexpr size_t NONCE_SIZE = 12;
+    static constexpr size_t TAG_SIZE = 16;
+
+    explicit ChaCha20Poly1305(const uint8_t* key);
+    ~ChaCha20Poly1305();  // wipes the key
+    ChaCha20Poly1305(const ChaCha20Poly1305&) = delete;
+    ChaCha20Poly1305& operator=(const ChaCha20Poly1305&) = delete;
+
+    // Encrypt length bytes from in to out and write the tag. A nonce must never be reused
+    // with the same key.
+    void seal(const uint8_t* nonce, const uint8_t* aad, size_t aadLength,
+              const uint8_t* in, uint8_t* out, size_t length, uint8_t* tag) const;
+
+    // Check the tag in constant time, then decrypt. On a mismatch out is left untouched and
+    // false is returned.
+    bool open(const uint8_t* nonce, const uint8_t* aad, size_t aadLength,
+              const uint8_t* in, uint8_t* out, size_t length, const uint8_t* tag) const;
+
+    // The underlying primitives
+    static void chacha20(const uint8_t* key, uint32_t counter, const uint8_t* nonce,
+                         const uint8_t* in, uint8_t* out, size_t length);
+    static void poly1305(const uint8_t* key, const uint8_t* message, size_t length, uint8_t* tag);
+
+    // Name of the ChaCha20 code path picked for this CPU ("avx2", "sse2", "neon" or "scalar")
+    static const char* implementation();
+
+private:
+    uint8_t m_key[KEY_SIZE];
+
+    void macCiphertext(const uint8_t* nonce, const uint8_t* aad, size_t aadLength,
+                       const uint8_t* ciphertext, size_t length, uint8_t* tag) const;
+};
+
+// Constant-time comparison, for tags and other secrets
+bool constantTimeEqual(const uint8_t* a, const uint8_t* b, size_t length);
+
+// Overwrite a secret so the store is not optimized away
+void secureWipe(void* data, size_t length);
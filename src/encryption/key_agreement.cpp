@@ -0,0 +1,735 @@
+#include "key_agreement.h"
+#include "encryption.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SIZEOF_INT128__)
+#define RIIF_X25519_RADIX51 1
+#endif
+
+namespace {
+
+inline uint32_t loadBE32(const uint8_t* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+inline void storeBE32(uint8_t* p, uint32_t v)
+{
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
+
+inline uint32_t rotr(uint32_t v, int n)
+{
+    return (v >> n) | (v << (32 - n));
+}
+
+const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+// ---- Field arithmetic mod 2^255 - 19 ----------------------------------------------------------
+
+#if RIIF_X25519_RADIX51
+
+// Five 51-bit limbs. Sums of up to a few reduced elements stay well inside the 64-bit limbs
+// and every product inside 128 bits, so carries are only propagated after multiplications.
+typedef uint64_t Fe[5];
+typedef unsigned __int128 u128;
+const uint64_t MASK51 = (uint64_t(1) << 51) - 1;
+
+inline uint64_t load64(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+inline void store64(uint8_t* p, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+void feFromBytes(Fe h, const uint8_t* s)
+{
+    h[0] = load64(s) & MASK51;
+    h[1] = (load64(s + 6) >> 3) & MASK51;
+    h[2] = (load64(s + 12) >> 6) & MASK51;
+    h[3] = (load64(s + 19) >> 1) & MASK51;
+    h[4] = (load64(s + 24) >> 12) & MASK51;  // bit 255 is ignored
+}
+
+void feToBytes(uint8_t* s, const Fe h)
+{
+    uint64_t t[5] = {h[0], h[1], h[2], h[3], h[4]};
+
+    // Two carry passes leave t below 2^255; adding 19 then shows whether t >= p
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        t[1] += t[0] >> 51; t[0] &= MASK51;
+        t[2] += t[1] >> 51; t[1] &= MASK51;
+        t[3] += t[2] >> 51; t[2] &= MASK51;
+        t[4] += t[3] >> 51; t[3] &= MASK51;
+        t[0] += 19 * (t[4] >> 51); t[4] &= MASK51;
+    }
+    t[0] += 19;
+    t[1] += t[0] >> 51; t[0] &= MASK51;
+    t[2] += t[1] >> 51; t[1] &= MASK51;
+    t[3] += t[2] >> 51; t[2] &= MASK51;
+    t[4] += t[3] >> 51; t[3] &= MASK51;
+    t[0] += 19 * (t[4] >> 51); t[4] &= MASK51;
+
+    // Now t + 19 - p is in [2^255, 2^256 - 20) offset by 2^255; subtract that offset back out
+    t[0] += (uint64_t(1) << 51) - 19;
+    t[1] += (uint64_t(1) << 51) - 1;
+    t[2] += (uint64_t(1) << 51) - 1;
+    t[3] += (uint64_t(1) << 51) - 1;
+    t[4] += (uint64_t(1) << 51) - 1;
+    t[1] += t[0] >> 51; t[0] &= MASK51;
+    t[2] += t[1] >> 51; t[1] &= MASK51;
+    t[3] += t[2] >> 51; t[2] &= MASK51;
+    t[4] += t[3] >> 51; t[3] &= MASK51;
+    t[4] &= MASK51;
+
+    store64(s, t[0] | (t[1] << 51));
+    store64(s + 8, (t[1] >> 13) | (t[2] << 38));
+    store64(s + 16, (t[2] >> 26) | (t[3] << 25));
+    store64(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+inline void feCopy(Fe out, const Fe a)
+{
+    for (int i = 0; i < 5; ++i)
+    {
+        out[i] = a[i];
+    }
+}
+
+inline void feSet(Fe out, uint64_t value)
+{
+    out[0] = value;
+    out[1] = out[2] = out[3] = out[4] = 0;
+}
+
+inline void feAdd(Fe out, const Fe a, const Fe b)
+{
+    for (int i = 0; i < 5; ++i)
+    {
+        out[i] = a[i] + b[i];
+    }
+}
+
+// a - b + 2p keeps every limb positive for reduced b
+inline void feSub(Fe out, const Fe a, const Fe b)
+{
+    out[0] = a[0] + 0xfffffffffffda - b[0];
+    out[1] = a[1] + 0xffffffffffffe - b[1];
+    out[2] = a[2] + 0xffffffffffffe - b[2];
+    out[3] = a[3] + 0xffffffffffffe - b[3];
+    out[4] = a[4] + 0xffffffffffffe - b[4];
+}
+
+inline void feCarry(Fe out, u128 t0, u128 t1, u128 t2, u128 t3, u128 t4)
+{
+    uint64_t c;
+    uint64_t r0 = static_cast<uint64_t>(t0) & MASK51; c = static_cast<uint64_t>(t0 >> 51);
+    t1 += c; uint64_t r1 = static_cast<uint64_t>(t1) & MASK51; c = static_cast<uint64_t>(t1 >> 51);
+    t2 += c; uint64_t r2 = static_cast<uint64_t>(t2) & MASK51; c = static_cast<uint64_t>(t2 >> 51);
+    t3 += c; uint64_t r3 = static_cast<uint64_t>(t3) & MASK51; c = static_cast<uint64_t>(t3 >> 51);
+    t4 += c; uint64_t r4 = static_cast<uint64_t>(t4) & MASK51; c = static_cast<uint64_t>(t4 >> 51);
+    r0 += c * 19; c = r0 >> 51; r0 &= MASK51;
+    r1 += c;
+    out[0] = r0; out[1] = r1; out[2] = r2; out[3] = r3; out[4] = r4;
+}
+
+void feMul(Fe out, const Fe a, const Fe b)
+{
+    const uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+    const uint64_t b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3], b4 = b[4];
+    // Limb products past 2^255 wrap around multiplied by 19
+    const uint64_t b1_19 = 19 * b1, b2_19 = 19 * b2, b3_19 = 19 * b3, b4_19 = 19 * b4;
+
+    u128 t0 = (u128)a0 * b0 + (u128)a1 * b4_19 + (u128)a2 * b3_19 + (u128)a3 * b2_19 + (u128)a4 * b1_19;
+    u128 t1 = (u128)a0 * b1 + (u128)a1 * b0 + (u128)a2 * b4_19 + (u128)a3 * b3_19 + (u128)a4 * b2_19;
+    u128 t2 = (u128)a0 * b2 + (u128)a1 * b1 + (u128)a2 * b0 + (u128)a3 * b4_19 + (u128)a4 * b3_19;
+    u128 t3 = (u128)a0 * b3 + (u128)a1 * b2 + (u128)a2 * b1 + (u128)a3 * b0 + (u128)a4 * b4_19;
+    u128 t4 = (u128)a0 * b4 + (u128)a1 * b3 + (u128)a2 * b2 + (u128)a3 * b1 + (u128)a4 * b0;
+    feCarry(out, t0, t1, t2, t3, t4);
+}
+
+void feSquare(Fe out, const Fe a)
+{
+    const uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+    const uint64_t d0 = 2 * a0, d1 = 2 * a1;
+    const uint64_t a3_19 = 19 * a3, a4_19 = 19 * a4;
+    const uint64_t d2_19 = 2 * 19 * a2, d4_19 = 2 * a4_19;
+
+    u128 t0 = (u128)a0 * a0 + (u128)d4_19 * a1 + (u128)d2_19 * a3;
+    u128 t1 = (u128)d0 * a1 + (u128)d4_19 * a2 + (u128)a3_19 * a3;
+    u128 t2 = (u128)d0 * a2 + (u128)a1 * a1 + (u128)d4_19 * a3;
+    u128 t3 = (u128)d0 * a3 + (u128)d1 * a2 + (u128)a4_19 * a4;
+    u128 t4 = (u128)d0 * a4 + (u128)d1 * a3 + (u128)a2 * a2;
+    feCarry(out, t0, t1, t2, t3, t4);
+}
+
+void feMulSmall(Fe out, const Fe a, uint64_t k)
+{
+    feCarry(out, (u128)a[0] * k, (u128)a[1] * k, (u128)a[2] * k, (u128)a[3] * k, (u128)a[4] * k);
+}
+
+inline void feSwap(Fe a, Fe b, uint64_t swap)
+{
+    const uint64_t mask = 0 - swap;
+    for (int i = 0; i < 5; ++i)
+    {
+        uint64_t x = mask & (a[i] ^ b[i]);
+        a[i] ^= x;
+        b[i] ^= x;
+    }
+}
+
+#else
+
+// Sixteen 16-bit limbs in signed 64-bit words, for targets without 128-bit products
+typedef int64_t Fe[16];
+
+void feCarryFull(Fe o)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        o[i] += int64_t(1) << 16;
+        int64_t c = o[i] >> 16;
+        if (i < 15)
+        {
+            o[i + 1] += c - 1;
+        }
+        else
+        {
+            o[0] += 38 * (c - 1);
+        }
+        o[i] -= c * (int64_t(1) << 16);
+    }
+}
+
+void feFromBytes(Fe o, const uint8_t* s)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        o[i] = s[2 * i] + (static_cast<int64_t>(s[2 * i + 1]) << 8);
+    }
+    o[15] &= 0x7fff;
+}
+
+inline void feSwap(Fe a, Fe b, uint64_t swap)
+{
+    const int64_t mask = ~(static_cast<int64_t>(swap) - 1);
+    for (int i = 0; i < 16; ++i)
+    {
+        int64_t x = mask & (a[i] ^ b[i]);
+        a[i] ^= x;
+        b[i] ^= x;
+    }
+}
+
+void feToBytes(uint8_t* s, const Fe n)
+{
+    Fe t, m;
+    for (int i = 0; i < 16; ++i)
+    {
+        t[i] = n[i];
+    }
+    feCarryFull(t);
+    feCarryFull(t);
+    feCarryFull(t);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        m[0] = t[0] - 0xffed;
+        for (int i = 1; i < 15; ++i)
+        {
+            m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+            m[i - 1] &= 0xffff;
+        }
+        m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+        int64_t borrow = (m[15] >> 16) & 1;
+        m[14] &= 0xffff;
+        feSwap(t, m, static_cast<uint64_t>(1 - borrow));
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        s[2 * i] = static_cast<uint8_t>(t[i] & 0xff);
+        s[2 * i + 1] = static_cast<uint8_t>(t[i] >> 8);
+    }
+}
+
+inline void feCopy(Fe out, const Fe a)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        out[i] = a[i];
+    }
+}
+
+inline void feSet(Fe out, uint64_t value)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        out[i] = 0;
+    }
+    out[0] = static_cast<int64_t>(value);
+}
+
+inline void feAdd(Fe out, const Fe a, const Fe b)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        out[i] = a[i] + b[i];
+    }
+}
+
+inline void feSub(Fe out, const Fe a, const Fe b)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        out[i] = a[i] - b[i];
+    }
+}
+
+void feMul(Fe out, const Fe a, const Fe b)
+{
+    int64_t t[31] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int j = 0; j < 16; ++j)
+        {
+            t[i + j] += a[i] * b[j];
+        }
+    }
+    for (int i = 0; i < 15; ++i)
+    {
+        t[i] += 38 * t[i + 16];
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        out[i] = t[i];
+    }
+    feCarryFull(out);
+    feCarryFull(out);
+}
+
+inline void feSquare(Fe out, const Fe a)
+{
+    feMul(out, a, a);
+}
+
+void feMulSmall(Fe out, const Fe a, uint64_t k)
+{
+    Fe small;
+    feSet(small, 0);
+    small[0] = static_cast<int64_t>(k & 0xffff);
+    small[1] = static_cast<int64_t>(k >> 16);
+    feMul(out, a, small);
+}
+
+#endif
+
+inline void feSquareTimes(Fe out, const Fe a, int count)
+{
+    feSquare(out, a);
+    for (int i = 1; i < count; ++i)
+    {
+        feSquare(out, out);
+    }
+}
+
+// z^(p - 2) through the usual chain of 254 squarings and 11 multiplications
+void feInvert(Fe out, const Fe z)
+{
+    Fe z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+    feSquare(z2, z);
+    feSquareTimes(t, z2, 2);
+    feMul(z9, t, z);
+    feMul(z11, z9, z2);
+    feSquare(t, z11);
+    feMul(z2_5_0, t, z9);
+    feSquareTimes(t, z2_5_0, 5);
+    feMul(z2_10_0, t, z2_5_0);
+    feSquareTimes(t, z2_10_0, 10);
+    feMul(z2_20_0, t, z2_10_0);
+    feSquareTimes(t, z2_20_0, 20);
+    feMul(t, t, z2_20_0);
+    feSquareTimes(t, t, 10);
+    feMul(z2_50_0, t, z2_10_0);
+    feSquareTimes(t, z2_50_0, 50);
+    feMul(z2_100_0, t, z2_50_0);
+    feSquareTimes(t, z2_100_0, 100);
+    feMul(t, t, z2_100_0);
+    feSquareTimes(t, t, 50);
+    feMul(t, t, z2_50_0);
+    feSquareTimes(t, t, 5);
+    feMul(out, t, z11);
+}
+
+const uint8_t BASE_POINT[X25519_KEY_SIZE] = {9};
+
+const char HKDF_LABEL[] = "riif-ultrasonic key agreement v1";
+
+} // namespace
+
+Sha256::Sha256()
+{
+    reset();
+}
+
+Sha256::~Sha256()
+{
+    secureWipe(m_state, sizeof(m_state));
+    secureWipe(m_buffer, sizeof(m_buffer));
+}
+
+void Sha256::reset()
+{
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    std::memcpy(m_state, initial, sizeof(m_state));
+    m_length = 0;
+    m_buffered = 0;
+}
+
+void Sha256::compress(const uint8_t* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = loadBE32(block + 4 * i);
+    }
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+    m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+    secureWipe(w, sizeof(w));
+}
+
+void Sha256::update(const uint8_t* data, size_t length)
+{
+    m_length += length;
+    if (m_buffered > 0)
+    {
+        size_t n = std::min(BLOCK_SIZE - m_buffered, length);
+        std::memcpy(m_buffer + m_buffered, data, n);
+        m_buffered += n;
+        data += n;
+        length -= n;
+        if (m_buffered < BLOCK_SIZE)
+        {
+            return;
+        }
+        compress(m_buffer);
+        m_buffered = 0;
+    }
+    for (; length >= BLOCK_SIZE; data += BLOCK_SIZE, length -= BLOCK_SIZE)
+    {
+        compress(data);
+    }
+    if (length > 0)
+    {
+        std::memcpy(m_buffer, data, length);
+        m_buffered = length;
+    }
+}
+
+void Sha256::finish(uint8_t* digest)
+{
+    const uint64_t bits = m_length * 8;
+    m_buffer[m_buffered++] = 0x80;
+    if (m_buffered > BLOCK_SIZE - 8)
+    {
+        std::fill(m_buffer + m_buffered, m_buffer + BLOCK_SIZE, uint8_t(0));
+        compress(m_buffer);
+        m_buffered = 0;
+    }
+    std::fill(m_buffer + m_buffered, m_buffer + BLOCK_SIZE - 8, uint8_t(0));
+    storeBE32(m_buffer + BLOCK_SIZE - 8, static_cast<uint32_t>(bits >> 32));
+    storeBE32(m_buffer + BLOCK_SIZE - 4, static_cast<uint32_t>(bits));
+    compress(m_buffer);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        storeBE32(digest + 4 * i, m_state[i]);
+    }
+}
+
+void hmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length, uint8_t* mac)
+{
+    uint8_t block[Sha256::BLOCK_SIZE] = {};
+    Sha256 hash;
+    if (keyLength > Sha256::BLOCK_SIZE)
+    {
+        hash.update(key, keyLength);
+        hash.finish(block);
+        hash.reset();
+    }
+    else
+    {
+        std::copy_n(key, keyLength, block);
+    }
+
+    uint8_t pad[Sha256::BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(pad); ++i)
+    {
+        pad[i] = block[i] ^ 0x36;
+    }
+    uint8_t inner[Sha256::DIGEST_SIZE];
+    hash.update(pad, sizeof(pad));
+    hash.update(data, length);
+    hash.finish(inner);
+
+    for (size_t i = 0; i < sizeof(pad); ++i)
+    {
+        pad[i] = block[i] ^ 0x5c;
+    }
+    hash.reset();
+    hash.update(pad, sizeof(pad));
+    hash.update(inner, sizeof(inner));
+    hash.finish(mac);
+
+    secureWipe(block, sizeof(block));
+    secureWipe(pad, sizeof(pad));
+    secureWipe(inner, sizeof(inner));
+}
+
+bool hkdfSha256(const uint8_t* salt, size_t saltLength, const uint8_t* ikm, size_t ikmLength,
+                const uint8_t* info, size_t infoLength, uint8_t* out, size_t outLength)
+{
+    if (outLength > 255 * Sha256::DIGEST_SIZE)
+    {
+        return false;
+    }
+
+    // Extract; a missing salt is a block of zeros
+    static const uint8_t zeros[Sha256::DIGEST_SIZE] = {};
+    uint8_t prk[Sha256::DIGEST_SIZE];
+    if (saltLength == 0)
+    {
+        salt = zeros;
+        saltLength = sizeof(zeros);
+    }
+    hmacSha256(salt, saltLength, ikm, ikmLength, prk);
+
+    // Expand: T(i) = HMAC(PRK, T(i-1) | info | i)
+    uint8_t block[Sha256::DIGEST_SIZE];
+    Sha256 hash;
+    uint8_t pad[Sha256::BLOCK_SIZE];
+    for (uint8_t counter = 1; outLength > 0; ++counter)
+    {
+        uint8_t inner[Sha256::DIGEST_SIZE];
+        for (size_t i = 0; i < sizeof(pad); ++i)
+        {
+            pad[i] = (i < sizeof(prk) ? prk[i] : 0) ^ 0x36;
+        }
+        hash.reset();
+        hash.update(pad, sizeof(pad));
+        if (counter > 1)
+        {
+            hash.update(block, sizeof(block));
+        }
+        hash.update(info, infoLength);
+        hash.update(&counter, 1);
+        hash.finish(inner);
+
+        for (size_t i = 0; i < sizeof(pad); ++i)
+        {
+            pad[i] = (i < sizeof(prk) ? prk[i] : 0) ^ 0x5c;
+        }
+        hash.reset();
+        hash.update(pad, sizeof(pad));
+        hash.update(inner, sizeof(inner));
+        hash.finish(block);
+
+        size_t n = std::min(outLength, sizeof(block));
+        std::copy_n(block, n, out);
+        out += n;
+        outLength -= n;
+        secureWipe(inner, sizeof(inner));
+    }
+
+    secureWipe(prk, sizeof(prk));
+    secureWipe(block, sizeof(block));
+    secureWipe(pad, sizeof(pad));
+    return true;
+}
+
+void x25519(uint8_t* out, const uint8_t* scalar, const uint8_t* point)
+{
+    uint8_t e[X25519_KEY_SIZE];
+    std::copy_n(scalar, X25519_KEY_SIZE, e);
+    e[0] &= 248;
+    e[31] &= 127;
+    e[31] |= 64;
+
+    // Montgomery ladder (RFC 7748 section 5), the swaps are masks rather than branches
+    Fe x1, x2, z2, x3, z3, a, aa, b, bb, e_, c, d, da, cb;
+    feFromBytes(x1, point);
+    feSet(x2, 1);
+    feSet(z2, 0);
+    feCopy(x3, x1);
+    feSet(z3, 1);
+
+    uint64_t swap = 0;
+    for (int t = 254; t >= 0; --t)
+    {
+        uint64_t bit = (e[t >> 3] >> (t & 7)) & 1;
+        swap ^= bit;
+        feSwap(x2, x3, swap);
+        feSwap(z2, z3, swap);
+        swap = bit;
+
+        feAdd(a, x2, z2);
+        feSquare(aa, a);
+        feSub(b, x2, z2);
+        feSquare(bb, b);
+        feSub(e_, aa, bb);
+        feAdd(c, x3, z3);
+        feSub(d, x3, z3);
+        feMul(da, d, a);
+        feMul(cb, c, b);
+        feAdd(x3, da, cb);
+        feSquare(x3, x3);
+        feSub(z3, da, cb);
+        feSquare(z3, z3);
+        feMul(z3, z3, x1);
+        feMul(x2, aa, bb);
+        feMulSmall(z2, e_, 121665);
+        feAdd(z2, z2, aa);
+        feMul(z2, z2, e_);
+    }
+    feSwap(x2, x3, swap);
+    feSwap(z2, z3, swap);
+
+    feInvert(z2, z2);
+    feMul(x2, x2, z2);
+    feToBytes(out, x2);
+
+    secureWipe(e, sizeof(e));
+    secureWipe(x2, sizeof(x2));
+    secureWipe(z2, sizeof(z2));
+    secureWipe(x3, sizeof(x3));
+    secureWipe(z3, sizeof(z3));
+}
+
+void x25519PublicKey(uint8_t* publicKey, const uint8_t* privateKey)
+{
+    x25519(publicKey, privateKey, BASE_POINT);
+}
+
+bool systemRandom(uint8_t* out, size_t length)
+{
+    std::FILE* source = std::fopen("/dev/urandom", "rb");
+    if (source == nullptr)
+    {
+        return false;
+    }
+    bool ok = std::fread(out, 1, length, source) == length;
+    std::fclose(source);
+    return ok;
+}
+
+EphemeralKeyAgreement::EphemeralKeyAgreement() : m_valid(false)
+{
+    uint8_t random[X25519_KEY_SIZE];
+    if (systemRandom(random, sizeof(random)))
+    {
+        generate(random);
+    }
+    secureWipe(random, sizeof(random));
+}
+
+EphemeralKeyAgreement::EphemeralKeyAgreement(const uint8_t* randomBytes) : m_valid(false)
+{
+    generate(randomBytes);
+}
+
+EphemeralKeyAgreement::~EphemeralKeyAgreement()
+{
+    secureWipe(m_private, sizeof(m_private));
+}
+
+void EphemeralKeyAgreement::generate(const uint8_t* randomBytes)
+{
+    std::copy_n(randomBytes, X25519_KEY_SIZE, m_private);
+    x25519PublicKey(m_public, m_private);
+    m_valid = true;
+}
+
+bool EphemeralKeyAgreement::deriveKey(const uint8_t* peerPublicKey, const uint8_t* context, size_t contextLength,
+                                      uint8_t* key, size_t keyLength) const
+{
+    if (!m_valid)
+    {
+        return false;
+    }
+
+    uint8_t shared[X25519_KEY_SIZE];
+    x25519(shared, m_private, peerPublicKey);
+    static const uint8_t zeros[X25519_KEY_SIZE] = {};
+    if (constantTimeEqual(shared, zeros, sizeof(shared)))
+    {
+        return false;
+    }
+
+    // Salt: both public keys in a fixed order, so either side computes the same value
+    // without knowing which one initiated
+    uint8_t salt[2 * X25519_KEY_SIZE];
+    bool own_first = std::lexicographical_compare(m_public, m_public + X25519_KEY_SIZE,
+                                                  peerPublicKey, peerPublicKey + X25519_KEY_SIZE);
+    std::copy_n(own_first ? m_public : peerPublicKey, X25519_KEY_SIZE, salt);
+    std::copy_n(own_first ? peerPublicKey : m_public, X25519_KEY_SIZE, salt + X25519_KEY_SIZE);
+
+    // Info: a fixed label followed by the caller's context
+    Sha256 hash;
+    uint8_t info[Sha256::DIGEST_SIZE];
+    hash.update(reinterpret_cast<const uint8_t*>(HKDF_LABEL), sizeof(HKDF_LABEL) - 1);
+    hash.update(context, contextLength);
+    hash.finish(info);
+
+    bool ok = hkdfSha256(salt, sizeof(salt), shared, sizeof(shared), info, sizeof(info), key, keyLength);
+    secureWipe(shared, sizeof(shared));
+    return ok;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// SHA-256 (FIPS 180-4), incremental
+class Sha256 {
+public:
+    static constexpr size_t DIGEST_SIZE = 32;
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    Sha256();
+    ~Sha256();
+    void update(const uint8_t* data, size_t length);
+    void finish(uint8_t* digest);  // the object has to be reset() before it is used again
+    void reset();
+
+private:
+    uint32_t m_state[8];
+    uint64_t m_length;
+    uint8_t m_buffer[BLOCK_SIZE];
+    size_t m_buffered;
+
+    void compress(const uint8_t* block);
+};
+
+void hmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length, uint8_t* mac);
+
+// HKDF extract-and-expand (RFC 5869). Returns false if more than 255 * 32 bytes are asked for.
+bool hkdfSha256(const uint8_t* salt, size_t saltLength, const uint8_t* ikm, size_t ikmLength,
+                const uint8_t* info, size_t infoLength, uint8_t* out, size_t outLength);
+
+// X25519 Diffie-Hellman (RFC 7748), constant time. On 64-bit targets field elements are five
+// 51-bit limbs multiplied through 128-bit products; elsewhere a 16-bit limb fallback is used.
+constexpr size_t X25519_KEY_SIZE = 32;
+void x25519(uint8_t* out, const uint8_t* scalar, const uint8_t* point);
+void x25519PublicKey(uint8_t* publicKey, const uint8_t* privateKey);
+
+// Fill a buffer from the operating system's random source, false if it is unavailable
+bool systemRandom(uint8_t* out, size_t length);
+
+// One side of an ephemeral key agreement. Only the 32-byte public keys cross the air (and
+// the relay), each side then derives the same session key locally. The derivation binds
+// both public keys and the caller's context (a transaction ID, say), so a key is never
+// reused across transactions or confused between them.
+class EphemeralKeyAgreement {
+public:
+    // A fresh key pair from the system random source; valid() is false if that failed
+    EphemeralKeyAgreement();
+    // A key pair from caller-supplied randomness (32 bytes)
+    explicit EphemeralKeyAgreement(const uint8_t* randomBytes);
+    ~EphemeralKeyAgreement();  // wipes the private key
+    EphemeralKeyAgreement(const EphemeralKeyAgreement&) = delete;
+    EphemeralKeyAgreement& operator=(const EphemeralKeyAgreement&) = delete;
+
+    bool valid() const { return m_valid; }
+    const uint8_t* publicKey() const { return m_public; }
+
+    // HKDF-SHA256 of the shared secret. Fails on a low-order peer key (all-zero secret).
+    bool deriveKey(const uint8_t* peerPublicKey, const uint8_t* context, size_t contextLength,
+                   uint8_t* key, size_t keyLength) const;
+
+private:
+    uint8_t m_private[X25519_KEY_SIZE];
+    uint8_t m_public[X25519_KEY_SIZE];
+    bool m_valid;
+
+    void generate(const uint8_t* randomBytes);
+};
@@ -0,0 +1,197 @@
+#include "pos_protocol.h"
+#include <algorithm>
+
+namespace {
+
+const uint8_t HEADER_PUBLIC_KEY = 0x80;
+const uint8_t HEADER_AMOUNT = 0x40;
+const uint8_t HEADER_CURRENCY = 0x20;
+
+const size_t MAX_VARINT_BYTES = 10;  // 64 bits in 7-bit groups
+
+size_t varintSize(uint64_t value)
+{
+    size_t n = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+uint8_t* writeVarint(uint8_t* out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+// Returns nullptr on truncation or an overlong encoding
+const uint8_t* readVarint(const uint8_t* p, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (size_t i = 0; i < MAX_VARINT_BYTES && p < end; ++i)
+    {
+        uint8_t byte = *p++;
+        if (i == MAX_VARINT_BYTES - 1 && byte > 1)
+        {
+            return nullptr;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0)
+        {
+            // Only the canonical (shortest) form is accepted, so every message has one encoding
+            return (byte == 0 && i > 0) ? nullptr : p;
+        }
+    }
+    return nullptr;
+}
+
+bool packCurrency(const char* code, uint16_t& packed)
+{
+    packed = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (code[i] < 'A' || code[i] > 'Z')
+        {
+            return false;
+        }
+        packed = static_cast<uint16_t>((packed << 5) | (code[i] - 'A' + 1));
+    }
+    return code[3] == '\0';
+}
+
+bool unpackCurrency(uint16_t packed, char* code)
+{
+    if (packed & 0x8000)
+    {
+        return false;
+    }
+    for (int i = 2; i >= 0; --i)
+    {
+        int letter = packed & 0x1F;
+        if (letter < 1 || letter > 26)
+        {
+            return false;
+        }
+        code[i] = static_cast<char>('A' + letter - 1);
+        packed >>= 5;
+    }
+    code[3] = '\0';
+    return true;
+}
+
+} // namespace
+
+size_t posMessageSize(const PosMessage& message)
+{
+    if (message.flags > POS_MAX_FLAGS)
+    {
+        return 0;
+    }
+    size_t size = 2 + varintSize(message.transactionId);
+    if (message.hasAmount)
+    {
+        size += varintSize(message.amount);
+    }
+    if (message.currency[0] != '\0')
+    {
+        uint16_t packed;
+        if (!packCurrency(message.currency, packed))
+        {
+            return 0;
+        }
+        size += 2;
+    }
+    if (message.publicKey != nullptr)
+    {
+        size += POS_PUBLIC_KEY_SIZE;
+    }
+    return size;
+}
+
+size_t serializePosMessage(const PosMessage& message, uint8_t* out, size_t capacity)
+{
+    size_t size = posMessageSize(message);
+    if (size == 0 || size > capacity)
+    {
+        return 0;
+    }
+
+    uint8_t header = message.flags;
+    header |= message.publicKey != nullptr ? HEADER_PUBLIC_KEY : 0;
+    header |= message.hasAmount ? HEADER_AMOUNT : 0;
+    header |= message.currency[0] != '\0' ? HEADER_CURRENCY : 0;
+
+    uint8_t* p = out;
+    *p++ = POS_PROTOCOL_VERSION;
+    *p++ = header;
+    p = writeVarint(p, message.transactionId);
+    if (message.hasAmount)
+    {
+        p = writeVarint(p, message.amount);
+    }
+    if (header & HEADER_CURRENCY)
+    {
+        uint16_t packed;
+        packCurrency(message.currency, packed);
+        *p++ = static_cast<uint8_t>(packed >> 8);
+        *p++ = static_cast<uint8_t>(packed);
+    }
+    if (message.publicKey != nullptr)
+    {
+        p = std::copy_n(message.publicKey, POS_PUBLIC_KEY_SIZE, p);
+    }
+    return size;
+}
+
+size_t parsePosMessage(const uint8_t* data, size_t length, PosMessage& message)
+{
+    message = PosMessage();
+    const uint8_t* end = data + length;
+    if (length < 3 || data[0] != POS_PROTOCOL_VERSION)
+    {
+        return 0;
+    }
+
+    const uint8_t header = data[1];
+    const uint8_t* p = readVarint(data + 2, end, message.transactionId);
+    if (p == nullptr)
+    {
+        return 0;
+    }
+    message.flags = header & POS_MAX_FLAGS;
+
+    if (header & HEADER_AMOUNT)
+    {
+        p = readVarint(p, end, message.amount);
+        if (p == nullptr)
+        {
+            return 0;
+        }
+        message.hasAmount = true;
+    }
+    if (header & HEADER_CURRENCY)
+    {
+        if (end - p < 2 || !unpackCurrency(static_cast<uint16_t>((p[0] << 8) | p[1]), message.currency))
+        {
+            return 0;
+        }
+        p += 2;
+    }
+    if (header & HEADER_PUBLIC_KEY)
+    {
+        if (static_cast<size_t>(end - p) < POS_PUBLIC_KEY_SIZE)
+        {
+            return 0;
+        }
+        message.publicKey = p;
+        p += POS_PUBLIC_KEY_SIZE;
+    }
+    return static_cast<size_t>(p - data);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Compact binary message carried from the POS terminal to the customer's device. Every byte
+// costs eight symbols of airtime, so integers are varints (LEB128) and the optional fields
+// are announced by bits in one header byte. Layout, version 1:
+//
+//   version      1 byte   POS_PROTOCOL_VERSION
+//   header       1 byte   bit 7 public key, bit 6 amount, bit 5 currency, bits 4-0 flags
+//   transaction  varint
+//   amount       varint   minor units (cents), if present
+//   currency     2 bytes  ISO 4217 code, three 5-bit letters (A = 1), big-endian, if present
+//   public key   32 bytes X25519 key of the terminal, if present
+//
+// A parsed message points into the buffer it was read from, nothing is copied.
+static constexpr uint8_t POS_PROTOCOL_VERSION = 1;
+static constexpr size_t POS_PUBLIC_KEY_SIZE = 32;
+static constexpr uint8_t POS_MAX_FLAGS = 0x1F;
+
+struct PosMessage {
+    uint64_t transactionId = 0;
+    bool hasAmount = false;
+    uint64_t amount = 0;
+    char currency[4] = {};                // empty when absent, else three letters A-Z
+    uint8_t flags = 0;                    // application flags, up to POS_MAX_FLAGS
+    const uint8_t* publicKey = nullptr;   // POS_PUBLIC_KEY_SIZE bytes, or nullptr when absent
+};
+
+// Bytes serializePosMessage() would write, 0 if the message cannot be represented
+size_t posMessageSize(const PosMessage& message);
+
+// Returns the bytes written, 0 if the message is invalid or does not fit in capacity
+size_t serializePosMessage(const PosMessage& message, uint8_t* out, size_t capacity);
+
+// Returns the bytes consumed, 0 on a malformed or unknown-version message. Bytes after the
+// message (the zero padding of a codec block, say) are left alone.
+size_t parsePosMessage(const uint8_t* data, size_t length, PosMessage& message);
@@ -0,0 +1,159 @@
+/* Batched polynomial evaluation over GF(2^8) for the Chien search and the Forney step.
+ *
+ * The value at a^i is the sum of the terms c_d * a^(d*i). Sixteen consecutive positions
+ * of one term advance to the next sixteen by a multiplication with the constant a^(16*d),
+ * and multiplying a vector by a constant is two table lookups, one per nibble, which a byte
+ * shuffle does for sixteen lanes at once. */
+
+#include "gf.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define RS_GF_SSSE3 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define RS_GF_NEON 1
+#endif
+
+namespace RS {
+
+namespace gf {
+
+namespace {
+
+const size_t LANES = 16;
+
+/* k * v == lo[v & 15] ^ hi[v >> 4]: both tables are XORs of k times single bits */
+void nibble_tables(uint8_t k, uint8_t *lo, uint8_t *hi) {
+    uint8_t bits[8];
+    bits[0] = k;
+    for(int b = 1; b < 8; b++) {
+        bits[b] = (uint8_t)((bits[b-1] << 1) ^ ((bits[b-1] & 0x80) ? 0x1d : 0));
+    }
+    lo[0] = hi[0] = 0;
+    for(int n = 1; n < 16; n++) {
+        int b = 0;
+        while(!((n >> b) & 1)) b++;
+        lo[n] = lo[n & (n-1)] ^ bits[b];
+        hi[n] = hi[n & (n-1)] ^ bits[b+4];
+    }
+}
+
+/* First sixteen positions of the term of degree d, and the tables that step it by sixteen */
+void term_setup(uint8_t coef, size_t degree, uint8_t *seed, uint8_t *lo, uint8_t *hi) {
+    for(size_t lane = 0; lane < LANES; lane++) {
+        seed[lane] = exp[(log[coef] + degree * lane) % 255];
+    }
+    nibble_tables(exp[(degree * LANES) % 255], lo, hi);
+}
+
+typedef size_t (*EvalKernel)(const Poly *p, uint8_t *out, size_t count);
+
+#if RS_GF_SSSE3
+
+__attribute__((target("ssse3")))
+size_t eval_ssse3(const Poly *p, uint8_t *out, size_t count) {
+    const size_t blocks = count / LANES;
+    if(blocks == 0) return 0;
+
+    __m128i acc[255 / LANES];
+    for(size_t b = 0; b < blocks; b++) acc[b] = _mm_setzero_si128();
+
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    alignas(16) uint8_t seed[LANES], lo[16], hi[16];
+    for(uint8_t k = 0; k < p->length; k++) {
+        uint8_t coef = p->at(k);
+        if(coef == 0) continue;
+        term_setup(coef, p->length - 1 - k, seed, lo, hi);
+
+        __m128i term = _mm_load_si128((const __m128i*)seed);
+        const __m128i tlo = _mm_load_si128((const __m128i*)lo);
+        const __m128i thi = _mm_load_si128((const __m128i*)hi);
+        for(size_t b = 0; b < blocks; b++) {
+            acc[b] = _mm_xor_si128(acc[b], term);
+            term = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(term, mask)),
+                                 _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi16(term, 4), mask)));
+        }
+    }
+
+    for(size_t b = 0; b < blocks; b++) {
+        _mm_storeu_si128((__m128i*)(out + b * LANES), acc[b]);
+    }
+    return blocks * LANES;
+}
+
+#elif RS_GF_NEON
+
+size_t eval_neon(const Poly *p, uint8_t *out, size_t count) {
+    const size_t blocks = count / LANES;
+    if(blocks == 0) return 0;
+
+    uint8x16_t acc[255 / LANES];
+    for(size_t b = 0; b < blocks; b++) acc[b] = vdupq_n_u8(0);
+
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    uint8_t seed[LANES], lo[16], hi[16];
+    for(uint8_t k = 0; k < p->length; k++) {
+        uint8_t coef = p->at(k);
+        if(coef == 0) continue;
+        term_setup(coef, p->length - 1 - k, seed, lo, hi);
+
+        uint8x16_t term = vld1q_u8(seed);
+        const uint8x16_t tlo = vld1q_u8(lo);
+        const uint8x16_t thi = vld1q_u8(hi);
+        for(size_t b = 0; b < blocks; b++) {
+            acc[b] = veorq_u8(acc[b], term);
+            term = veorq_u8(vqtbl1q_u8(tlo, vandq_u8(term, mask)), vqtbl1q_u8(thi, vshrq_n_u8(term, 4)));
+        }
+    }
+
+    for(size_t b = 0; b < blocks; b++) {
+        vst1q_u8(out + b * LANES, acc[b]);
+    }
+    return blocks * LANES;
+}
+
+#endif
+
+struct EvalImplementation {
+    EvalKernel kernel;  // NULL: scalar only
+    const char* name;
+};
+
+EvalImplementation detect_implementation() {
+#if RS_GF_SSSE3
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")) {
+        return EvalImplementation{eval_ssse3, "ssse3"};
+    }
+#elif RS_GF_NEON
+    return EvalImplementation{eval_neon, "neon"};
+#endif
+    return EvalImplementation{NULL, "scalar"};
+}
+
+const EvalImplementation& eval_implementation() {
+    static const EvalImplementation implementation = detect_implementation();
+    return implementation;
+}
+
+} // namespace
+
+void poly_eval_powers(const Poly *p, uint8_t *out, size_t count) {
+    assert(count <= 255);
+    const EvalImplementation& impl = eval_implementation();
+    size_t done = impl.kernel != NULL ? impl.kernel(p, out, count) : 0;
+
+    // Positions the vectors did not cover, by Horner's rule
+    for(size_t i = done; i < count; i++) {
+        out[i] = (uint8_t)poly_eval(p, exp[i]);
+    }
+}
+
+const char* poly_eval_implementation() {
+    return eval_implementation().name;
+}
+
+} /* end of gf namespace */
+
+}
@@ -13,12 +13,12 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <iostream>
 
 namespace RS {
 
 #define MSG_CNT 3   // message-length polynomials count
 #define POLY_CNT 14 // (ecc_length*2)-length polynomialc count
+#define FORNEY_BATCH_ERRATA 8 // errata count from which Forney evaluates at all positions at once
 
 class ReedSolomon {
 public:
@@ -27,12 +27,13 @@ public:
 
     uint8_t * heap_memory = nullptr;
     uint8_t * generator_cache = nullptr;
+    uint8_t * syndrome_acc = nullptr;
     bool owns_heap_memory = false;
     bool generator_cached = false;
 
     // used to pre-allocate a memory buffer for the Reed-Solomon class in order to avoid memory allocations
-    static size_t getWorkSize_bytes(uint8_t msg_length, uint8_t ecc_length) {
-        return ecc_length + 1 + MSG_CNT * msg_length + POLY_CNT * ecc_length * 2;
+    static constexpr size_t getWorkSize_bytes(uint8_t msg_length, uint8_t ecc_length) {
+        return ecc_length + 1 + ecc_length + MSG_CNT * msg_length + POLY_CNT * ecc_length * 2;
     }
 
     ReedSolomon(uint8_t msg_length_p, uint8_t ecc_length_p, uint8_t * heap_memory_p = nullptr) :
@@ -41,10 +42,16 @@ public:
             heap_memory = heap_memory_p;
             owns_heap_memory = false;
         } else {
+#ifdef RIIF_EMBEDDED
+            // heap-free builds always pass their workspace
+            assert(heap_memory_p != nullptr);
+#else
             heap_memory = (uint8_t *) malloc(getWorkSize_bytes(msg_length, ecc_length));
             owns_heap_memory = true;
+#endif
         }
         generator_cache = heap_memory;
+        syndrome_acc = heap_memory + ecc_length + 1;
 
         const uint8_t   enc_len  = msg_length + ecc_length;
         const uint8_t   poly_len = ecc_length * 2;
@@ -74,9 +81,11 @@ public:
     }
 
     ~ReedSolomon() {
+#ifndef RIIF_EMBEDDED
         if (owns_heap_memory) {
-            delete[] heap_memory;
+            free(heap_memory);
         }
+#endif
         // Dummy destructor, gcc-generated one crashes program
         memory = NULL;
     }
@@ -92,7 +101,7 @@ public:
         //this->memory = stack_memory;
 
         // gg : allocation is now on the heap
-        this->memory = heap_memory + ecc_length + 1;
+        this->memory = heap_memory + 2 * ecc_length + 1;
 
         const uint8_t* src_ptr = (const uint8_t*) src;
         uint8_t* dst_ptr = (uint8_t*) dst;
@@ -155,6 +164,81 @@ public:
      * @param erase_count  - count of known errors
      * @return RESULT_SUCCESS if successfull, error code otherwise */
      int DecodeBlock(const void* src, const void* ecc, void* dst, uint8_t* erase_pos = NULL, size_t erase_count = 0) {
+        return DecodeWith(src, ecc, dst, erase_pos, erase_count, NULL);
+    }
+
+    /* @brief Message block decoding
+     * @param *src         - encoded message buffer   (msg_length + ecc_length size)
+     * @param *msg_out     - output buffer            (msg_length size at least)
+     * @param *erase_pos   - known errors positions
+     * @param erase_count  - count of known errors
+     * @return RESULT_SUCCESS if successfull, error code otherwise */
+     int Decode(const void* src, void* dst, uint8_t* erase_pos = NULL, size_t erase_count = 0) {
+         const uint8_t *src_ptr = (const uint8_t*) src;
+         const uint8_t *ecc_ptr = src_ptr + msg_length;
+
+         return DecodeBlock(src, ecc_ptr, dst, erase_pos, erase_count);
+     }
+
+    /* Streaming syndromes: call BeginSyndromes(), then push every codeword byte in order as it
+     * arrives (PushZeros() skips a run of known zero bytes in one step). Each byte is one Horner
+     * step of all ecc_length syndromes, so once the last byte is in SyndromesClean() tells
+     * whether the codeword needs correcting and DecodeStreamed() goes straight to error
+     * location. */
+    void BeginSyndromes() {
+        memset(syndrome_acc, 0, ecc_length);
+    }
+
+    void PushSyndromes(uint8_t byte) {
+        // S_i = S_i * a^i + byte
+        for(uint8_t i = 0; i < ecc_length; i++) {
+            uint8_t s = syndrome_acc[i];
+            if(s != 0) {
+                int index = gf::log[s] + i;
+                if(index >= 255) index -= 255;
+                s = gf::exp[index];
+            }
+            syndrome_acc[i] = s ^ byte;
+        }
+    }
+
+    void PushZeros(size_t count) {
+        // S_i = S_i * a^(i * count)
+        size_t step = count % 255;
+        for(uint8_t i = 0; i < ecc_length; i++) {
+            uint8_t s = syndrome_acc[i];
+            if(s != 0) {
+                syndrome_acc[i] = gf::exp[(gf::log[s] + i * step) % 255];
+            }
+        }
+    }
+
+    bool SyndromesClean() const {
+        for(uint8_t i = 0; i < ecc_length; i++) {
+            if(syndrome_acc[i] != 0) return false;
+        }
+        return true;
+    }
+
+    /* @brief Decoding with the streamed syndromes of the same codeword
+     * @param *src         - encoded message buffer   (msg_length + ecc_length size)
+     * @param *dst         - output buffer            (msg_length size at least)
+     * @return RESULT_SUCCESS if successfull, error code otherwise */
+    int DecodeStreamed(const void* src, void* dst) {
+        const uint8_t *src_ptr = (const uint8_t*) src;
+        if(SyndromesClean()) {
+            memcpy(dst, src_ptr, msg_length);
+            return 0;
+        }
+        return DecodeWith(src_ptr, src_ptr + msg_length, dst, NULL, 0, syndrome_acc);
+    }
+
+#ifndef DEBUG
+private:
+#endif
+
+    int DecodeWith(const void* src, const void* ecc, void* dst, uint8_t* erase_pos, size_t erase_count,
+                   const uint8_t* syndromes) {
         assert(msg_length + ecc_length < 256);
 
         const uint8_t *src_ptr = (const uint8_t*) src;
@@ -171,7 +255,7 @@ public:
         //this->memory = stack_memory;
 
         // gg : allocation is now on the heap
-        this->memory = heap_memory + ecc_length + 1;
+        this->memory = heap_memory + 2 * ecc_length + 1;
 
         Poly *msg_in  = &polynoms[ID_MSG_IN];
         Poly *msg_out = &polynoms[ID_MSG_OUT];
@@ -201,8 +285,14 @@ public:
         Poly *err    = &polynoms[ID_ERRORS];
         Poly *forney = &polynoms[ID_FORNEY];
 
-        // Calculating syndrome
-        CalcSyndromes(msg_in);
+        // Calculating syndrome, unless it was streamed (erasures change it, so not then)
+        if(syndromes != NULL && epos->length == 0) {
+            synd->length = ecc_length+1;
+            synd->at(0) = 0;
+            memcpy(synd->ptr()+1, syndromes, ecc_length);
+        } else {
+            CalcSyndromes(msg_in);
+        }
 
         // Checking for errors
         bool has_errors = false;
@@ -248,23 +338,6 @@ public:
         return 0;
     }
 
-    /* @brief Message block decoding
-     * @param *src         - encoded message buffer   (msg_length + ecc_length size)
-     * @param *msg_out     - output buffer            (msg_length size at least)
-     * @param *erase_pos   - known errors positions
-     * @param erase_count  - count of known errors
-     * @return RESULT_SUCCESS if successfull, error code otherwise */
-     int Decode(const void* src, void* dst, uint8_t* erase_pos = NULL, size_t erase_count = 0) {
-         const uint8_t *src_ptr = (const uint8_t*) src;
-         const uint8_t *ecc_ptr = src_ptr + msg_length;
-
-         return DecodeBlock(src, ecc_ptr, dst, erase_pos, erase_count);
-     }
-
-#ifndef DEBUG
-private:
-#endif
-
     enum POLY_ID {
         ID_MSG_IN = 0,
         ID_MSG_OUT,
@@ -402,18 +475,41 @@ private:
             X->Append(gf::pow(2, -l));
         }
 
+        uint8_t y;
+
         /* Magnitude polynomial
            Shit just got real */
         Poly *E = &polynoms[ID_MSG_E];
         E->Reset();
         E->length = msg_in->length;
 
+        if(X->length >= FORNEY_BATCH_ERRATA) {
+            /* Near the correction limit the evaluator and the formal derivative of the errata
+             * locator are evaluated at every position in two batched passes, and each magnitude
+             * is X^2 * eval(X^-1) / loc'(X^-1) */
+            Poly *dloc = &polynoms[ID_TPOLY3];
+            dloc->length = errata_loc->length - 1;
+            for(uint8_t k = 0; k < dloc->length; k++) {
+                dloc->at(k) = ((errata_loc->length - 1 - k) & 1) ? errata_loc->at(k) : 0;
+            }
+
+            uint8_t eval_at[255], dloc_at[255];
+            gf::poly_eval_powers(re_eval, eval_at, 255);
+            gf::poly_eval_powers(dloc, dloc_at, 255);
+            for(uint8_t i = 0; i < X->length; i++) {
+                uint8_t k = (255 - c_pos->at(i)) % 255;  // X^-1 == a^k
+                y = gf::mul(gf::mul(X->at(i), X->at(i)), eval_at[k]);
+                E->at(err_pos->at(i)) = gf::div(y, dloc_at[k]);
+            }
+            gf::poly_add(msg_in, E, corrected);
+            return;
+        }
+
         uint8_t Xi_inv;
 
         Poly *err_loc_prime_temp = &polynoms[ID_TPOLY2];
 
         uint8_t err_loc_prime;
-        uint8_t y;
 
         for(uint8_t i = 0; i < X->length; i++){
             Xi_inv = gf::inverse(X->at(i));
@@ -510,9 +606,11 @@ private:
         uint8_t errs = error_loc->length - 1;
         err->length = 0;
 
+        // Chien search: the locator at every position in one batched pass
+        uint8_t eval_result[255];
+        gf::poly_eval_powers(error_loc, eval_result, msg_in_size);
         for(uint8_t i = 0; i < msg_in_size; i++) {
-            uint8_t eval_result = gf::poly_eval(error_loc, gf::pow(2, i));
-            if(eval_result == 0) {
+            if(eval_result[i] == 0) {
                 err->Append(msg_in_size - 1 - i);
             }
         }
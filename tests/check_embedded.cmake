@@ -0,0 +1,125 @@
+# Checks that the embedded library needs no heap, exceptions or iostreams, reports its code
+# size, and bounds its stack. Run with -DNM=<nm> -DSIZE=<size> -DLIBRARY=<archive>, and for
+# the stack with -DCALLGRAPH_DIR=<object dir> -DHEADER=<embedded_reader.h>.
+cmake_minimum_required(VERSION 3.10)
+
+execute_process(COMMAND ${NM} -u -C ${LIBRARY} OUTPUT_VARIABLE undefined RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "nm failed on ${LIBRARY}")
+endif()
+
+set(forbidden "malloc" "calloc" "realloc" "free" "operator new" "operator delete"
+    "__cxa_throw" "__cxa_allocate_exception" "__gxx_personality" "std::cout" "std::ios_base")
+foreach(symbol IN LISTS forbidden)
+    string(FIND "${undefined}" "${symbol}" found)
+    if(NOT found EQUAL -1)
+        message(FATAL_ERROR "${LIBRARY} references ${symbol}:\n${undefined}")
+    endif()
+endforeach()
+
+if(SIZE)
+    execute_process(COMMAND ${SIZE} -t ${LIBRARY} OUTPUT_VARIABLE sizes)
+    message(STATUS "Embedded reader code size (text, data, bss per object):\n${sizes}")
+endif()
+
+# Stack: the deepest call chain from EmbeddedReader::push() in the call graphs GCC writes with
+# -fcallgraph-info=su, frame sizes summed along it. Indirect calls are the GF evaluation
+# kernels. Library calls (memmove, sqrtf, assert) have no frame in the graph; STACK_BYTES
+# keeps a margin for them.
+if(NOT CALLGRAPH_DIR)
+    return()
+endif()
+file(GLOB_RECURSE graphs "${CALLGRAPH_DIR}/*.ci")
+if(NOT graphs)
+    message(STATUS "No call graphs in ${CALLGRAPH_DIR}, the stack bound is not checked")
+    return()
+endif()
+
+set(root_pattern "EmbeddedReader.*4push")
+set(indirect_pattern "eval_(ssse3|neon)")
+set(functions "")
+foreach(graph IN LISTS graphs)
+    file(READ ${graph} text)
+    # One entry per line; brackets and semicolons in signatures would upset list handling
+    string(REGEX REPLACE "[][;]" "" text "${text}")
+    string(REPLACE "\n" ";" lines "${text}")
+    foreach(line IN LISTS lines)
+        if(line MATCHES "^node: { title: \"([^\"]*)\" label: \"[^\"]*n([0-9]+) bytes \\(")
+            set(frame ${CMAKE_MATCH_2})
+            string(REGEX REPLACE ".*:" "" name "${CMAKE_MATCH_1}")
+            set_property(GLOBAL PROPERTY "frame_${name}" ${frame})
+            list(APPEND functions ${name})
+        elseif(line MATCHES "^edge: { sourcename: \"([^\"]*)\" targetname: \"([^\"]*)\"")
+            set(target "${CMAKE_MATCH_2}")
+            string(REGEX REPLACE ".*:" "" caller "${CMAKE_MATCH_1}")
+            string(REGEX REPLACE ".*:" "" callee "${target}")
+            set_property(GLOBAL APPEND PROPERTY "calls_${caller}" ${callee})
+        endif()
+    endforeach()
+endforeach()
+
+set(roots "")
+set(indirect_targets "")
+foreach(name IN LISTS functions)
+    if(name MATCHES "${root_pattern}")
+        list(APPEND roots ${name})
+    endif()
+    if(name MATCHES "${indirect_pattern}")
+        list(APPEND indirect_targets ${name})
+    endif()
+endforeach()
+if(NOT roots)
+    message(FATAL_ERROR "No EmbeddedReader::push() in the call graphs of ${CALLGRAPH_DIR}")
+endif()
+
+# Deepest stack below and including node, memoized; the chain is kept for the report
+function(deepest node result)
+    get_property(done GLOBAL PROPERTY "deepest_${node}" SET)
+    if(done)
+        get_property(value GLOBAL PROPERTY "deepest_${node}")
+        set(${result} ${value} PARENT_SCOPE)
+        return()
+    endif()
+    get_property(visiting GLOBAL PROPERTY "visiting_${node}")
+    if(visiting)
+        message(FATAL_ERROR "Recursion through ${node}, the stack has no static bound")
+    endif()
+    set_property(GLOBAL PROPERTY "visiting_${node}" TRUE)
+
+    get_property(frame GLOBAL PROPERTY "frame_${node}")
+    if(NOT frame)
+        set(frame 0)
+    endif()
+    get_property(calls GLOBAL PROPERTY "calls_${node}")
+    list(REMOVE_DUPLICATES calls)
+    list(FIND calls "__indirect_call" indirect)
+    if(NOT indirect EQUAL -1)
+        list(APPEND calls ${indirect_targets})
+    endif()
+    set(best 0)
+    set(best_chain "")
+    foreach(callee IN LISTS calls)
+        deepest(${callee} depth)
+        if(depth GREATER best)
+            set(best ${depth})
+            get_property(best_chain GLOBAL PROPERTY "chain_${callee}")
+        endif()
+    endforeach()
+
+    math(EXPR total "${frame} + ${best}")
+    set_property(GLOBAL PROPERTY "deepest_${node}" ${total})
+    set_property(GLOBAL PROPERTY "chain_${node}" "  ${frame}\t${node}\n${best_chain}")
+    set_property(GLOBAL PROPERTY "visiting_${node}" FALSE)
+    set(${result} ${total} PARENT_SCOPE)
+endfunction()
+
+file(STRINGS ${HEADER} declaration REGEX "STACK_BYTES = [0-9]+")
+string(REGEX MATCH "[0-9]+" budget "${declaration}")
+foreach(root IN LISTS roots)
+    deepest(${root} depth)
+    get_property(chain GLOBAL PROPERTY "chain_${root}")
+    message(STATUS "Deepest stack from EmbeddedReader::push(): ${depth} bytes\n${chain}")
+    if(depth GREATER budget)
+        message(FATAL_ERROR "The deepest stack, ${depth} bytes, exceeds STACK_BYTES = ${budget}")
+    endif()
+endforeach()
@@ -0,0 +1,265 @@
+#include <gtest/gtest.h>
+#include "../include/riif_ultrasonic.h"
+#include "core/async_receiver.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#endif
+
+namespace {
+
+RiifUltrasonic::Parameters fastParameters()
+{
+    RiifUltrasonic::Parameters params;
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    params.shortenCodewords = true;
+    return params;
+}
+
+// Transmissions one after another, each behind `gap` samples, with noise over everything
+std::vector<int16_t> capture(const std::vector<std::vector<int16_t>>& signals, size_t gap, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::vector<int16_t> samples;
+    for (const std::vector<int16_t>& signal : signals) {
+        samples.resize(samples.size() + gap, 0);
+        samples.insert(samples.end(), signal.begin(), signal.end());
+    }
+    samples.resize(samples.size() + gap, 0);
+    for (int16_t& s : samples) {
+        float v = s / 32768.0f + noise(gen);
+        s = static_cast<int16_t>(std::max(-1.0f, std::min(1.0f, v)) * 32767);
+    }
+    return samples;
+}
+
+// Pushes in irregular blocks, as an audio callback would
+void pushAll(AsyncReceiver& receiver, const std::vector<int16_t>& samples)
+{
+    std::mt19937 gen(5);
+    std::uniform_int_distribution<size_t> block(1, 3000);
+    for (size_t pos = 0; pos < samples.size();) {
+        size_t n = std::min(block(gen), samples.size() - pos);
+        receiver.push(samples.data() + pos, n);
+        pos += n;
+    }
+}
+
+// Minimal event loop: jobs posted from any thread run on the thread calling runUntil()
+class Loop {
+public:
+    void post(std::function<void()> job) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+        m_wake.notify_one();
+    }
+
+    bool runUntil(const std::function<bool()>& done) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (!done()) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!m_wake.wait_until(lock, deadline, [this] { return !m_jobs.empty(); })) {
+                return false;
+            }
+            std::function<void()> job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            lock.unlock();
+            job();
+        }
+        return true;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::function<void()>> m_jobs;
+};
+
+std::string text(const std::vector<uint8_t>& message)
+{
+    return std::string(message.begin(), message.end());
+}
+
+}
+
+TEST(AsyncReceiverTest, MessagesDeliveredOnLoopThread) {
+    RiifUltrasonic transmitter;
+    transmitter.setParameters(fastParameters());
+    std::vector<int16_t> samples = capture({transmitter.encode("PAY 7.10"), transmitter.encode("REFUND 3.25")}, 9000, 50);
+
+    Loop loop;
+    AsyncReceiver receiver(fastParameters(), 48000, [&loop](std::function<void()> job) { loop.post(std::move(job)); });
+    std::vector<std::string> received;
+    std::vector<std::thread::id> threads;
+    auto handler = [&](std::vector<uint8_t> message) {
+        received.push_back(text(message));
+        threads.push_back(std::this_thread::get_id());
+    };
+    receiver.nextMessage(handler);
+    receiver.nextMessage(handler);
+
+    // The loop thread only copies audio in; the decoding happens behind it
+    pushAll(receiver, samples);
+    ASSERT_TRUE(loop.runUntil([&] { return received.size() == 2; }));
+    EXPECT_EQ("PAY 7.10", received[0]);
+    EXPECT_EQ("REFUND 3.25", received[1]);
+    for (std::thread::id id : threads) {
+        EXPECT_EQ(std::this_thread::get_id(), id);
+    }
+    EXPECT_EQ(0u, receiver.failedFrames());
+
+    // After the end of the capture, requests are answered with empty messages
+    receiver.finish();
+    receiver.nextMessage(handler);
+    ASSERT_TRUE(loop.runUntil([&] { return received.size() == 3; }));
+    EXPECT_TRUE(received[2].empty());
+}
+
+TEST(AsyncReceiverTest, FutureWithDispatch) {
+    RiifUltrasonic transmitter;
+    transmitter.setParameters(fastParameters());
+    std::vector<int16_t> signal = transmitter.encode("PAY 7.10");
+    // The second transmission is cut off halfway and cannot be corrected
+    std::vector<int16_t> cut(signal.begin(), signal.begin() + signal.size() / 2);
+    std::vector<int16_t> samples = capture({signal, cut}, 7000, 51);
+    samples.resize(samples.size() - 7000);
+
+    // Without a post function, deliveries wait for dispatch() on the loop thread
+    AsyncReceiver receiver(fastParameters(), 48000);
+    std::future<std::vector<uint8_t>> first = receiver.nextMessage().future();
+    pushAll(receiver, samples);
+    receiver.finish();
+    std::future<std::vector<uint8_t>> second = receiver.nextMessage().future();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (second.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready &&
+           std::chrono::steady_clock::now() < deadline) {
+        receiver.dispatch();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(std::future_status::ready, first.wait_for(std::chrono::milliseconds(0)));
+    EXPECT_EQ("PAY 7.10", text(first.get()));
+    ASSERT_EQ(std::future_status::ready, second.wait_for(std::chrono::milliseconds(0)));
+    EXPECT_TRUE(second.get().empty());
+    EXPECT_EQ(1u, receiver.failedFrames());
+}
+
+TEST(AsyncReceiverTest, NoiseBurstIsNotAnOnset) {
+    RiifUltrasonic transmitter;
+    transmitter.setParameters(fastParameters());
+    std::vector<int16_t> samples = capture({transmitter.encode("PAY 7.10")}, 9000, 53);
+
+    // A click loud enough to cross the onset threshold, a few symbols before the transmission
+    std::mt19937 gen(54);
+    std::normal_distribution<float> click(0.0f, 0.5f);
+    for (size_t i = 6000; i < 6200; ++i) {
+        samples[i] = static_cast<int16_t>(std::max(-1.0f, std::min(1.0f, click(gen))) * 32767);
+    }
+
+    AsyncReceiver receiver(fastParameters(), 48000);
+    std::future<std::vector<uint8_t>> message = receiver.nextMessage().future();
+    pushAll(receiver, samples);
+    receiver.finish();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (message.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready &&
+           std::chrono::steady_clock::now() < deadline) {
+        receiver.dispatch();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(std::future_status::ready, message.wait_for(std::chrono::milliseconds(0)));
+    EXPECT_EQ("PAY 7.10", text(message.get()));
+    EXPECT_EQ(0u, receiver.failedFrames());
+}
+
+TEST(AsyncReceiverTest, DestructionAnswersRequests) {
+    // Through the post function, after the receiver is gone
+    Loop loop;
+    std::vector<std::string> received;
+    {
+        AsyncReceiver receiver(fastParameters(), 48000, [&loop](std::function<void()> job) { loop.post(std::move(job)); });
+        auto handler = [&](std::vector<uint8_t> message) { received.push_back(text(message)); };
+        receiver.nextMessage(handler);
+        receiver.nextMessage(handler);
+    }
+    ASSERT_TRUE(loop.runUntil([&] { return received.size() == 2; }));
+    EXPECT_TRUE(received[0].empty());
+    EXPECT_TRUE(received[1].empty());
+
+    // Without one, before the destructor returns
+    std::future<std::vector<uint8_t>> message;
+    {
+        AsyncReceiver receiver(fastParameters(), 48000);
+        message = receiver.nextMessage().future();
+    }
+    ASSERT_EQ(std::future_status::ready, message.wait_for(std::chrono::milliseconds(0)));
+    EXPECT_TRUE(message.get().empty());
+
+    // While the worker is still decoding: the request gets the message or an empty one
+    RiifUltrasonic transmitter;
+    transmitter.setParameters(fastParameters());
+    std::vector<int16_t> samples = capture({transmitter.encode("PAY 7.10"), transmitter.encode("PAY 12.00")}, 8000, 55);
+    {
+        AsyncReceiver receiver(fastParameters(), 48000);
+        message = receiver.nextMessage().future();
+        receiver.push(samples.data(), samples.size());
+    }
+    ASSERT_EQ(std::future_status::ready, message.wait_for(std::chrono::milliseconds(0)));
+    std::string first = text(message.get());
+    EXPECT_TRUE(first.empty() || first == "PAY 7.10");
+}
+
+#ifdef __cpp_impl_coroutine
+namespace {
+
+// Fire-and-forget coroutine, enough to drive co_await from a test
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+Detached readTwo(AsyncReceiver& receiver, std::vector<std::string>& received, std::vector<std::thread::id>& threads)
+{
+    for (int i = 0; i < 2; ++i) {
+        std::vector<uint8_t> message = co_await receiver.nextMessage();
+        received.push_back(text(message));
+        threads.push_back(std::this_thread::get_id());
+    }
+}
+
+}
+
+TEST(AsyncReceiverTest, CoroutineAwaitsMessages) {
+    RiifUltrasonic transmitter;
+    transmitter.setParameters(fastParameters());
+    std::vector<int16_t> samples = capture({transmitter.encode("PAY 7.10"), transmitter.encode("PAY 12.00")}, 8000, 52);
+
+    Loop loop;
+    AsyncReceiver receiver(fastParameters(), 48000, [&loop](std::function<void()> job) { loop.post(std::move(job)); });
+    std::vector<std::string> received;
+    std::vector<std::thread::id> threads;
+    readTwo(receiver, received, threads);
+    pushAll(receiver, samples);
+
+    ASSERT_TRUE(loop.runUntil([&] { return received.size() == 2; }));
+    EXPECT_EQ("PAY 7.10", received[0]);
+    EXPECT_EQ("PAY 12.00", received[1]);
+    for (std::thread::id id : threads) {
+        EXPECT_EQ(std::this_thread::get_id(), id);
+    }
+}
+#endif
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include "../include/riif_ultrasonic.h"
+#include "embedded/embedded_reader.h"
+#include <vector>
+#include <string>
+#include <random>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Heap calls are counted while g_count_allocations is set
+namespace {
+std::atomic<bool> g_count_allocations(false);
+std::atomic<size_t> g_allocations(0);
+
+struct ShortProfile : EmbeddedProfile {
+    static constexpr int samplesPerFrame = 512;
+    static constexpr double df = 1000.0;
+    static constexpr bool shortenCodewords = true;
+};
+
+template <class Profile>
+RiifUltrasonic::Parameters transmitterFor()
+{
+    RiifUltrasonic::Parameters params;
+    params.sampleRate = Profile::sampleRate;
+    params.samplesPerFrame = Profile::samplesPerFrame;
+    params.f0 = Profile::f0;
+    params.df = Profile::df;
+    params.rsMsgLength = Profile::rsMsgLength;
+    params.rsEccLength = Profile::rsEccLength;
+    params.shortenCodewords = Profile::shortenCodewords;
+    return params;
+}
+
+// Transmission behind `lead` samples of noise, with noise on top
+std::vector<int16_t> capture(const std::vector<int16_t>& signal, size_t lead, float noise_level, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::normal_distribution<float> noise(0.0f, noise_level);
+    std::vector<int16_t> samples(lead + signal.size() + 2000);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        float s = (i >= lead && i - lead < signal.size()) ? signal[i - lead] / 32768.0f : 0.0f;
+        samples[i] = static_cast<int16_t>(std::max(-1.0f, std::min(1.0f, s + noise(gen))) * 32767);
+    }
+    return samples;
+}
+}
+
+void* operator new(std::size_t size)
+{
+    if (g_count_allocations) {
+        ++g_allocations;
+    }
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+TEST(EmbeddedReaderTest, DecodesShortenedFrameWithoutHeap) {
+    RiifUltrasonic riif;
+    riif.setParameters(transmitterFor<ShortProfile>());
+    std::string message = "txn=88213;amount=12.50";
+    std::vector<int16_t> samples = capture(riif.encode(message), 3333, 0.05f, 45);
+
+    static EmbeddedReader<ShortProfile> reader;
+    reader.reset();
+    g_allocations = 0;
+    g_count_allocations = true;
+    EmbeddedReader<ShortProfile>::Status status = EmbeddedReader<ShortProfile>::LISTENING;
+    const size_t block = 333;
+    for (size_t i = 0; i < samples.size() && status != EmbeddedReader<ShortProfile>::COMPLETE; i += block) {
+        status = reader.push(samples.data() + i, std::min(block, samples.size() - i));
+    }
+    g_count_allocations = false;
+
+    EXPECT_EQ(0u, g_allocations.load()) << "The embedded reader touched the heap";
+    ASSERT_EQ(EmbeddedReader<ShortProfile>::COMPLETE, status);
+    EXPECT_EQ(message, std::string(reader.message(), reader.message() + reader.messageLength()));
+
+    // Ready for the next transmission after a reset; silence alone never starts a frame
+    reader.reset();
+    std::vector<int16_t> quiet = capture(std::vector<int16_t>(), 20000, 0.002f, 46);
+    EXPECT_EQ(EmbeddedReader<ShortProfile>::LISTENING, reader.push(quiet.data(), quiet.size()));
+    std::vector<int16_t> again = capture(riif.encode("PAY 1.00"), 0, 0.05f, 47);
+    ASSERT_EQ(EmbeddedReader<ShortProfile>::COMPLETE, reader.push(again.data(), again.size()));
+    EXPECT_EQ("PAY 1.00", std::string(reader.message(), reader.message() + reader.messageLength()));
+}
+
+TEST(EmbeddedReaderTest, DecodesDefaultParameters) {
+    RiifUltrasonic riif;
+    riif.setParameters(transmitterFor<EmbeddedProfile>());
+    std::string message = "store beacon 17";
+    std::vector<int16_t> samples = capture(riif.encode(message), 1500, 0.05f, 48);
+
+    static EmbeddedReader<EmbeddedProfile> reader;
+    reader.reset();
+    ASSERT_EQ(EmbeddedReader<EmbeddedProfile>::COMPLETE, reader.push(samples.data(), samples.size()));
+    ASSERT_EQ(223u, reader.messageLength());
+    EXPECT_EQ(message, std::string(reader.message(), reader.message() + message.size()));
+}
+
+TEST(EmbeddedReaderTest, FitsTheRamBudget) {
+    // The reader is the whole receive-side RAM apart from the caller's sample blocks
+    const size_t budget = 64 * 1024;
+    EXPECT_LE(EmbeddedReader<EmbeddedProfile>::ramBytes(), budget);
+    EXPECT_LE(EmbeddedReader<ShortProfile>::ramBytes(), budget);
+    RecordProperty("DefaultProfileRamBytes", static_cast<int>(EmbeddedReader<EmbeddedProfile>::ramBytes()));
+}
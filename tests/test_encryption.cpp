@@ -0,0 +1,213 @@
+#include <gtest/gtest.h>
+#include "encryption.h"
+#include "key_agreement.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace {
+
+std::vector<uint8_t> fromHex(const std::string& hex)
+{
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back(static_cast<uint8_t>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+std::vector<uint8_t> sequence(uint8_t first, size_t count)
+{
+    std::vector<uint8_t> bytes(count);
+    for (size_t i = 0; i < count; ++i) {
+        bytes[i] = static_cast<uint8_t>(first + i);
+    }
+    return bytes;
+}
+
+const std::string SUNSCREEN = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for "
+                              "the future, sunscreen would be it.";
+
+} // namespace
+
+// RFC 8439 section 2.4.2
+TEST(EncryptionTest, ChaCha20Rfc8439Vector) {
+    std::vector<uint8_t> key = sequence(0, 32);
+    std::vector<uint8_t> nonce = fromHex("000000000000004a00000000");
+    std::vector<uint8_t> expected = fromHex(
+        "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+        "f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+        "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+        "5af90bbf74a35be6b40b8eedf2785e42874d");
+
+    std::vector<uint8_t> data(SUNSCREEN.begin(), SUNSCREEN.end());
+    ChaCha20Poly1305::chacha20(key.data(), 1, nonce.data(), data.data(), data.data(), data.size());
+    EXPECT_EQ(expected, data);
+}
+
+// RFC 8439 section 2.5.2
+TEST(EncryptionTest, Poly1305Rfc8439Vector) {
+    std::vector<uint8_t> key = fromHex("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b");
+    std::string message = "Cryptographic Forum Research Group";
+    uint8_t tag[16];
+    ChaCha20Poly1305::poly1305(key.data(), reinterpret_cast<const uint8_t*>(message.data()), message.size(), tag);
+    EXPECT_EQ(fromHex("a8061dc1305136c6c22b8baf0c0127a9"), std::vector<uint8_t>(tag, tag + 16));
+}
+
+// RFC 8439 section 2.8.2
+TEST(EncryptionTest, AeadRfc8439Vector) {
+    std::vector<uint8_t> key = sequence(0x80, 32);
+    std::vector<uint8_t> nonce = fromHex("070000004041424344454647");
+    std::vector<uint8_t> aad = fromHex("50515253c0c1c2c3c4c5c6c7");
+    std::vector<uint8_t> expected = fromHex(
+        "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+        "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+        "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+        "3ff4def08e4b7a9de576d26586cec64b6116");
+    std::vector<uint8_t> expected_tag = fromHex("1ae10b594f09e26a7e902ecbd0600691");
+
+    ChaCha20Poly1305 aead(key.data());
+    std::vector<uint8_t> data(SUNSCREEN.begin(), SUNSCREEN.end());
+    uint8_t tag[ChaCha20Poly1305::TAG_SIZE];
+    aead.seal(nonce.data(), aad.data(), aad.size(), data.data(), data.data(), data.size(), tag);
+    EXPECT_EQ(expected, data);
+    EXPECT_EQ(expected_tag, std::vector<uint8_t>(tag, tag + 16));
+
+    std::vector<uint8_t> plain(data.size());
+    ASSERT_TRUE(aead.open(nonce.data(), aad.data(), aad.size(), data.data(), plain.data(), data.size(), tag));
+    EXPECT_EQ(SUNSCREEN, std::string(plain.begin(), plain.end()));
+
+    // Any flipped bit in the ciphertext, the AAD or the tag is rejected and nothing is written
+    std::vector<uint8_t> untouched(plain.size(), 0xEE);
+    plain = untouched;
+    data[17] ^= 0x04;
+    EXPECT_FALSE(aead.open(nonce.data(), aad.data(), aad.size(), data.data(), plain.data(), data.size(), tag));
+    EXPECT_EQ(untouched, plain);
+    data[17] ^= 0x04;
+    aad[0] ^= 0x01;
+    EXPECT_FALSE(aead.open(nonce.data(), aad.data(), aad.size(), data.data(), plain.data(), data.size(), tag));
+    aad[0] ^= 0x01;
+    tag[15] ^= 0x80;
+    EXPECT_FALSE(aead.open(nonce.data(), aad.data(), aad.size(), data.data(), plain.data(), data.size(), tag));
+}
+
+TEST(EncryptionTest, WideKernelsMatchBlockByBlock) {
+    // Long runs go through the SIMD kernels, single blocks through the scalar path
+    std::vector<uint8_t> key = sequence(7, 32);
+    std::vector<uint8_t> nonce = sequence(100, 12);
+    std::vector<uint8_t> input(64 * 37 + 13);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<uint8_t>(i * 131 + 7);
+    }
+
+    std::vector<uint8_t> wide(input.size());
+    ChaCha20Poly1305::chacha20(key.data(), 5, nonce.data(), input.data(), wide.data(), input.size());
+
+    std::vector<uint8_t> scalar(input.size());
+    for (size_t offset = 0; offset < input.size(); offset += 64) {
+        size_t n = std::min<size_t>(64, input.size() - offset);
+        ChaCha20Poly1305::chacha20(key.data(), static_cast<uint32_t>(5 + offset / 64), nonce.data(),
+                                   input.data() + offset, scalar.data() + offset, n);
+    }
+    EXPECT_EQ(scalar, wide) << "implementation: " << ChaCha20Poly1305::implementation();
+}
+
+TEST(EncryptionTest, Sha256HmacHkdfVectors) {
+    uint8_t digest[Sha256::DIGEST_SIZE];
+    Sha256 hash;
+    hash.finish(digest);
+    EXPECT_EQ(fromHex("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"),
+              std::vector<uint8_t>(digest, digest + 32));
+
+    // Fed in uneven pieces across the block boundaries
+    std::string text = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    hash.reset();
+    for (size_t i = 0; i < text.size(); i += 7) {
+        hash.update(reinterpret_cast<const uint8_t*>(text.data()) + i, std::min<size_t>(7, text.size() - i));
+    }
+    hash.finish(digest);
+    EXPECT_EQ(fromHex("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"),
+              std::vector<uint8_t>(digest, digest + 32));
+
+    // RFC 4231 test case 2
+    std::string key = "Jefe";
+    std::string data = "what do ya want for nothing?";
+    hmacSha256(reinterpret_cast<const uint8_t*>(key.data()), key.size(),
+               reinterpret_cast<const uint8_t*>(data.data()), data.size(), digest);
+    EXPECT_EQ(fromHex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"),
+              std::vector<uint8_t>(digest, digest + 32));
+
+    // RFC 5869 test case 1
+    std::vector<uint8_t> ikm(22, 0x0b);
+    std::vector<uint8_t> salt = sequence(0, 13);
+    std::vector<uint8_t> info = sequence(0xf0, 10);
+    std::vector<uint8_t> okm(42);
+    ASSERT_TRUE(hkdfSha256(salt.data(), salt.size(), ikm.data(), ikm.size(), info.data(), info.size(),
+                           okm.data(), okm.size()));
+    EXPECT_EQ(fromHex("3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865"), okm);
+    std::vector<uint8_t> too_long(255 * 32 + 1);
+    EXPECT_FALSE(hkdfSha256(salt.data(), salt.size(), ikm.data(), ikm.size(), info.data(), info.size(),
+                            too_long.data(), too_long.size()));
+}
+
+// RFC 7748 sections 5.2 and 6.1
+TEST(EncryptionTest, X25519Rfc7748Vectors) {
+    uint8_t out[X25519_KEY_SIZE];
+    x25519(out, fromHex("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4").data(),
+           fromHex("e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c").data());
+    EXPECT_EQ(fromHex("c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552"),
+              std::vector<uint8_t>(out, out + 32));
+
+    x25519(out, fromHex("4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d").data(),
+           fromHex("e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493").data());
+    EXPECT_EQ(fromHex("95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957"),
+              std::vector<uint8_t>(out, out + 32));
+
+    // Iterated: k, u = x25519(k, u), k
+    std::vector<uint8_t> k(32, 0), u(32, 0);
+    k[0] = u[0] = 9;
+    for (int i = 0; i < 1000; ++i) {
+        x25519(out, k.data(), u.data());
+        u = k;
+        k.assign(out, out + 32);
+        if (i == 0) {
+            EXPECT_EQ(fromHex("422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079"), k);
+        }
+    }
+    EXPECT_EQ(fromHex("684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51"), k);
+
+    std::vector<uint8_t> alice = fromHex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+    std::vector<uint8_t> bob = fromHex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb");
+    uint8_t alice_public[32], bob_public[32], shared[32];
+    x25519PublicKey(alice_public, alice.data());
+    x25519PublicKey(bob_public, bob.data());
+    EXPECT_EQ(fromHex("8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a"),
+              std::vector<uint8_t>(alice_public, alice_public + 32));
+    EXPECT_EQ(fromHex("de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f"),
+              std::vector<uint8_t>(bob_public, bob_public + 32));
+    x25519(shared, alice.data(), bob_public);
+    EXPECT_EQ(fromHex("4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742"),
+              std::vector<uint8_t>(shared, shared + 32));
+}
+
+TEST(EncryptionTest, EphemeralKeyAgreement) {
+    EphemeralKeyAgreement terminal;
+    EphemeralKeyAgreement customer;
+    ASSERT_TRUE(terminal.valid());
+    ASSERT_TRUE(customer.valid());
+
+    std::string txn = "txn-88213";
+    const uint8_t* context = reinterpret_cast<const uint8_t*>(txn.data());
+    uint8_t terminal_key[ChaCha20Poly1305::KEY_SIZE], customer_key[ChaCha20Poly1305::KEY_SIZE];
+    ASSERT_TRUE(terminal.deriveKey(customer.publicKey(), context, txn.size(), terminal_key, sizeof(terminal_key)));
+    ASSERT_TRUE(customer.deriveKey(terminal.publicKey(), context, txn.size(), customer_key, sizeof(customer_key)));
+    EXPECT_EQ(std::vector<uint8_t>(terminal_key, terminal_key + 32), std::vector<uint8_t>(customer_key, customer_key + 32));
+
+    // Another transaction gets another key, and a low-order point is refused
+    std::string other = "txn-88214";
+    ASSERT_TRUE(customer.deriveKey(terminal.publicKey(), reinterpret_cast<const uint8_t*>(other.data()),
+                                   other.size(), customer_key, sizeof(customer_key)));
+    EXPECT_NE(std::vector<uint8_t>(terminal_key, terminal_key + 32), std::vector<uint8_t>(customer_key, customer_key + 32));
+    uint8_t zero_point[X25519_KEY_SIZE] = {};
+    EXPECT_FALSE(customer.deriveKey(zero_point, context, txn.size(), customer_key, sizeof(customer_key)));
+}
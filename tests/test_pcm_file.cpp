@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+#include "../include/riif_ultrasonic.h"
+#include "pcm_file.h"
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <random>
+
+namespace {
+
+std::vector<bool> randomBits(size_t count, unsigned seed)
+{
+    std::vector<bool> bits(count);
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<> dis(0, 1);
+    for (size_t i = 0; i < count; ++i) {
+        bits[i] = dis(gen) == 1;
+    }
+    return bits;
+}
+
+std::vector<int16_t> modulate(const RiifUltrasonic::Parameters& params, const std::vector<bool>& bits)
+{
+    std::vector<int16_t> audio_samples;
+    double phase = 0.0;
+    for (bool bit : bits) {
+        double frequency = bit ? params.f0 + params.df : params.f0;
+        for (int i = 0; i < params.samplesPerFrame; ++i) {
+            phase += 2 * M_PI * frequency / params.sampleRate;
+            audio_samples.push_back(static_cast<int16_t>(0.5 * std::sin(phase) * 32767));
+        }
+    }
+    return audio_samples;
+}
+
+} // namespace
+
+TEST(PcmFileTest, MonoWavRoundTripDecodesInPlace) {
+    RiifUltrasonic riif;
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    std::vector<bool> bits = randomBits(300, 11);
+    std::vector<int16_t> audio_samples = modulate(params, bits);
+
+    std::string path = ::testing::TempDir() + "riif_mono.wav";
+    PcmFormat format;
+    format.sampleRate = params.sampleRate;
+    PcmFileWriter writer;
+    ASSERT_TRUE(writer.open(path, format));
+    // Written in uneven pieces, as an output callback would
+    for (size_t i = 0; i < audio_samples.size(); i += 1000) {
+        ASSERT_TRUE(writer.write(audio_samples.data() + i, std::min<size_t>(1000, audio_samples.size() - i)));
+    }
+    ASSERT_TRUE(writer.close());
+
+    PcmFileReader reader;
+    ASSERT_TRUE(reader.open(path));
+    EXPECT_EQ(params.sampleRate, reader.format().sampleRate);
+    EXPECT_EQ(1, reader.format().channels);
+    ASSERT_EQ(audio_samples.size(), reader.frameCount());
+    ASSERT_NE(nullptr, reader.samples()) << "Mono 16-bit data should be usable in place";
+    EXPECT_EQ(0, std::memcmp(audio_samples.data(), reader.samples(), audio_samples.size() * sizeof(int16_t)));
+
+    std::vector<bool> expected = riif.decode(audio_samples);
+    std::vector<bool> decoded = decodePcmFile(riif, reader);
+    EXPECT_EQ(expected, decoded);
+    ASSERT_GE(decoded.size(), bits.size());
+    EXPECT_TRUE(std::equal(bits.begin(), bits.end(), decoded.begin()));
+
+    reader.close();
+    std::remove(path.c_str());
+}
+
+TEST(PcmFileTest, StereoChannelIsSelected) {
+    RiifUltrasonic riif;
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    std::vector<bool> bits = randomBits(200, 5);
+    std::vector<int16_t> audio_samples = modulate(params, bits);
+
+    // Left channel silent, the transmission on the right
+    std::vector<int16_t> interleaved(audio_samples.size() * 2, 0);
+    for (size_t i = 0; i < audio_samples.size(); ++i) {
+        interleaved[2 * i + 1] = audio_samples[i];
+    }
+
+    std::string path = ::testing::TempDir() + "riif_stereo.wav";
+    PcmFormat format;
+    format.channels = 2;
+    PcmFileWriter writer;
+    ASSERT_TRUE(writer.open(path, format));
+    ASSERT_TRUE(writer.write(interleaved.data(), interleaved.size()));
+    ASSERT_TRUE(writer.close());
+
+    PcmFileReader reader;
+    ASSERT_TRUE(reader.open(path));
+    EXPECT_EQ(2, reader.format().channels);
+    EXPECT_EQ(nullptr, reader.samples());
+
+    std::vector<bool> decoded = decodePcmFile(riif, reader, 1);
+    EXPECT_EQ(riif.decode(audio_samples), decoded);
+    EXPECT_TRUE(decodePcmFile(riif, reader, 2).empty());
+
+    reader.close();
+    std::remove(path.c_str());
+}
+
+TEST(PcmFileTest, ParsesExtensible24BitWithExtraChunks) {
+    // Hand-built file: WAVE_FORMAT_EXTENSIBLE, 24-bit stereo, a LIST chunk of odd length
+    // before the data
+    std::vector<uint8_t> file;
+    auto put = [&](const void* p, size_t n) {
+        const uint8_t* b = static_cast<const uint8_t*>(p);
+        file.insert(file.end(), b, b + n);
+    };
+    auto put16 = [&](uint16_t v) { uint8_t b[2] = {uint8_t(v), uint8_t(v >> 8)}; put(b, 2); };
+    auto put32 = [&](uint32_t v) { uint8_t b[4] = {uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)}; put(b, 4); };
+
+    const int32_t left[3] = {0x123456, -0x200000, 0x7FFFFF};
+    const int32_t right[3] = {-1, 0x010000, -0x800000};
+
+    put("RIFF", 4); put32(0); put("WAVE", 4);
+    put("fmt ", 4); put32(40);
+    put16(0xFFFE); put16(2); put32(44100); put32(44100 * 6); put16(6); put16(24);
+    put16(22); put16(24); put32(3);
+    put16(0x0001); put16(0x0000); put32(0x00100000); put32(0xAA000080); put32(0x719B3800);
+    put("LIST", 4); put32(3); put("abc", 3); put("\0", 1);
+    put("data", 4); put32(3 * 6);
+    for (int i = 0; i < 3; ++i) {
+        uint8_t l[3] = {uint8_t(left[i]), uint8_t(left[i] >> 8), uint8_t(left[i] >> 16)};
+        uint8_t r[3] = {uint8_t(right[i]), uint8_t(right[i] >> 8), uint8_t(right[i] >> 16)};
+        put(l, 3);
+        put(r, 3);
+    }
+
+    std::string path = ::testing::TempDir() + "riif_24bit.wav";
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    ASSERT_NE(nullptr, f);
+    std::fwrite(file.data(), 1, file.size(), f);
+    std::fclose(f);
+
+    PcmFileReader reader;
+    ASSERT_TRUE(reader.open(path));
+    EXPECT_EQ(44100, reader.format().sampleRate);
+    EXPECT_EQ(2, reader.format().channels);
+    EXPECT_EQ(24, reader.format().bitsPerSample);
+    ASSERT_EQ(3u, reader.frameCount());
+
+    int16_t out[3];
+    ASSERT_EQ(3u, reader.read(0, 3, out, 0));
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(static_cast<int16_t>(left[i] >> 8), out[i]);
+    }
+    ASSERT_EQ(2u, reader.read(1, 10, out, 1));
+    EXPECT_EQ(static_cast<int16_t>(right[1] >> 8), out[0]);
+    EXPECT_EQ(static_cast<int16_t>(right[2] >> 8), out[1]);
+
+    reader.close();
+
+    // The same bytes opened as raw PCM past the header
+    PcmFormat raw;
+    raw.sampleRate = 44100;
+    raw.channels = 2;
+    raw.bitsPerSample = 24;
+    ASSERT_TRUE(reader.openRaw(path, raw, file.size() - 18));
+    ASSERT_EQ(3u, reader.frameCount());
+    ASSERT_EQ(1u, reader.read(2, 1, out, 0));
+    EXPECT_EQ(static_cast<int16_t>(left[2] >> 8), out[0]);
+
+    reader.close();
+    std::remove(path.c_str());
+}
+
+TEST(PcmFileTest, RejectsMissingAndMalformedFiles) {
+    PcmFileReader reader;
+    EXPECT_FALSE(reader.open(::testing::TempDir() + "riif_does_not_exist.wav"));
+
+    std::string path = ::testing::TempDir() + "riif_not_a_wav.wav";
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    ASSERT_NE(nullptr, f);
+    std::fputs("RIFF....JUNKnothing to see here", f);
+    std::fclose(f);
+    EXPECT_FALSE(reader.open(path));
+    EXPECT_FALSE(reader.isOpen());
+    std::remove(path.c_str());
+}
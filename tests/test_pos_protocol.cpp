@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+#include "pos_protocol.h"
+#include "../include/riif_ultrasonic.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+TEST(PosProtocolTest, RoundTripPointsIntoBuffer) {
+    uint8_t key[POS_PUBLIC_KEY_SIZE];
+    for (size_t i = 0; i < sizeof(key); ++i) {
+        key[i] = static_cast<uint8_t>(0xA0 + i);
+    }
+
+    PosMessage message;
+    message.transactionId = 88213;
+    message.hasAmount = true;
+    message.amount = 1250;
+    std::copy_n("USD", 4, message.currency);
+    message.flags = 0x05;
+    message.publicKey = key;
+
+    // 2 header bytes, 3 + 2 varint bytes, 2 currency bytes and the key
+    uint8_t buffer[64];
+    size_t size = serializePosMessage(message, buffer, sizeof(buffer));
+    EXPECT_EQ(2u + 3 + 2 + 2 + POS_PUBLIC_KEY_SIZE, size);
+    EXPECT_EQ(size, posMessageSize(message));
+    EXPECT_EQ(0u, serializePosMessage(message, buffer, size - 1));
+
+    PosMessage parsed;
+    ASSERT_EQ(size, parsePosMessage(buffer, sizeof(buffer), parsed));
+    EXPECT_EQ(88213u, parsed.transactionId);
+    EXPECT_TRUE(parsed.hasAmount);
+    EXPECT_EQ(1250u, parsed.amount);
+    EXPECT_STREQ("USD", parsed.currency);
+    EXPECT_EQ(0x05, parsed.flags);
+    ASSERT_EQ(buffer + size - POS_PUBLIC_KEY_SIZE, parsed.publicKey);
+    EXPECT_TRUE(std::equal(key, key + sizeof(key), parsed.publicKey));
+
+    // The smallest message is a transaction ID alone
+    PosMessage bare;
+    bare.transactionId = 7;
+    EXPECT_EQ(3u, serializePosMessage(bare, buffer, sizeof(buffer)));
+    ASSERT_EQ(3u, parsePosMessage(buffer, 3, parsed));
+    EXPECT_EQ(7u, parsed.transactionId);
+    EXPECT_FALSE(parsed.hasAmount);
+    EXPECT_EQ('\0', parsed.currency[0]);
+    EXPECT_EQ(nullptr, parsed.publicKey);
+
+    message.transactionId = UINT64_MAX;
+    size = serializePosMessage(message, buffer, sizeof(buffer));
+    ASSERT_EQ(size, parsePosMessage(buffer, size, parsed));
+    EXPECT_EQ(UINT64_MAX, parsed.transactionId);
+}
+
+TEST(PosProtocolTest, RejectsMalformedMessages) {
+    PosMessage message;
+    message.transactionId = 300;
+    message.hasAmount = true;
+    message.amount = 99;
+    uint8_t buffer[16];
+    size_t size = serializePosMessage(message, buffer, sizeof(buffer));
+    ASSERT_GT(size, 0u);
+
+    PosMessage parsed;
+    for (size_t n = 0; n < size; ++n) {
+        EXPECT_EQ(0u, parsePosMessage(buffer, n, parsed)) << "truncated to " << n;
+    }
+
+    std::vector<uint8_t> wrong_version(buffer, buffer + size);
+    wrong_version[0] = POS_PROTOCOL_VERSION + 1;
+    EXPECT_EQ(0u, parsePosMessage(wrong_version.data(), wrong_version.size(), parsed));
+
+    // Overlong varint for 1 (0x81 0x00) and an 11-byte varint
+    const uint8_t overlong[] = {POS_PROTOCOL_VERSION, 0x00, 0x81, 0x00};
+    EXPECT_EQ(0u, parsePosMessage(overlong, sizeof(overlong), parsed));
+    std::vector<uint8_t> too_long = {POS_PROTOCOL_VERSION, 0x00};
+    too_long.insert(too_long.end(), 10, 0xFF);
+    too_long.push_back(0x01);
+    EXPECT_EQ(0u, parsePosMessage(too_long.data(), too_long.size(), parsed));
+
+    // Fields that cannot be represented are refused on the way out
+    message.flags = POS_MAX_FLAGS + 1;
+    EXPECT_EQ(0u, serializePosMessage(message, buffer, sizeof(buffer)));
+    message.flags = 0;
+    std::copy_n("us", 3, message.currency);
+    EXPECT_EQ(0u, serializePosMessage(message, buffer, sizeof(buffer)));
+}
+
+TEST(PosProtocolTest, ParsesDecodedCodecBlock) {
+    RiifUltrasonic riif;
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    uint8_t key[POS_PUBLIC_KEY_SIZE] = {1, 2, 3, 4};
+    PosMessage message;
+    message.transactionId = 4102;
+    message.publicKey = key;
+    uint8_t buffer[64];
+    size_t size = serializePosMessage(message, buffer, sizeof(buffer));
+    ASSERT_GT(size, 0u);
+
+    std::vector<bool> bits = riif.decode(riif.encode(std::string(buffer, buffer + size)));
+    ASSERT_GE(bits.size(), static_cast<size_t>(params.rsMsgLength) * 8);
+    std::vector<uint8_t> block(params.rsMsgLength);
+    for (size_t i = 0; i < block.size(); ++i) {
+        for (int b = 0; b < 8; ++b) {
+            block[i] = static_cast<uint8_t>((block[i] << 1) | (bits[i * 8 + b] ? 1 : 0));
+        }
+    }
+
+    // The block is zero padded behind the message; the parser stops where the message ends
+    PosMessage parsed;
+    ASSERT_EQ(size, parsePosMessage(block.data(), block.size(), parsed));
+    EXPECT_EQ(4102u, parsed.transactionId);
+    ASSERT_NE(nullptr, parsed.publicKey);
+    EXPECT_TRUE(std::equal(key, key + sizeof(key), parsed.publicKey));
+}
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include "rs.hpp"
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+
+TEST(ReedSolomonTest, BatchedEvaluationMatchesHorner) {
+    uint8_t storage[64];
+    uint8_t* memory = storage;
+    RS::Poly poly;
+    poly.Init(0, 0, sizeof(storage), &memory);
+
+    std::mt19937 gen(43);
+    std::uniform_int_distribution<> byte(0, 255);
+    for (uint8_t length : {1, 2, 9, 17, 33, 64}) {
+        std::vector<uint8_t> coefs(length);
+        for (uint8_t& c : coefs) {
+            c = static_cast<uint8_t>(byte(gen));
+        }
+        coefs[length / 2] = 0;
+        poly.Set(coefs.data(), length);
+
+        // Counts off the vector width exercise the scalar tail
+        for (size_t count : {size_t(5), size_t(16), size_t(223), size_t(255)}) {
+            std::vector<uint8_t> batched(count);
+            RS::gf::poly_eval_powers(&poly, batched.data(), count);
+            for (size_t i = 0; i < count; ++i) {
+                ASSERT_EQ(static_cast<uint8_t>(RS::gf::poly_eval(&poly, RS::gf::exp[i])), batched[i])
+                    << "length " << int(length) << ", position " << i
+                    << ", implementation: " << RS::gf::poly_eval_implementation();
+            }
+        }
+    }
+}
+
+TEST(ReedSolomonTest, CorrectsUpToHalfTheParity) {
+    const uint8_t msg_length = 223;
+    const uint8_t ecc_length = 32;
+    RS::ReedSolomon rs(msg_length, ecc_length);
+
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<> byte(0, 255);
+    std::vector<uint8_t> message(msg_length), codeword(msg_length + ecc_length), decoded(msg_length);
+    std::vector<size_t> positions(codeword.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        positions[i] = i;
+    }
+
+    // Error counts on both sides of the batched Forney threshold, up to the limit
+    for (size_t errors : {size_t(0), size_t(1), size_t(5), size_t(8), size_t(12), size_t(16)}) {
+        for (int trial = 0; trial < 20; ++trial) {
+            for (uint8_t& b : message) {
+                b = static_cast<uint8_t>(byte(gen));
+            }
+            rs.Encode(message.data(), codeword.data());
+            std::shuffle(positions.begin(), positions.end(), gen);
+            for (size_t e = 0; e < errors; ++e) {
+                codeword[positions[e]] ^= static_cast<uint8_t>(1 + byte(gen) % 255);
+            }
+
+            std::fill(decoded.begin(), decoded.end(), 0);
+            ASSERT_EQ(0, rs.Decode(codeword.data(), decoded.data())) << errors << " errors";
+            ASSERT_EQ(message, decoded) << errors << " errors";
+
+            // Streamed syndromes give the same result
+            rs.BeginSyndromes();
+            for (uint8_t b : codeword) {
+                rs.PushSyndromes(b);
+            }
+            EXPECT_EQ(errors == 0, rs.SyndromesClean());
+            std::fill(decoded.begin(), decoded.end(), 0);
+            ASSERT_EQ(0, rs.DecodeStreamed(codeword.data(), decoded.data()));
+            ASSERT_EQ(message, decoded) << errors << " errors, streamed";
+        }
+    }
+}
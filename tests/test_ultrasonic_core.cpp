@@ -1,11 +1,52 @@
 #include <gtest/gtest.h>
 #include "../include/riif_ultrasonic.h"
+#include "../include/riif_ultrasonic_t.h"
+#include "encryption/encryption.h"
+#include "core/trace.h"
 #include <vector>
 #include <cstdint>
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <random>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <sstream>
+#include <chrono>
+#include <stdexcept>
+
+// Ooura real FFT, compiled into riif_ultrasonic
+void rdft(int n, int isgn, float *a, int *ip, float *w);
+
+// Heap calls are counted while g_count_allocations is set
+namespace {
+std::atomic<bool> g_count_allocations(false);
+std::atomic<size_t> g_allocations(0);
+}
+
+void* operator new(std::size_t size)
+{
+    if (g_count_allocations) {
+        ++g_allocations;
+    }
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
 
 class RiifUltrasonicCoreTest : public ::testing::Test {
 protected:
@@ -161,3 +202,1053 @@ TEST(RiifUltrasonicCoreTest, LongerBitPatternTest) {
     // We'll allow a small error rate (e.g., 5%) for now
     EXPECT_LT(bit_error_rate, 0.05) << "Bit error rate too high";
 }
+
+TEST(RiifUltrasonicCoreTest, MisalignedBitPatternTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.f0 = 15000.0f;
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    std::vector<bool> bits(96);
+    std::mt19937 gen(1234);
+    std::uniform_int_distribution<> dis(0, 1);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        bits[i] = dis(gen) == 1;
+    }
+
+    // Start the first symbol 3/8 of a frame in, so a grid aligned to sample 0 straddles every symbol
+    std::vector<int16_t> audio_samples(params.samplesPerFrame * 3 / 8, 0);
+    for (bool bit : bits) {
+        float frequency = bit ? params.f0 + params.df : params.f0;
+        for (int i = 0; i < params.samplesPerFrame; ++i) {
+            float t = static_cast<float>(i) / params.sampleRate;
+            audio_samples.push_back(static_cast<int16_t>(std::sin(2 * M_PI * frequency * t) * 32767));
+        }
+    }
+
+    std::vector<bool> decoded_bits = riif.decode(audio_samples);
+
+    ASSERT_EQ(bits.size(), decoded_bits.size()) << "Mismatch in number of decoded bits";
+    int mismatches = 0;
+    for (size_t i = 0; i < bits.size(); ++i) {
+        if (bits[i] != decoded_bits[i]) {
+            mismatches++;
+        }
+    }
+    std::cout << "Misaligned bit errors: " << mismatches << std::endl;
+    EXPECT_EQ(0, mismatches) << "Bits straddling frame boundaries were not recovered";
+}
+
+TEST(RiifUltrasonicCoreTest, NarrowbandInterfererTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.f0 = 15000.0f;
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    std::vector<bool> bits(256);
+    std::mt19937 gen(99);
+    std::uniform_int_distribution<> dis(0, 1);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        bits[i] = dis(gen) == 1;
+    }
+
+    // A motion sensor sitting on the "0" tone, almost as loud as the signal itself
+    const float signal_level = 0.5f;
+    const float interferer_level = 0.45f;
+    std::vector<int16_t> audio_samples;
+    size_t n = 0;
+    for (bool bit : bits) {
+        float frequency = bit ? params.f0 + params.df : params.f0;
+        for (int i = 0; i < params.samplesPerFrame; ++i, ++n) {
+            float t = static_cast<float>(i) / params.sampleRate;
+            float interferer = std::sin(2 * M_PI * params.f0 * n / params.sampleRate + 1.0);
+            float sample = signal_level * std::sin(2 * M_PI * frequency * t) + interferer_level * interferer;
+            audio_samples.push_back(static_cast<int16_t>(sample * 32767));
+        }
+    }
+
+    std::vector<bool> decoded_bits = riif.decode(audio_samples);
+
+    ASSERT_EQ(bits.size(), decoded_bits.size()) << "Mismatch in number of decoded bits";
+    int mismatches = 0;
+    for (size_t i = 0; i < bits.size(); ++i) {
+        if (bits[i] != decoded_bits[i]) {
+            mismatches++;
+        }
+    }
+    double bit_error_rate = static_cast<double>(mismatches) / bits.size();
+    std::cout << "Bit Error Rate with interferer: " << (bit_error_rate * 100) << "%" << std::endl;
+    EXPECT_LT(bit_error_rate, 0.05) << "Noise floor did not adapt to the interferer";
+}
+
+TEST(RiifUltrasonicCoreTest, SampleClockDriftTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.f0 = 15000.0f;
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    std::vector<bool> bits(400);
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<> dis(0, 1);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        bits[i] = dis(gen) == 1;
+    }
+
+    // The transmitter clock runs 2000 ppm slow, so by the end the nominal grid is most of a symbol off
+    const double symbol_length = params.samplesPerFrame * 1.002;
+    size_t total = static_cast<size_t>(bits.size() * symbol_length);
+    std::vector<int16_t> audio_samples(total);
+    for (size_t n = 0; n < total; ++n) {
+        size_t symbol = std::min(static_cast<size_t>(n / symbol_length), bits.size() - 1);
+        float frequency = bits[symbol] ? params.f0 + params.df : params.f0;
+        float sample = std::sin(2 * M_PI * frequency * n / params.sampleRate);
+        audio_samples[n] = static_cast<int16_t>(sample * 32767);
+    }
+
+    std::vector<bool> decoded_bits = riif.decode(audio_samples);
+
+    ASSERT_GE(decoded_bits.size(), bits.size()) << "Timing loop lost symbols";
+    int mismatches = 0;
+    for (size_t i = 0; i < bits.size(); ++i) {
+        if (bits[i] != decoded_bits[i]) {
+            mismatches++;
+        }
+    }
+    double bit_error_rate = static_cast<double>(mismatches) / bits.size();
+    std::cout << "Bit Error Rate with clock drift: " << (bit_error_rate * 100) << "%" << std::endl;
+    EXPECT_LT(bit_error_rate, 0.01) << "Timing recovery did not follow the drift";
+}
+
+TEST(RiifUltrasonicCoreTest, CarrierFrequencyOffsetTest) {
+    RiifUltrasonic riif;
+
+    // Tones two analysis bins apart, the closest spacing the frame length resolves
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.f0 = 15000.0f;
+    params.df = 187.5f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    std::vector<bool> bits(256);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, 1);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        bits[i] = dis(gen) == 1;
+    }
+
+    // Both tones arrive 85 Hz high (Doppler plus resampler error), with some background noise
+    const double offset = 85.0;
+    std::normal_distribution<float> noise(0.0f, 0.3f);
+    std::vector<int16_t> audio_samples;
+    size_t n = 0;
+    for (bool bit : bits) {
+        double frequency = (bit ? params.f0 + params.df : params.f0) + offset;
+        for (int i = 0; i < params.samplesPerFrame; ++i, ++n) {
+            float sample = 0.6f * std::sin(2 * M_PI * frequency * n / params.sampleRate) + noise(gen);
+            audio_samples.push_back(static_cast<int16_t>(std::max(-1.0f, std::min(1.0f, sample)) * 32767));
+        }
+    }
+
+    std::vector<bool> decoded_bits = riif.decode(audio_samples);
+
+    std::cout << "Estimated frequency offset: " << riif.getFrequencyOffset() << " Hz" << std::endl;
+    EXPECT_NEAR(offset, riif.getFrequencyOffset(), 10.0);
+
+    ASSERT_GE(decoded_bits.size(), bits.size());
+    int mismatches = 0;
+    for (size_t i = 0; i < bits.size(); ++i) {
+        if (bits[i] != decoded_bits[i]) {
+            mismatches++;
+        }
+    }
+    double bit_error_rate = static_cast<double>(mismatches) / bits.size();
+    std::cout << "Bit Error Rate with frequency offset: " << (bit_error_rate * 100) << "%" << std::endl;
+    EXPECT_LT(bit_error_rate, 0.01) << "Tone bins were not compensated for the offset";
+}
+
+TEST(RiifUltrasonicCoreTest, RetunedBandOutOfBandToneTest) {
+    RiifUltrasonic riif;
+
+    // A different tone plan and symbol length: the front end has to follow it
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.f0 = 17500.0f;
+    params.df = 375.0f;
+    params.samplesPerFrame = 480;
+    riif.setParameters(params);
+
+    std::vector<bool> bits(200);
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<> dis(0, 1);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        bits[i] = dis(gen) == 1;
+    }
+
+    // A louder tone sweeping 21-24 kHz. One decimated sample rate below, that range covers
+    // both tones, so it would fold onto them if the band were not filtered before decimation
+    const double sweep_start = 21000.0;
+    const double sweep_rate = 6000.0;  // Hz per second, repeating every half second
+    double sweep_phase = 0.0;
+    std::vector<int16_t> audio_samples;
+    size_t n = 0;
+    for (bool bit : bits) {
+        double frequency = bit ? params.f0 + params.df : params.f0;
+        for (int i = 0; i < params.samplesPerFrame; ++i, ++n) {
+            double t = static_cast<double>(n) / params.sampleRate;
+            double sweep = sweep_start + sweep_rate * std::fmod(t, 0.5);
+            sweep_phase += 2 * M_PI * sweep / params.sampleRate;
+            float sample = 0.3f * std::sin(2 * M_PI * frequency * t) + 0.6f * std::sin(sweep_phase);
+            audio_samples.push_back(static_cast<int16_t>(sample * 32767));
+        }
+    }
+
+    std::vector<bool> decoded_bits = riif.decode(audio_samples);
+
+    ASSERT_GE(decoded_bits.size(), bits.size());
+    int mismatches = 0;
+    for (size_t i = 0; i < bits.size(); ++i) {
+        if (bits[i] != decoded_bits[i]) {
+            mismatches++;
+        }
+    }
+    double bit_error_rate = static_cast<double>(mismatches) / bits.size();
+    std::cout << "Bit Error Rate with out-of-band tone: " << (bit_error_rate * 100) << "%" << std::endl;
+    EXPECT_EQ(0, mismatches) << "Out-of-band energy leaked into the decimated band";
+}
+
+TEST(RiifUltrasonicCoreTest, CaptureRateTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.f0 = 15000.0f;
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    std::vector<bool> bits(128);
+    std::mt19937 gen(3);
+    std::uniform_int_distribution<> dis(0, 1);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        bits[i] = dis(gen) == 1;
+    }
+
+    // The same transmission as captured by devices running at other rates; a symbol no longer
+    // spans a whole number of samples
+    for (int capture_rate : {44100, 96000}) {
+        double symbol_duration = static_cast<double>(params.samplesPerFrame) / params.sampleRate;
+        size_t total = static_cast<size_t>(bits.size() * symbol_duration * capture_rate);
+        std::vector<int16_t> audio_samples;
+        double phase = 0.0;
+        for (size_t n = 0; n < total; ++n) {
+            size_t symbol = static_cast<size_t>(n / (symbol_duration * capture_rate));
+            double frequency = bits[std::min(symbol, bits.size() - 1)] ? params.f0 + params.df : params.f0;
+            phase += 2 * M_PI * frequency / capture_rate;
+            audio_samples.push_back(static_cast<int16_t>(0.5 * std::sin(phase) * 32767));
+        }
+
+        std::vector<bool> decoded_bits = riif.decode(audio_samples, capture_rate);
+
+        ASSERT_GE(decoded_bits.size(), bits.size()) << "at " << capture_rate << " Hz";
+        int mismatches = 0;
+        for (size_t i = 0; i < bits.size(); ++i) {
+            if (bits[i] != decoded_bits[i]) {
+                mismatches++;
+            }
+        }
+        std::cout << "Mismatches at " << capture_rate << " Hz: " << mismatches << std::endl;
+        EXPECT_EQ(0, mismatches) << "at " << capture_rate << " Hz";
+    }
+
+    // 16 kHz cannot represent the tones at all
+    std::vector<int16_t> low_rate(16000, 0);
+    EXPECT_TRUE(riif.decode(low_rate, 16000).empty());
+
+    // Back at the native rate after a foreign capture
+    std::vector<int16_t> native;
+    double phase = 0.0;
+    for (bool bit : bits) {
+        double frequency = bit ? params.f0 + params.df : params.f0;
+        for (int i = 0; i < params.samplesPerFrame; ++i) {
+            phase += 2 * M_PI * frequency / params.sampleRate;
+            native.push_back(static_cast<int16_t>(0.5 * std::sin(phase) * 32767));
+        }
+    }
+    std::vector<bool> decoded_native = riif.decode(native);
+    ASSERT_GE(decoded_native.size(), bits.size());
+    EXPECT_TRUE(std::equal(bits.begin(), bits.end(), decoded_native.begin()));
+}
+
+TEST(RiifUltrasonicCoreTest, StreamingReceiveTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.f0 = 15000.0f;
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    // Long enough for the receiver to slide its buffers several times
+    std::vector<bool> bits(600);
+    std::mt19937 gen(21);
+    std::uniform_int_distribution<> dis(0, 1);
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        bits[i] = dis(gen) == 1;
+    }
+    std::vector<int16_t> audio_samples;
+    size_t n = 0;
+    for (bool bit : bits) {
+        double frequency = bit ? params.f0 + params.df : params.f0;
+        for (int i = 0; i < params.samplesPerFrame; ++i, ++n) {
+            float sample = 0.5f * std::sin(2 * M_PI * frequency * n / params.sampleRate) + noise(gen);
+            audio_samples.push_back(static_cast<int16_t>(sample * 32767));
+        }
+    }
+
+    std::vector<bool> whole = riif.decode(audio_samples);
+
+    // Blocks of an awkward size: bits must come out as the stream goes, and match the one-shot decode
+    std::vector<bool> streamed;
+    ASSERT_TRUE(riif.beginReceive(params.sampleRate));
+    const size_t block = 777;
+    size_t before_end = 0;
+    for (size_t i = 0; i < audio_samples.size(); i += block) {
+        riif.receive(audio_samples.data() + i, std::min(block, audio_samples.size() - i), streamed);
+        if (i < audio_samples.size() / 2) {
+            before_end = streamed.size();
+        }
+    }
+    riif.endReceive(streamed);
+
+    EXPECT_GT(before_end, bits.size() / 4) << "Bits were held back until the end of the stream";
+    EXPECT_EQ(whole, streamed);
+    ASSERT_GE(streamed.size(), bits.size());
+    EXPECT_TRUE(std::equal(bits.begin(), bits.end(), streamed.begin()));
+}
+
+TEST(RiifUltrasonicCoreTest, PullEncoderTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.samplesPerFrame = 480;
+    params.preambleDuration = 1000;
+    riif.setParameters(params);
+
+    std::string message = "Pay 12.50 to stall 7";
+    std::vector<int16_t> whole = riif.encode(message);
+    ASSERT_EQ(static_cast<size_t>(params.samplesPerFrame) * ((params.rsMsgLength + params.rsEccLength) * 8 + 2), whole.size());
+
+    // An output callback asking for blocks that do not line up with the symbols
+    ASSERT_TRUE(riif.prepare(message));
+    EXPECT_EQ(whole.size(), riif.pendingFrames());
+    std::vector<int16_t> streamed;
+    int16_t block[333];
+    size_t n;
+    while ((n = riif.render(block, 333)) > 0) {
+        streamed.insert(streamed.end(), block, block + n);
+        EXPECT_EQ(whole.size() - streamed.size(), riif.pendingFrames());
+    }
+    EXPECT_EQ(whole, streamed);
+    EXPECT_EQ(0u, riif.render(block, 333));
+
+    // Without a configured codec there is nothing to send
+    RiifUltrasonic unconfigured;
+    EXPECT_FALSE(unconfigured.prepare(message));
+    EXPECT_TRUE(unconfigured.encode(message).empty());
+}
+
+TEST(RiifUltrasonicCoreTest, EncodeDecodeRoundTripTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    // The code is systematic, so the codeword starts with the zero-padded message
+    std::string message = "Store beacon: lane 4 open";
+    std::vector<int16_t> signal = riif.encode(message);
+    std::vector<bool> decoded_bits = riif.decode(signal);
+
+    ASSERT_GE(decoded_bits.size(), static_cast<size_t>(params.rsMsgLength) * 8);
+    int mismatches = 0;
+    for (int byte = 0; byte < params.rsMsgLength; ++byte) {
+        uint8_t expected = byte < static_cast<int>(message.size()) ? message[byte] : 0;
+        for (int i = 0; i < 8; ++i) {
+            if (decoded_bits[byte * 8 + i] != (((expected >> (7 - i)) & 1) != 0)) {
+                mismatches++;
+            }
+        }
+    }
+    EXPECT_EQ(0, mismatches);
+
+    // A repeat comes back from the waveform cache unchanged; new parameters invalidate it
+    EXPECT_EQ(signal, riif.encode(message));
+    params.samplesPerFrame = 480;
+    riif.setParameters(params);
+    EXPECT_EQ(static_cast<size_t>(480) * (params.rsMsgLength + params.rsEccLength) * 8, riif.encode(message).size());
+}
+
+TEST(RiifUltrasonicCoreTest, EncodeBatchTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.samplesPerFrame = 480;
+    riif.setParameters(params);
+
+    std::vector<std::string> messages;
+    for (int lane = 0; lane < 12; ++lane) {
+        messages.push_back("lane " + std::to_string(lane) + " total " + std::to_string(lane * 317 % 1000));
+    }
+    messages.push_back(std::string(300, 'z'));  // longer than a codeword, truncated like encode()
+    messages.push_back("");
+
+    RiifUltrasonic::EncodedBatch batch = riif.encodeBatch(messages);
+    ASSERT_EQ(messages.size() + 1, batch.offsets.size());
+    EXPECT_EQ(batch.samples.size(), batch.offsets.back());
+    for (size_t i = 0; i < messages.size(); ++i) {
+        std::vector<int16_t> expected = riif.encode(messages[i]);
+        ASSERT_EQ(expected.size(), batch.offsets[i + 1] - batch.offsets[i]) << "message " << i;
+        EXPECT_TRUE(std::equal(expected.begin(), expected.end(), batch.samples.begin() + batch.offsets[i]))
+            << "message " << i;
+    }
+
+    EXPECT_TRUE(riif.encodeBatch(std::vector<std::string>()).samples.empty());
+}
+
+TEST(RiifUltrasonicCoreTest, ThreadPoolTest) {
+    ThreadPool pool(3);
+    ASSERT_EQ(4u, pool.workerCount());
+
+    // Every index exactly once, from valid workers, across repeated loops
+    for (int round = 0; round < 20; ++round) {
+        std::vector<std::atomic<int>> hits(1000);
+        std::atomic<bool> bad_worker(false);
+        pool.parallelFor(hits.size(), [&](size_t worker, size_t index) {
+            if (worker >= pool.workerCount()) {
+                bad_worker = true;
+            }
+            hits[index]++;
+        });
+        EXPECT_FALSE(bad_worker);
+        for (size_t i = 0; i < hits.size(); ++i) {
+            ASSERT_EQ(1, hits[i].load()) << "index " << i << " in round " << round;
+        }
+    }
+    pool.parallelFor(0, [](size_t, size_t) { FAIL(); });
+
+    // A throw reaches the caller only after the workers have left fn, from whichever thread
+    // it came, and the pool stays usable
+    for (size_t thrower = 0; thrower < 2; ++thrower) {
+        std::atomic<int> running(0);
+        std::atomic<bool> thrown(false);
+        EXPECT_THROW(pool.parallelFor(64, [&](size_t worker, size_t) {
+            running++;
+            if ((thrower == 0) == (worker == 0) && !thrown.exchange(true)) {
+                running--;
+                throw std::runtime_error("index failed");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            running--;
+        }), std::runtime_error);
+        EXPECT_EQ(0, running.load()) << "parallelFor returned with fn still running";
+    }
+    std::atomic<int> sum(0);
+    pool.parallelFor(10, [&](size_t, size_t index) { sum += static_cast<int>(index); });
+    EXPECT_EQ(45, sum.load());
+}
+
+TEST(RiifUltrasonicCoreTest, SteadyStateAllocationTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    std::string message = "Receipt 0042";
+    std::vector<int16_t> signal = riif.encode(message);
+
+    // One transaction: render the reply into a fixed block and receive a capture into a
+    // caller-reserved bit buffer
+    std::vector<int16_t> block(4096);
+    std::vector<bool> bits;
+    bits.reserve(signal.size() / params.samplesPerFrame + 16);
+    auto transaction = [&]() {
+        ASSERT_TRUE(riif.prepare(message));
+        while (riif.render(block.data(), block.size()) > 0) {
+        }
+        bits.clear();
+        ASSERT_TRUE(riif.beginReceive(params.sampleRate));
+        for (size_t i = 0; i < signal.size(); i += block.size()) {
+            riif.receive(signal.data() + i, std::min(block.size(), signal.size() - i), bits);
+        }
+        riif.endReceive(bits);
+    };
+
+    transaction();  // first use sizes the buffers
+    std::vector<bool> first = bits;
+
+    g_allocations = 0;
+    g_count_allocations = true;
+    transaction();
+    transaction();
+    g_count_allocations = false;
+
+    EXPECT_EQ(0u, g_allocations.load()) << "Steady-state transactions touched the heap";
+    EXPECT_EQ(first, bits);
+}
+
+TEST(RiifUltrasonicCoreTest, ProfileSwitchTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters low = riif.getParameters();
+    low.df = 1000.0f;
+    low.samplesPerFrame = 512;
+    RiifUltrasonic::Parameters high = low;
+    high.f0 = 18000.0;
+
+    int low_id = riif.registerProfile(low);
+    int high_id = riif.registerProfile(high);
+    EXPECT_NE(low_id, high_id);
+    EXPECT_EQ(low_id, riif.registerProfile(low));
+    EXPECT_EQ(-1, riif.activeProfile());
+    EXPECT_FALSE(riif.selectProfile(high_id + 1));
+
+    // Reference output from instances that were only ever configured once
+    RiifUltrasonic low_ref, high_ref;
+    low_ref.setParameters(low);
+    high_ref.setParameters(high);
+    std::string message = "Loyalty 7731";
+    std::vector<int16_t> low_signal = low_ref.encode(message);
+    std::vector<int16_t> high_signal = high_ref.encode(message);
+    std::vector<bool> low_bits = low_ref.decode(low_signal);
+    std::vector<bool> high_bits = high_ref.decode(high_signal);
+
+    std::vector<int16_t> block(4096);
+    std::vector<bool> bits;
+    bits.reserve(low_signal.size() / low.samplesPerFrame + 16);
+    auto transaction = [&](int id, const std::vector<int16_t>& signal) {
+        ASSERT_TRUE(riif.selectProfile(id));
+        ASSERT_TRUE(riif.prepare(message));
+        while (riif.render(block.data(), block.size()) > 0) {
+        }
+        bits.clear();
+        ASSERT_TRUE(riif.beginReceive(riif.getParameters().sampleRate));
+        for (size_t i = 0; i < signal.size(); i += block.size()) {
+            riif.receive(signal.data() + i, std::min(block.size(), signal.size() - i), bits);
+        }
+        riif.endReceive(bits);
+    };
+
+    transaction(low_id, low_signal);
+    EXPECT_EQ(low_bits, bits);
+    transaction(high_id, high_signal);
+    EXPECT_EQ(high_bits, bits);
+    EXPECT_EQ(high_id, riif.activeProfile());
+    EXPECT_EQ(high.f0, riif.getParameters().f0);
+
+    g_allocations = 0;
+    g_count_allocations = true;
+    transaction(low_id, low_signal);
+    transaction(high_id, high_signal);
+    g_count_allocations = false;
+
+    EXPECT_EQ(0u, g_allocations.load()) << "Switching profiles touched the heap";
+    EXPECT_EQ(high_bits, bits);
+
+    ASSERT_TRUE(riif.selectProfile(low_id));
+    EXPECT_EQ(low_signal, riif.encode(message));
+    EXPECT_EQ(low_bits, riif.decode(low_signal));
+
+    // A front end is kept per capture rate, so alternating rates does not allocate either
+    auto receive_at = [&](int rate) {
+        bits.clear();
+        ASSERT_TRUE(riif.beginReceive(rate));
+        for (size_t i = 0; i < low_signal.size(); i += block.size()) {
+            riif.receive(low_signal.data() + i, std::min(block.size(), low_signal.size() - i), bits);
+        }
+        riif.endReceive(bits);
+    };
+    receive_at(44100);
+    receive_at(low.sampleRate);
+    g_allocations = 0;
+    g_count_allocations = true;
+    receive_at(44100);
+    receive_at(low.sampleRate);
+    g_count_allocations = false;
+    EXPECT_EQ(0u, g_allocations.load()) << "Switching capture rates touched the heap";
+    EXPECT_EQ(low_bits, bits);
+}
+
+TEST(RiifUltrasonicCoreTest, SealedPayloadTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+
+    uint8_t key[ChaCha20Poly1305::KEY_SIZE];
+    uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE] = {1, 2, 3};
+    for (size_t i = 0; i < sizeof(key); ++i) {
+        key[i] = static_cast<uint8_t>(i * 29 + 3);
+    }
+    ChaCha20Poly1305 aead(key);
+
+    std::string payload = "txn=88213;amount=12.50";
+    const uint8_t* plain = reinterpret_cast<const uint8_t*>(payload.data());
+    ASSERT_TRUE(riif.prepareSealed(aead, nonce, plain, payload.size()));
+    std::vector<int16_t> signal(riif.pendingFrames());
+    riif.render(signal.data(), signal.size());
+
+    // The plaintext never goes over the air
+    std::vector<bool> bits = riif.decode(signal);
+    std::string on_air;
+    for (size_t i = 0; i + 8 <= bits.size() && on_air.size() < payload.size(); i += 8) {
+        char c = 0;
+        for (int b = 0; b < 8; ++b) {
+            c = static_cast<char>((c << 1) | (bits[i + b] ? 1 : 0));
+        }
+        on_air.push_back(c);
+    }
+    EXPECT_NE(payload, on_air);
+
+    std::vector<uint8_t> opened(payload.size());
+    ASSERT_TRUE(riif.openSealed(bits, aead, nonce, opened.data(), opened.size()));
+    EXPECT_EQ(payload, std::string(opened.begin(), opened.end()));
+
+    // A wrong nonce or key fails authentication; an oversized payload is refused
+    nonce[0] ^= 1;
+    EXPECT_FALSE(riif.openSealed(bits, aead, nonce, opened.data(), opened.size()));
+    std::vector<uint8_t> too_long(params.rsMsgLength);
+    EXPECT_FALSE(riif.prepareSealed(aead, nonce, too_long.data(), too_long.size()));
+}
+
+TEST(RiifUltrasonicCoreTest, ShortenedCodewordTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    riif.setParameters(params);
+    const size_t full_length = riif.encode("PAY 4.20").size();
+    EXPECT_EQ(static_cast<size_t>(params.rsMsgLength), riif.messageCapacity());
+
+    params.shortenCodewords = true;
+    riif.setParameters(params);
+    EXPECT_EQ(static_cast<size_t>(params.rsMsgLength - 1), riif.messageCapacity());
+
+    // Only the length header, the message and the parity go over the air
+    std::string message = "PAY 4.20";
+    std::vector<int16_t> signal = riif.encode(message);
+    size_t padding = full_length - static_cast<size_t>(params.rsMsgLength + params.rsEccLength) * 8 * params.samplesPerFrame;
+    EXPECT_EQ((2 + message.size() + params.rsEccLength) * 8 * params.samplesPerFrame + padding, signal.size());
+    EXPECT_LT(signal.size(), full_length);
+
+    std::vector<bool> bits = riif.decode(signal);
+    std::vector<uint8_t> decoded = riif.decodeMessage(bits);
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+
+    // A flipped bit in each header byte and a few byte errors in the message are corrected
+    bits[3] = !bits[3];
+    bits[12] = !bits[12];
+    for (size_t i = 16; i < 40; i += 9) {
+        bits[i] = !bits[i];
+    }
+    decoded = riif.decodeMessage(bits);
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+
+    // A header claiming another length does not decode into a wrong message
+    bits[0] = !bits[0];
+    bits[1] = !bits[1];
+    EXPECT_TRUE(riif.decodeMessage(bits).empty());
+
+    // Sealed payloads shrink the same way
+    uint8_t key[ChaCha20Poly1305::KEY_SIZE] = {7};
+    uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE] = {9};
+    ChaCha20Poly1305 aead(key);
+    const uint8_t plain[] = {1, 2, 3, 4, 5};
+    ASSERT_TRUE(riif.prepareSealed(aead, nonce, plain, sizeof(plain)));
+    signal.assign(riif.pendingFrames(), 0);
+    riif.render(signal.data(), signal.size());
+    EXPECT_LT(signal.size(), full_length);
+    uint8_t opened[sizeof(plain)];
+    ASSERT_TRUE(riif.openSealed(riif.decode(signal), aead, nonce, opened, sizeof(opened)));
+    EXPECT_TRUE(std::equal(plain, plain + sizeof(plain), opened));
+
+    // Batches lay out each transmission at its own length
+    RiifUltrasonic::EncodedBatch batch = riif.encodeBatch(std::vector<std::string>{"A", message});
+    ASSERT_EQ(3u, batch.offsets.size());
+    EXPECT_EQ(batch.offsets[2] - batch.offsets[1] - (batch.offsets[1] - batch.offsets[0]),
+              (message.size() - 1) * 8 * static_cast<size_t>(params.samplesPerFrame));
+}
+
+TEST(RiifUltrasonicCoreTest, IncrementalFrameDecodeTest) {
+    RiifUltrasonic riif;
+
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    params.shortenCodewords = true;
+    riif.setParameters(params);
+
+    std::string message = "txn=88213;amount=12.50";
+    std::vector<int16_t> signal = riif.encode(message);
+
+    // The frame completes while the capture is still streaming in
+    std::vector<bool> bits;
+    ASSERT_TRUE(riif.beginReceive(params.sampleRate));
+    riif.beginFrame();
+    bool complete = false;
+    size_t fed = 0;
+    const size_t block = 4096;
+    for (size_t i = 0; i < signal.size() && !complete; i += block) {
+        riif.receive(signal.data() + i, std::min(block, signal.size() - i), bits);
+        complete = riif.feedFrame(bits);
+        fed = i + block;
+    }
+    if (!complete) {
+        riif.endReceive(bits);
+        complete = riif.feedFrame(bits);
+    }
+    ASSERT_TRUE(complete);
+    EXPECT_LE(fed, signal.size());
+    std::vector<uint8_t> decoded = riif.finishFrame();
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+
+    // Errors found by the streamed syndromes are corrected like a one-shot decode
+    bits = riif.decode(signal);
+    for (size_t i = 20; i < 20 + 8 * 10; i += 8) {
+        bits[i] = !bits[i];
+    }
+    riif.beginFrame();
+    for (size_t n = 0; n <= bits.size(); n += 13) {
+        riif.feedFrame(std::vector<bool>(bits.begin(), bits.begin() + std::min(n, bits.size())));
+    }
+    EXPECT_TRUE(riif.feedFrame(bits));
+    decoded = riif.finishFrame();
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+    EXPECT_EQ(decoded, riif.decodeMessage(bits));
+
+    // Full-length codewords stream the same way; a truncated frame is not complete
+    params.shortenCodewords = false;
+    riif.setParameters(params);
+    bits = riif.decode(riif.encode(message));
+    riif.beginFrame();
+    EXPECT_FALSE(riif.feedFrame(std::vector<bool>(bits.begin(), bits.begin() + 100 * 8)));
+    EXPECT_TRUE(riif.finishFrame().empty());
+    EXPECT_TRUE(riif.feedFrame(bits));
+    decoded = riif.finishFrame();
+    ASSERT_EQ(static_cast<size_t>(params.rsMsgLength), decoded.size());
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.begin() + message.size()));
+}
+
+TEST(RiifUltrasonicCoreTest, PackedBitStreamTest) {
+    // Symbols of mixed widths straddle the word boundaries and come back whole
+    BitStream stream;
+    std::mt19937 gen(44);
+    std::vector<std::pair<uint64_t, unsigned>> symbols;
+    for (int i = 0; i < 200; ++i) {
+        unsigned width = 1 + gen() % 64;
+        uint64_t value = (static_cast<uint64_t>(gen()) << 32 | gen()) & (width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1);
+        symbols.emplace_back(value, width);
+        stream.append(value, width);
+    }
+    size_t pos = 0;
+    for (const auto& symbol : symbols) {
+        ASSERT_EQ(symbol.first, stream.extract(pos, symbol.second)) << "at bit " << pos;
+        pos += symbol.second;
+    }
+    EXPECT_EQ(pos, stream.size());
+
+    // Bytes go in a word at a time and read back in the same bit order as single bits
+    const uint8_t bytes[] = {0xA5, 0x01, 0xFF, 0x00, 0x3C, 0x80, 0x7E, 0x11, 0x42};
+    stream.clear();
+    stream.push_back(true);
+    stream.clear();
+    stream.appendBytes(bytes, sizeof(bytes));
+    ASSERT_EQ(sizeof(bytes) * 8, stream.size());
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        EXPECT_EQ(bytes[i], stream.byteAt(i));
+        for (int b = 0; b < 8; ++b) {
+            EXPECT_EQ(((bytes[i] >> (7 - b)) & 1) != 0, stream[i * 8 + b]);
+        }
+    }
+    EXPECT_EQ(stream, BitStream(stream.toBools()));
+
+    // The receiver fills either container with the same bits, and both decode the same
+    RiifUltrasonic riif;
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    params.shortenCodewords = true;
+    riif.setParameters(params);
+    std::string message = "PAY 7.10";
+    std::vector<int16_t> signal = riif.encode(message);
+    std::vector<bool> bools = riif.decode(signal);
+    BitStream packed;
+    riif.decode(signal.data(), signal.size(), params.sampleRate, packed);
+    EXPECT_EQ(BitStream(bools), packed);
+    std::vector<uint8_t> decoded = riif.decodeMessage(packed);
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+}
+
+struct FastStaticProfile : StaticProfile {
+    static constexpr int samplesPerFrame = 512;
+    static constexpr double df = 1000.0;
+    static constexpr bool shortenCodewords = true;
+};
+
+TEST(RiifUltrasonicCoreTest, CompileTimeProfileTest) {
+    using FastCodec = RiifUltrasonicT<FastStaticProfile>;
+    static_assert(FastCodec::TONE_BINS[0] == 160 && FastCodec::TONE_BINS[1] == 171, "tone bins at compile time");
+    static_assert(RS::gf::mul(0x53, 0xCA) == 0x8F, "GF tables at compile time");
+    EXPECT_EQ(RiifUltrasonic::Parameters(), RiifUltrasonicT<>::parameters());
+
+    // The same transmission as the run-time codec, give or take a rounding of the templates
+    FastCodec codec;
+    RiifUltrasonic riif;
+    riif.setParameters(FastCodec::parameters());
+    std::string message = "PAY 7.10";
+    std::vector<int16_t> fixed = codec.encode(message);
+    std::vector<int16_t> runtime = riif.encode(message);
+    ASSERT_EQ(runtime.size(), fixed.size());
+    EXPECT_EQ(FastCodec::transmitFrames(message.size()), fixed.size());
+    int worst = 0;
+    for (size_t i = 0; i < fixed.size(); ++i) {
+        worst = std::max(worst, std::abs(fixed[i] - runtime[i]));
+    }
+    EXPECT_LE(worst, 1);
+
+    // The FFT table is what rdft() builds on first use
+    std::vector<float> scratch(FastStaticProfile::samplesPerFrame, 0.0f);
+    std::vector<int> ip(static_tables::rdftWorkSize(scratch.size()), 0);
+    std::vector<float> table(scratch.size() / 2);
+    rdft(static_cast<int>(scratch.size()), 1, scratch.data(), ip.data(), table.data());
+    for (size_t i = 0; i < table.size(); ++i) {
+        EXPECT_NEAR(table[i], FastCodec::fftTable()[i], 1e-6f) << "at " << i;
+    }
+    // and transforming over it read-only gives rdft()'s spectrum
+    std::vector<float> spectrum(scratch.size());
+    for (size_t i = 0; i < scratch.size(); ++i) {
+        scratch[i] = spectrum[i] = fixed[i] / 32768.0f;
+    }
+    rdft(static_cast<int>(scratch.size()), 1, scratch.data(), ip.data(), table.data());
+    rdftForward(static_cast<int>(spectrum.size()), spectrum.data(), ip.data(), FastCodec::fftTable());
+    for (size_t i = 0; i < spectrum.size(); ++i) {
+        EXPECT_NEAR(scratch[i], spectrum[i], 1e-4f) << "at " << i;
+    }
+
+    // Either receiver decodes it
+    std::vector<uint8_t> decoded = riif.decodeMessage(riif.decode(fixed));
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+    BitStream bits;
+    codec.demodulate(fixed.data(), fixed.size(), bits);
+    decoded = codec.decodeMessage(bits);
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+}
+
+TEST(RiifUltrasonicCoreTest, TraceEventsTest) {
+    // Each thread records into its own ring, which keeps the most recent events
+    trace::clear();
+    const char* names[] = {"first", "second"};
+    for (size_t i = 0; i < trace::EVENTS_PER_THREAD + 10; ++i) {
+        trace::record(names[i % 2], 1000 * i, 1000 * i + 500);
+    }
+    std::thread worker([] { trace::Scope scope("worker"); });
+    worker.join();
+
+    std::vector<trace::Event> events = trace::collect();
+    ASSERT_EQ(trace::EVENTS_PER_THREAD + 1, events.size());
+    EXPECT_EQ(10000u, events.front().begin);
+    EXPECT_EQ(1000 * (trace::EVENTS_PER_THREAD + 9) + 500, events[trace::EVENTS_PER_THREAD - 1].end);
+    EXPECT_STREQ("worker", events.back().name);
+    EXPECT_NE(events.front().thread, events.back().thread);
+
+    std::string json = trace::chromeJson();
+    EXPECT_EQ(0u, json.find("{\"traceEvents\":["));
+    EXPECT_NE(std::string::npos, json.find("{\"name\":\"second\",\"cat\":\"riif\",\"ph\":\"X\",\"pid\":1,\"tid\":"));
+    EXPECT_NE(std::string::npos, json.find("\"ts\":0.000,\"dur\":0.500}"));
+    trace::clear();
+    EXPECT_TRUE(trace::collect().empty());
+
+    // The codec's scopes are only there when built with RIIF_ENABLE_TRACE
+    RiifUltrasonic riif;
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    params.shortenCodewords = true;
+    riif.setParameters(params);
+    std::vector<uint8_t> decoded = riif.decodeMessage(riif.decode(riif.encode("PAY 7.10")));
+    EXPECT_EQ("PAY 7.10", std::string(decoded.begin(), decoded.end()));
+    std::vector<std::string> stages;
+    for (const trace::Event& e : trace::collect()) {
+        stages.push_back(e.name);
+    }
+#ifdef RIIF_ENABLE_TRACE
+    for (const char* stage : {"encode", "rs.encode", "decode", "acquire", "align", "fft", "rs.decode"}) {
+        EXPECT_NE(stages.end(), std::find(stages.begin(), stages.end(), stage)) << stage;
+    }
+#else
+    EXPECT_TRUE(stages.empty());
+#endif
+}
+
+TEST(RiifUltrasonicCoreTest, DiagnosticCaptureTest) {
+    RiifUltrasonic riif;
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    params.shortenCodewords = true;
+    riif.setParameters(params);
+    std::vector<int16_t> signal = riif.encode("PAY 7.10");
+
+    riif.enableDiagnostics(4096);
+    std::vector<bool> bits = riif.decode(signal);
+    DiagnosticSnapshot snap = riif.diagnostics();
+    ASSERT_EQ(bits.size(), snap.symbols.size());
+    for (size_t i = 0; i < bits.size(); ++i) {
+        EXPECT_EQ(bits[i] ? 1 : 0, snap.symbols[i].bit);
+    }
+    ASSERT_FALSE(snap.frames.empty());
+    ASSERT_EQ(snap.frames.size() * snap.bins, snap.magnitudes.size());
+
+    // The loudest column of the spectrogram is one of the tones
+    std::vector<double> columns(snap.bins, 0.0);
+    for (size_t i = 0; i < snap.magnitudes.size(); ++i) {
+        columns[i % snap.bins] += snap.magnitudes[i];
+    }
+    size_t loudest = std::max_element(columns.begin(), columns.end()) - columns.begin();
+    double hz = snap.firstBinHz + loudest * snap.binHz;
+    EXPECT_LE(std::min(std::abs(hz - params.f0), std::abs(hz - params.f0 - params.df)), snap.binHz);
+    EXPECT_NEAR(params.samplesPerFrame / 4.0 / params.sampleRate, snap.frameSeconds, 1e-9);
+
+    std::ostringstream pgm;
+    ASSERT_TRUE(snap.writePGM(pgm));
+    std::string header = "P5\n" + std::to_string(snap.bins) + " " + std::to_string(snap.frames.size()) + "\n255\n";
+    EXPECT_EQ(0u, pgm.str().find(header));
+    EXPECT_EQ(header.size() + snap.magnitudes.size(), pgm.str().size());
+    std::ostringstream binary;
+    ASSERT_TRUE(snap.writeBinary(binary));
+    EXPECT_EQ(0u, binary.str().find("RIFD"));
+    EXPECT_EQ(40 + snap.magnitudes.size() + 16 * snap.frames.size() + 17 * snap.symbols.size(), binary.str().size());
+
+    // The ring keeps the most recent entries, and recording can be turned off
+    riif.enableDiagnostics(16);
+    riif.decode(signal);
+    snap = riif.diagnostics();
+    ASSERT_EQ(16u, snap.symbols.size());
+    EXPECT_EQ(16u, snap.frames.size());
+    for (size_t i = 0; i < 16; ++i) {
+        EXPECT_EQ(bits[bits.size() - 16 + i] ? 1 : 0, snap.symbols[i].bit);
+    }
+    riif.enableDiagnostics(0);
+    riif.decode(signal);
+    EXPECT_TRUE(riif.diagnostics().symbols.empty());
+}
+
+TEST(RiifUltrasonicCoreTest, AdaptivePlanTest) {
+    RiifUltrasonic riif;
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    params.shortenCodewords = true;
+    params.planChannels = 3;
+    riif.setParameters(params);
+    const int profile = riif.activeProfile();
+
+    // Channel k has its tones at f0 + 2k * df and f0 + (2k + 1) * df; jam both of a channel's
+    std::mt19937 gen(49);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    auto jammed = [&](std::vector<int16_t> audio, size_t length, int channel) {
+        audio.resize(length, 0);
+        for (size_t n = 0; n < audio.size(); ++n) {
+            double f = params.f0 + 2 * channel * params.df;
+            float jam = 0.3f * std::sin(2 * M_PI * f * n / params.sampleRate) +
+                        0.3f * std::sin(2 * M_PI * (f + params.df) * n / params.sampleRate + 1.0);
+            float sample = audio[n] / 32768.0f + jam + noise(gen);
+            audio[n] = static_cast<int16_t>(std::max(-1.0f, std::min(1.0f, sample)) * 32767);
+        }
+        return audio;
+    };
+
+    for (int channel = 0; channel < 3; ++channel) {
+        std::vector<int16_t> listen = jammed({}, params.sampleRate / 4, channel);
+        RiifUltrasonic::BandSurvey survey = riif.surveyBand(listen.data(), listen.size(), params.sampleRate);
+        ASSERT_EQ(3u, survey.noise.size());
+        EXPECT_NE(channel, survey.best);
+        EXPECT_GT(survey.noise[channel], 10 * survey.noise[survey.best]);
+    }
+
+    // A frame moved off a jammed channel is found through the header
+    std::string message = "PAY 7.10";
+    std::vector<int16_t> signal = riif.encodeOnChannel(message, 2);
+    ASSERT_FALSE(signal.empty());
+    std::vector<int16_t> capture = jammed(signal, signal.size(), 1);
+    EXPECT_EQ(2, riif.readPlanHeader(capture.data(), capture.size(), params.sampleRate));
+    std::vector<uint8_t> decoded = riif.decodeAdaptive(capture.data(), capture.size(), params.sampleRate);
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+    EXPECT_EQ(profile, riif.activeProfile());
+
+    // The header is on every channel, so jamming channel 0 does not hide it
+    signal = riif.encodeOnChannel(message, 1);
+    capture = jammed(signal, signal.size(), 0);
+    EXPECT_EQ(1, riif.readPlanHeader(capture.data(), capture.size(), params.sampleRate));
+    decoded = riif.decodeAdaptive(capture.data(), capture.size(), params.sampleRate);
+    EXPECT_EQ(message, std::string(decoded.begin(), decoded.end()));
+    EXPECT_EQ(profile, riif.activeProfile());
+
+    // Channels past the plan, or with a tone past Nyquist, are refused
+    EXPECT_TRUE(riif.encodeOnChannel(message, 3).empty());
+    params.planChannels = 8;
+    riif.setParameters(params);
+    EXPECT_FALSE(riif.encodeOnChannel(message, 3).empty());
+    EXPECT_TRUE(riif.encodeOnChannel(message, 4).empty());
+}
+
+TEST(RiifUltrasonicCoreTest, AdaptivePlanIsolationTest) {
+    RiifUltrasonic riif;
+    RiifUltrasonic::Parameters params = riif.getParameters();
+    params.df = 1000.0f;
+    params.samplesPerFrame = 512;
+    params.shortenCodewords = true;
+    params.planChannels = 3;
+    riif.setParameters(params);
+    const int profile = riif.activeProfile();
+
+    std::vector<int16_t> stream = riif.encode("REFUND 3.25");
+    std::vector<int16_t> adaptive = riif.encodeOnChannel("PAY 7.10", 1);
+
+    // An adaptive decode between two blocks of a streaming receive leaves the receive going
+    BitStream bits;
+    ASSERT_TRUE(riif.beginReceive(params.sampleRate));
+    riif.beginFrame();
+    const size_t half = stream.size() / 2;
+    riif.receive(stream.data(), half, bits);
+    riif.feedFrame(bits);
+
+    std::vector<uint8_t> decoded = riif.decodeAdaptive(adaptive.data(), adaptive.size(), params.sampleRate);
+    EXPECT_EQ("PAY 7.10", std::string(decoded.begin(), decoded.end()));
+    EXPECT_EQ(1, riif.readPlanHeader(adaptive.data(), adaptive.size(), params.sampleRate));
+
+    riif.receive(stream.data() + half, stream.size() - half, bits);
+    riif.endReceive(bits);
+    riif.feedFrame(bits);
+    decoded = riif.finishFrame();
+    EXPECT_EQ("REFUND 3.25", std::string(decoded.begin(), decoded.end()));
+    EXPECT_EQ(profile, riif.activeProfile());
+
+    // The channels belong to the plan: the next parameter set still gets the next id
+    RiifUltrasonic::Parameters other = params;
+    other.planChannels = 1;
+    EXPECT_EQ(profile + 1, riif.registerProfile(other));
+}